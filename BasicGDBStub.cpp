@@ -7,104 +7,155 @@ using namespace GDBServerFoundation;
 
 StubResponse BasicGDBStub::HandleRequest( const BazisLib::TempStringA &requestType, char splitterChar, const BazisLib::TempStringA &requestData )
 {
-	//requestData is the part of the request following the first ',', ';' or ':' character
-	if (requestType.length() < 1)
-		return StandardResponses::CommandNotSupported;
-
-	size_t idx, idx2;
+	//The reply to the previous request has already been sent, so nothing refers to the arena memory anymore
+	m_SessionArena.Reset();
 
-	switch(requestType[0])
+	//requestData is the part of the request following the first ',', ';' or ':' character
+	GDBRequest request;
+	bool malformed = false;
+	PacketHandler pHandler = m_PacketTable.Find(requestType, splitterChar, requestData, &request, &malformed);
+	if (!pHandler)
 	{
-	case 'q':
-		if (requestType == "qSupported")
-			return Handle_qSupported(requestData);
-		else if (requestType == "qfThreadInfo")
-			return Handle_qfThreadInfo();
-		else if (requestType == "qsThreadInfo")
-			return Handle_qsThreadInfo();
-		else if (requestType == "qThreadExtraInfo")
-			return Handle_qThreadExtraInfo(requestData);
-		else if (requestType == "qC")
-			return Handle_qC();
-		else if (requestType == "qCRC")
-		{
-			idx = requestData.find(',');
-			if (idx == -1)
-				break;
-			return Handle_qCRC(requestData.substr(0, idx), requestData.substr(idx + 1));
-		}
-		else if (requestType == "qRcmd")
-			return Handle_qRcmd(requestData);
-		break;
-	case 'H':
-		return Handle_H(requestType);
-	case '?':
-		return Handle_QueryStopReason();
-	case 'g':
-		return Handle_g(GetThreadIDForOp(true));
-	case 'G':
-		return Handle_G(GetThreadIDForOp(true), requestType.substr(1));
-	case 'P':
-		idx = requestType.find('=');
-		if (idx == -1)
-			break;
-		return Handle_P(GetThreadIDForOp(true), requestType.substr(1, idx - 1), requestType.substr(idx + 1));
-	case 'm':
-		return Handle_m(requestType.substr(1), requestData);
-	case 'M':
-		idx = requestData.find(':');
-		if (idx == -1)
-			break;
-		return Handle_M(requestType.substr(1), requestData.substr(0, idx), requestData.substr(idx + 1));
-	case 'X':
-		idx = requestData.find(':');
-		if (idx == -1)
-			break;
-		return Handle_X(requestType.substr(1), requestData.substr(0, idx), requestData.substr(idx + 1));
-	case 'c':
-		return Handle_c(GetThreadIDForOp(false));
-	case 's':
-		return Handle_s(GetThreadIDForOp(false));
-	case 'T':
-		return Handle_T(requestType.substr(1));
-	case 'v':
-		if (requestType == "vCont?")
-			return Handle_vCont(requestType.substr(5));
-		else if (requestType == "vCont")
-			return Handle_vCont(requestData);
-		else if (requestType == "vFlashErase")
-		{
-			idx = requestData.find(',');
-			if (idx == -1)
-				break;
-			return Handle_vFlashErase(requestData.substr(0, idx), requestData.substr(idx + 1));
-		}
-		else if (requestType == "vFlashWrite")
-		{
-			idx = requestData.find(':');
-			if (idx == -1)
-				break;
-			return Handle_vFlashWrite(requestData.substr(0, idx), requestData.substr(idx + 1));
-		}
-		else if (requestType == "vFlashDone")
-			return Handle_vFlashDone();
-		break;
-	case 'k':
-		return Handle_k();
-	case 'Z':
-	case 'z':
-		if (requestType.length() != 2)
-			break;
-		idx2 = requestData.find(';');
-		if (idx2 == -1)
-			idx2 = requestData.length();
-		idx = requestData.find(',');
-		if (idx == -1)
-			break;
-		return Handle_Zz((requestType[0] == 'Z'), requestType[1], requestData.substr(0, idx), requestData.substr(idx + 1, idx2 - idx + 1), requestData.substr(idx2));
+		//An empty reply would make GDB assume that the packet is not supported at all and stop sending it
+		return malformed ? StandardResponses::InvalidArgument : StandardResponses::CommandNotSupported;
 	}
 
-	return StandardResponses::CommandNotSupported;
+	return (this->*pHandler)(request);
+}
+
+StubResponse BasicGDBStub::Dispatch_qSupported(const GDBRequest &request)
+{
+	return Handle_qSupported(*request.pData);
+}
+
+StubResponse BasicGDBStub::Dispatch_qfThreadInfo(const GDBRequest &request)
+{
+	return Handle_qfThreadInfo();
+}
+
+StubResponse BasicGDBStub::Dispatch_qsThreadInfo(const GDBRequest &request)
+{
+	return Handle_qsThreadInfo();
+}
+
+StubResponse BasicGDBStub::Dispatch_qThreadExtraInfo(const GDBRequest &request)
+{
+	return Handle_qThreadExtraInfo(request.ThreadID);
+}
+
+StubResponse BasicGDBStub::Dispatch_qC(const GDBRequest &request)
+{
+	return Handle_qC();
+}
+
+StubResponse BasicGDBStub::Dispatch_qCRC(const GDBRequest &request)
+{
+	return Handle_qCRC(request.Address, request.Length);
+}
+
+StubResponse BasicGDBStub::Dispatch_qRcmd(const GDBRequest &request)
+{
+	return Handle_qRcmd(*request.pData);
+}
+
+StubResponse BasicGDBStub::Dispatch_H(const GDBRequest &request)
+{
+	return Handle_H(request.Char, request.ThreadID);
+}
+
+StubResponse BasicGDBStub::Dispatch_QueryStopReason(const GDBRequest &request)
+{
+	return Handle_QueryStopReason();
+}
+
+StubResponse BasicGDBStub::Dispatch_g(const GDBRequest &request)
+{
+	return Handle_g(GetThreadIDForOp(true));
+}
+
+StubResponse BasicGDBStub::Dispatch_G(const GDBRequest &request)
+{
+	return Handle_G(GetThreadIDForOp(true), request.GetPayload());
+}
+
+StubResponse BasicGDBStub::Dispatch_P(const GDBRequest &request)
+{
+	return Handle_P(GetThreadIDForOp(true), request.Number, request.GetPayload());
+}
+
+StubResponse BasicGDBStub::Dispatch_p(const GDBRequest &request)
+{
+	return Handle_p(GetThreadIDForOp(true), request.Number);
+}
+
+StubResponse BasicGDBStub::Dispatch_m(const GDBRequest &request)
+{
+	return Handle_m(request.Address, request.Length);
+}
+
+StubResponse BasicGDBStub::Dispatch_M(const GDBRequest &request)
+{
+	return Handle_M(request.Address, request.Length, request.GetPayload());
+}
+
+StubResponse BasicGDBStub::Dispatch_X(const GDBRequest &request)
+{
+	return Handle_X(request.Address, request.Length, request.GetPayload());
+}
+
+StubResponse BasicGDBStub::Dispatch_c(const GDBRequest &request)
+{
+	return Handle_c(GetThreadIDForOp(false));
+}
+
+StubResponse BasicGDBStub::Dispatch_s(const GDBRequest &request)
+{
+	return Handle_s(GetThreadIDForOp(false));
+}
+
+StubResponse BasicGDBStub::Dispatch_T(const GDBRequest &request)
+{
+	return Handle_T(request.ThreadID);
+}
+
+StubResponse BasicGDBStub::Dispatch_vContQuery(const GDBRequest &request)
+{
+	return Handle_vCont(request.pType->substr(5));
+}
+
+StubResponse BasicGDBStub::Dispatch_vCont(const GDBRequest &request)
+{
+	return Handle_vCont(*request.pData);
+}
+
+StubResponse BasicGDBStub::Dispatch_vFlashErase(const GDBRequest &request)
+{
+	return Handle_vFlashErase(request.Address, request.Length);
+}
+
+StubResponse BasicGDBStub::Dispatch_vFlashWrite(const GDBRequest &request)
+{
+	return Handle_vFlashWrite(request.Address, request.GetPayload());
+}
+
+StubResponse BasicGDBStub::Dispatch_vFlashDone(const GDBRequest &request)
+{
+	return Handle_vFlashDone();
+}
+
+StubResponse BasicGDBStub::Dispatch_k(const GDBRequest &request)
+{
+	return Handle_k();
+}
+
+StubResponse BasicGDBStub::Dispatch_Z(const GDBRequest &request)
+{
+	return Handle_Zz(true, request.Char, request.Address, request.Number, request.GetPayload());
+}
+
+StubResponse BasicGDBStub::Dispatch_z(const GDBRequest &request)
+{
+	return Handle_Zz(false, request.Char, request.Address, request.Number, request.GetPayload());
 }
 
 template <class _Splitter> static void FillMapFromSplitter(_Splitter &spl, std::map<std::string, std::string> &strMap)
@@ -139,6 +190,9 @@ StubResponse BasicGDBStub::Handle_qSupported( const BazisLib::TempStringA &reque
 	m_GDBFeatures.clear();
 	FillMapFromSplitter(requestData.SplitByMarker(';'), m_GDBFeatures);
 
+	m_bReportSwBreak = IsFeatureNegotiated("swbreak");
+	m_bReportHwBreak = IsFeatureNegotiated("hwbreak");
+
 	StubResponse response;
 
 	for(std::map<std::string, std::string>::iterator it = m_StubFeatures.begin(); it != m_StubFeatures.end(); it++)
@@ -155,34 +209,75 @@ StubResponse BasicGDBStub::Handle_qSupported( const BazisLib::TempStringA &reque
 }
 
 GDBServerFoundation::BasicGDBStub::BasicGDBStub()
+	: m_bReportSwBreak(false)
+	, m_bReportHwBreak(false)
+	, m_pBreakInMonitor(NULL)
+	, m_MaxPacketSize(0)
 {
-	//m_StubFeatures["PacketSize"] = "4000";	//0x4000
+	SetMaxPacketSize(kDefaultMaxPacketSize);
 	m_StubFeatures["QStartNoAckMode"] = "+";
+
+	//The arguments that are not parsed here (NULL grammar) are either ignored or passed to the handlers as is
+	static constexpr PacketTable<BasicGDBStub>::PacketDescriptor builtinPackets[] = {
+		{"qSupported",			NULL,			&BasicGDBStub::Dispatch_qSupported},
+		{"qfThreadInfo",		NULL,			&BasicGDBStub::Dispatch_qfThreadInfo},
+		{"qsThreadInfo",		NULL,			&BasicGDBStub::Dispatch_qsThreadInfo},
+		{"qThreadExtraInfo",	",T",			&BasicGDBStub::Dispatch_qThreadExtraInfo},
+		{"qC",					NULL,			&BasicGDBStub::Dispatch_qC},
+		{"qCRC",				":A,L",			&BasicGDBStub::Dispatch_qCRC},
+		{"qRcmd",				NULL,			&BasicGDBStub::Dispatch_qRcmd},
+		{"H",					"CT",			&BasicGDBStub::Dispatch_H},
+		{"?",					NULL,			&BasicGDBStub::Dispatch_QueryStopReason},
+		{"g",					NULL,			&BasicGDBStub::Dispatch_g},
+		{"G",					"*",			&BasicGDBStub::Dispatch_G},
+		{"P",					"N=*",			&BasicGDBStub::Dispatch_P},
+		{"p",					"N",			&BasicGDBStub::Dispatch_p},
+		{"m",					"A,L",			&BasicGDBStub::Dispatch_m},
+		{"M",					"A,L:*",		&BasicGDBStub::Dispatch_M},
+		{"X",					"A,L:*",		&BasicGDBStub::Dispatch_X},
+		{"c",					NULL,			&BasicGDBStub::Dispatch_c},
+		{"s",					NULL,			&BasicGDBStub::Dispatch_s},
+		{"T",					"T",			&BasicGDBStub::Dispatch_T},
+		{"vCont?",				NULL,			&BasicGDBStub::Dispatch_vContQuery},
+		{"vCont",				NULL,			&BasicGDBStub::Dispatch_vCont},
+		{"vFlashErase",			":A,L",			&BasicGDBStub::Dispatch_vFlashErase},
+		{"vFlashWrite",			":A:*",			&BasicGDBStub::Dispatch_vFlashWrite},
+		{"vFlashDone",			NULL,			&BasicGDBStub::Dispatch_vFlashDone},
+		{"k",					NULL,			&BasicGDBStub::Dispatch_k},
+		{"Z",					"C,A,N*",		&BasicGDBStub::Dispatch_Z},
+		{"z",					"C,A,N*",		&BasicGDBStub::Dispatch_z},
+	};
+
+	static_assert(PacketTableBase::ValidateDescriptors(builtinPackets), "Duplicate packet names or too many string fields");
+	m_PacketTable.Register(builtinPackets);
 }
 
-GDBServerFoundation::StubResponse GDBServerFoundation::BasicGDBStub::Handle_H( const BazisLib::TempStringA &requestType )
+void GDBServerFoundation::BasicGDBStub::SetMaxPacketSize( size_t maxPacketSize )
 {
-	if (requestType.length() < 3)
-		return StandardResponses::InvalidArgument;
+	m_MaxPacketSize = maxPacketSize;
+	if (maxPacketSize)
+		m_StubFeatures["PacketSize"] = BazisLib::DynamicStringA::sFormat("%x", (unsigned)maxPacketSize).c_str();
+	else
+		m_StubFeatures.erase("PacketSize");
+}
 
-	int threadId = HexHelpers::ParseHexString<unsigned>(requestType.substr(2));
-	if (threadId > 0)
+GDBServerFoundation::StubResponse GDBServerFoundation::BasicGDBStub::Handle_H( char operation, int threadID )
+{
+	if (threadID > 0)
 	{
 		//If the thread does not exist, abort the command
-		StubResponse response = Handle_T(requestType.substr(2));
-		if (response.GetSize() != 2 || memcmp(response.GetData(), "OK", 2))
+		StubResponse response = Handle_T(threadID);
+		if (!response.Equals("OK"))
 			return response;
 	}
 
-	unsigned char op = requestType[1];
-
-	switch(op)
+	switch(operation)
 	{
 	case 'c':
-		m_ThreadIDForCont = threadId;
+		m_ThreadIDForCont = threadID;
 		break;
 	case 'g':
-		m_ThreadIDForReg = threadId;
+		m_ThreadIDForReg = threadID;
 		break;
 	default:
 		return StandardResponses::InvalidArgument;
@@ -191,13 +286,18 @@ GDBServerFoundation::StubResponse GDBServerFoundation::BasicGDBStub::Handle_H( c
 	return StandardResponses::OK;
 }
 
+GDBServerFoundation::StubResponse GDBServerFoundation::BasicGDBStub::Handle_p( int threadID, unsigned registerIndex )
+{
+	return StandardResponses::CommandNotSupported;
+}
+
 #if _MSC_VER
 #define snprintf _snprintf
 #endif
 
 GDBServerFoundation::StubResponse GDBServerFoundation::BasicGDBStub::StopRecordToStopReply( const TargetStopRecord &rec, const char *pReportedRegisterValues, bool updateLastReportedThreadID )
 {
-	StubResponse response;
+	StubResponse response(&m_SessionArena);
 	
 	char szReasonBase[32];
 	char szThread[32];
@@ -218,6 +318,8 @@ GDBServerFoundation::StubResponse GDBServerFoundation::BasicGDBStub::StopRecordT
 		if (pReportedRegisterValues)
 			response.Append(pReportedRegisterValues);
 		response.Append(szThread);
+		if (rec.StoppedByBreakpoint)
+			AppendBreakpointStopReason(rec, response);
 		break;
 	case kLibraryEvent:
 	default:
@@ -236,6 +338,35 @@ GDBServerFoundation::StubResponse GDBServerFoundation::BasicGDBStub::StopRecordT
 	return response;
 }
 
+void GDBServerFoundation::BasicGDBStub::AppendBreakpointStopReason( const TargetStopRecord &rec, StubResponse &response )
+{
+	char szReason[64];
+	switch(rec.BreakpointKind)
+	{
+	case bptSoftwareBreakpoint:
+		if (m_bReportSwBreak)
+			response.Append("swbreak:;");
+		break;
+	case bptHardwareBreakpoint:
+		if (m_bReportHwBreak)
+			response.Append("hwbreak:;");
+		break;
+	case bptWriteWatchpoint:
+	case bptReadWatchpoint:
+	case bptAccessWatchpoint:
+		//The watchpoint stop reasons are understood by all GDB versions and do not need to be negotiated
+		snprintf(szReason, sizeof(szReason), "%s:%llx;", (rec.BreakpointKind == bptWriteWatchpoint) ? "watch" : ((rec.BreakpointKind == bptReadWatchpoint) ? "rwatch" : "awatch"), rec.WatchAddress);
+		response.Append(szReason);
+		break;
+	}
+}
+
+bool GDBServerFoundation::BasicGDBStub::IsFeatureNegotiated( const char *pFeature ) const
+{
+	std::map<std::string, std::string>::const_iterator stubIt = m_StubFeatures.find(pFeature), gdbIt = m_GDBFeatures.find(pFeature);
+	return stubIt != m_StubFeatures.end() && stubIt->second == "+" && gdbIt != m_GDBFeatures.end() && gdbIt->second == "+";
+}
+
 int GDBServerFoundation::BasicGDBStub::GetThreadIDForOp( bool isRegOp )
 {
 	int defaultThreadID = isRegOp ? m_ThreadIDForReg : m_ThreadIDForCont;
@@ -259,15 +390,100 @@ void GDBServerFoundation::BasicGDBStub::AppendRegisterValueToString( const Regis
 		str.AppendFormat(pSuffix);
 }
 
+void GDBServerFoundation::BasicGDBStub::AppendRegisterValueToString( const RegisterValue &val, size_t sizeInBytes, StubResponse &response, const char *pSuffix /*= NULL*/ )
+{
+	if (!sizeInBytes)
+		sizeInBytes = val.SizeInBytes;
+
+	char *pText = response.AllocateAppend(sizeInBytes * 2);
+	if (!pText)
+		return;
+
+	if (val.Valid)
+		HexHelpers::HexEncode(val.Value, sizeInBytes, pText);
+	else
+		memset(pText, 'x', sizeInBytes * 2);
+
+	if (pSuffix)
+		response.Append(pSuffix);
+}
+
+void GDBServerFoundation::BasicGDBStub::AppendRegisterBlock( StubResponse &response, const PlatformRegisterList &registerList, const RegisterSetContainer &registers )
+{
+	ASSERT(registerList.Layout || !registerList.RegisterCount);
+	char *pText = response.AllocateAppend(registerList.BlockSize * 2);
+	if (!pText)
+		return;
+
+	bool packed = (registers.GetLayout() == registerList.Layout);
+	if (packed)
+		HexHelpers::HexEncode(registers.GetBlock(), registerList.BlockSize, pText);	//The container has the same layout as the 'g' reply
+
+	for (size_t i = 0; i < registerList.RegisterCount; i++)
+	{
+		const RegisterLayoutEntry &layout = registerList.Layout[i];
+		const RegisterValueReference val = registers[i];
+		if (!val.Valid)
+			memset(pText + layout.Offset * 2, 'x', layout.SizeInBytes * 2);
+		else if (!packed)
+		{
+			size_t size = layout.SizeInBytes < val.SizeInBytes ? layout.SizeInBytes : val.SizeInBytes;
+			HexHelpers::HexEncode(val.Value, size, pText + layout.Offset * 2);
+			memset(pText + (layout.Offset + size) * 2, '0', (layout.SizeInBytes - size) * 2);
+		}
+	}
+}
+
+void GDBServerFoundation::BasicGDBStub::AppendExpeditedRegisters( StubResponse &response, const PlatformRegisterList &registerList, const RegisterSetContainer &registers, const unsigned *pIndexes /*= NULL*/, size_t indexCount /*= 0*/ )
+{
+	ASSERT(registerList.Layout || !registerList.RegisterCount);
+	size_t count = pIndexes ? indexCount : registerList.RegisterCount;
+	size_t totalSize = 0;
+	for (size_t j = 0; j < count; j++)
+	{
+		size_t i = pIndexes ? pIndexes[j] : j;
+		if (registers[i].Valid)
+			totalSize += registerList.Layout[i].StopReplyPrefixLength + registerList.Layout[i].SizeInBytes * 2 + 1;
+	}
+
+	char *pText = response.AllocateAppend(totalSize);
+	if (!pText)
+		return;
+
+	for (size_t j = 0; j < count; j++)
+	{
+		size_t i = pIndexes ? pIndexes[j] : j;
+		const RegisterLayoutEntry &layout = registerList.Layout[i];
+		if (!registers[i].Valid)
+			continue;
+
+		memcpy(pText, layout.StopReplyPrefix, layout.StopReplyPrefixLength);
+		pText += layout.StopReplyPrefixLength;
+		HexHelpers::HexEncode(registers[i].Value, layout.SizeInBytes, pText);
+		pText += layout.SizeInBytes * 2;
+		*pText++ = ';';
+	}
+}
+
+void GDBServerFoundation::BasicGDBStub::AppendGDBError( StubResponse &response, GDBStatus status )
+{
+	unsigned char code = (unsigned char)(status & 0xFF);
+	char *pText = response.AllocateAppend(3);
+	if (!pText)
+		return;
+	pText[0] = 'E';
+	HexHelpers::HexEncode(&code, 1, pText + 1);
+}
+
 GDBServerFoundation::StubResponse GDBServerFoundation::BasicGDBStub::FormatGDBStatus( GDBStatus status )
 {
 	StubResponse response;
 	if (status == kGDBNotSupported)
 		return StandardResponses::CommandNotSupported;
 	else if (status != kGDBSuccess)
-		response.Append(BazisLib::DynamicStringA::sFormat("E%02x", status & 0xFF).c_str());
+		AppendGDBError(response, status);
 	else
-		response.Append("OK");
+		return StandardResponses::OK;
 
 	return response;
 }
@@ -3,6 +3,8 @@
 #include <map>
 #include <string>
 #include "IGDBTarget.h"
+#include "PacketTable.h"
+#include "SessionArena.h"
 
 namespace GDBServerFoundation
 {
@@ -16,23 +18,102 @@ namespace GDBServerFoundation
 		//! Contains featuers supported by the stub. E.g. [{PacketSize, 65536},{multiprocess,-}]
 		std::map<std::string, std::string> m_StubFeatures;
 
+		//! Set if both GDB and the stub support the 'swbreak' and 'hwbreak' stop reasons. Updated by Handle_qSupported().
+		bool m_bReportSwBreak, m_bReportHwBreak;
+
+		PacketTable<BasicGDBStub> m_PacketTable;
+
+		//! Contains the temporary objects created while handling the current request. Reset before each request.
+		SessionArena m_SessionArena;
+
+	private:
+		//! Returns true if the feature has been registered via RegisterStubFeature() and reported by GDB as supported
+		bool IsFeatureNegotiated(const char *pFeature) const;
+
+		//Convert the parsed requests into the Handle_xxx() calls
+		StubResponse Dispatch_qSupported(const GDBRequest &request);
+		StubResponse Dispatch_qfThreadInfo(const GDBRequest &request);
+		StubResponse Dispatch_qsThreadInfo(const GDBRequest &request);
+		StubResponse Dispatch_qThreadExtraInfo(const GDBRequest &request);
+		StubResponse Dispatch_qC(const GDBRequest &request);
+		StubResponse Dispatch_qCRC(const GDBRequest &request);
+		StubResponse Dispatch_qRcmd(const GDBRequest &request);
+		StubResponse Dispatch_H(const GDBRequest &request);
+		StubResponse Dispatch_QueryStopReason(const GDBRequest &request);
+		StubResponse Dispatch_g(const GDBRequest &request);
+		StubResponse Dispatch_G(const GDBRequest &request);
+		StubResponse Dispatch_P(const GDBRequest &request);
+		StubResponse Dispatch_p(const GDBRequest &request);
+		StubResponse Dispatch_m(const GDBRequest &request);
+		StubResponse Dispatch_M(const GDBRequest &request);
+		StubResponse Dispatch_X(const GDBRequest &request);
+		StubResponse Dispatch_c(const GDBRequest &request);
+		StubResponse Dispatch_s(const GDBRequest &request);
+		StubResponse Dispatch_T(const GDBRequest &request);
+		StubResponse Dispatch_vContQuery(const GDBRequest &request);
+		StubResponse Dispatch_vCont(const GDBRequest &request);
+		StubResponse Dispatch_vFlashErase(const GDBRequest &request);
+		StubResponse Dispatch_vFlashWrite(const GDBRequest &request);
+		StubResponse Dispatch_vFlashDone(const GDBRequest &request);
+		StubResponse Dispatch_k(const GDBRequest &request);
+		StubResponse Dispatch_Z(const GDBRequest &request);
+		StubResponse Dispatch_z(const GDBRequest &request);
+
 	protected:
 		int m_ThreadIDForCont, m_ThreadIDForReg;
 		
 		//Should be updated from the code returning stop records
 		int m_LastReportedCurrentThreadID;
 
+		//! Should be notified (via BreakInMonitorScope) around every call that can block inside the target. Can be NULL.
+		IBreakInMonitor *m_pBreakInMonitor;
+
+		size_t m_MaxPacketSize;
+
 	public:
 		virtual StubResponse HandleRequest(const BazisLib::TempStringA &requestType, char splitterChar, const BazisLib::TempStringA &requestData);
 
+		//! Returns the allocation statistics of the session arena. If SessionArena::Statistics::HeapAllocations stops growing, the requests are handled without using the heap.
+		const SessionArena::Statistics &GetSessionArenaStatistics() const {return m_SessionArena.GetStatistics();}
+
+		//! Stores the monitor notified around the blocking calls (see m_pBreakInMonitor)
+		/*! Returns false, as a subclass may block inside its own handlers without notifying the monitor. The subclasses that wrap all
+			blocking calls into BreakInMonitorScope (e.g. GDBStub) should override this method and return true.
+		*/
+		virtual bool SetBreakInMonitor(IBreakInMonitor *pMonitor)
+		{
+			m_pBreakInMonitor = pMonitor;
+			return false;
+		}
+
+		virtual size_t GetMaxPacketSize() override
+		{
+			return m_MaxPacketSize;
+		}
+
+		//! Replaces the reported packet size with the one suggested by the transport. Override this method to keep a fixed packet size.
+		virtual void AdjustMaxPacketSize(size_t preferredMaxPacketSize) override
+		{
+			SetMaxPacketSize(preferredMaxPacketSize);
+		}
+
+		//! Sets the maximum packet size reported to GDB in the 'qSupported' reply. Pass 0 to let GDB use its default (small) packet size.
+		/*! GDB splits large memory reads and writes into packets of this size, so larger values reduce the amount of round trips on
+			high-latency links. The value should be set before GDB sends 'qSupported' (e.g. right after creating the stub).
+		*/
+		void SetMaxPacketSize(size_t maxPacketSize);
+
 		BasicGDBStub();
 
+		enum {kDefaultMaxPacketSize = 0x4000};
+
 	protected:
 		//! Stores features supported by GDB and reports features supported by the stub
 		virtual StubResponse Handle_qSupported(const BazisLib::TempStringA &requestData);
 
 		//! Sets thread ID for subsequent thread-related commands
-		virtual StubResponse Handle_H(const BazisLib::TempStringA &requestType);
+		/*! \param operation Specifies the operation affected by the thread ID ('c' or 'g') */
+		virtual StubResponse Handle_H(char operation, int threadID);
 
 		virtual StubResponse Handle_QueryStopReason()=0;
 		
@@ -43,16 +124,19 @@ namespace GDBServerFoundation
 		virtual StubResponse Handle_G(int threadID, const BazisLib::TempStringA &registerValueBlock)=0;
 
 		//! Sets the value of exactly one register
-		virtual StubResponse Handle_P(int threadID, const BazisLib::TempStringA &registerIndex, const BazisLib::TempStringA &registerValue)=0;
+		virtual StubResponse Handle_P(int threadID, unsigned registerIndex, const BazisLib::TempStringA &registerValue)=0;
+
+		//! Returns the value of exactly one register. The default implementation reports that the packet is not supported, so GDB uses 'g' instead.
+		virtual StubResponse Handle_p(int threadID, unsigned registerIndex);
 
 		//! Reads target memory
-		virtual StubResponse Handle_m(const BazisLib::TempStringA &addr, const BazisLib::TempStringA &length)=0;
+		virtual StubResponse Handle_m(ULONGLONG addr, size_t length)=0;
 
 		//! Writes target memory
-		virtual StubResponse Handle_M(const BazisLib::TempStringA &addr, const BazisLib::TempStringA &length, const BazisLib::TempStringA &data)=0;
+		virtual StubResponse Handle_M(ULONGLONG addr, size_t length, const BazisLib::TempStringA &data)=0;
 
 		//! Writes target memory, data is transmitted in binary format
-		virtual StubResponse Handle_X(const BazisLib::TempStringA &addr, const BazisLib::TempStringA &length, const BazisLib::TempStringA &binaryData)=0;
+		virtual StubResponse Handle_X(ULONGLONG addr, size_t length, const BazisLib::TempStringA &binaryData)=0;
 
 		//! Continue executing selected thread
 		virtual StubResponse Handle_c(int threadID)=0;
@@ -65,10 +149,10 @@ namespace GDBServerFoundation
 		virtual StubResponse Handle_qsThreadInfo()=0;
 
 		//!Return user-friendly thread description
-		virtual StubResponse Handle_qThreadExtraInfo(const BazisLib::TempStringA &strThreadID)=0;
+		virtual StubResponse Handle_qThreadExtraInfo(int threadID)=0;
 
 		//!Check whether the specified thread is alive
-		virtual StubResponse Handle_T(const BazisLib::TempStringA &strThreadID)=0;
+		virtual StubResponse Handle_T(int threadID)=0;
 
 		//! Returns the current thread ID
 		virtual StubResponse Handle_qC()=0;
@@ -80,27 +164,64 @@ namespace GDBServerFoundation
 		virtual StubResponse Handle_k()=0;
 
 		//! Sets or removes a breakpoint
-		virtual StubResponse Handle_Zz(bool setBreakpoint, char type, const BazisLib::TempStringA &addr, const BazisLib::TempStringA &kind, const BazisLib::TempStringA &conditions)=0;
+		virtual StubResponse Handle_Zz(bool setBreakpoint, char type, ULONGLONG addr, unsigned kind, const BazisLib::TempStringA &conditions)=0;
 
 		//! Computes CRC of a given memory block
-		virtual StubResponse Handle_qCRC(const BazisLib::TempStringA &addr, const BazisLib::TempStringA &length)=0;
+		virtual StubResponse Handle_qCRC(ULONGLONG addr, size_t length)=0;
 
 		//! Executes an arbitrary target command sent by GDB
 		virtual StubResponse Handle_qRcmd(const BazisLib::TempStringA &command)=0;
 
-		virtual StubResponse Handle_vFlashErase(const BazisLib::TempStringA &addr, const BazisLib::TempStringA &length)=0;
-		virtual StubResponse Handle_vFlashWrite(const BazisLib::TempStringA &addr, const BazisLib::TempStringA &binaryData)=0;
+		virtual StubResponse Handle_vFlashErase(ULONGLONG addr, size_t length)=0;
+		virtual StubResponse Handle_vFlashWrite(ULONGLONG addr, const BazisLib::TempStringA &binaryData)=0;
 		virtual StubResponse Handle_vFlashDone()=0;
 
 	protected:
 		StubResponse StopRecordToStopReply(const TargetStopRecord &rec, const char *pReportedRegisterValues = NULL, bool updateLastReportedThreadID = true);
+		//! Appends the 'swbreak', 'hwbreak' or watchpoint stop reason (see TargetStopRecord::StoppedByBreakpoint)
+		void AppendBreakpointStopReason(const TargetStopRecord &rec, StubResponse &response);
 		int GetThreadIDForOp(bool isRegOp);
 		
 		void AppendRegisterValueToString(const RegisterValue &val, size_t sizeInBytes, BazisLib::DynamicStringA &str, const char *pSuffix = NULL);	
+		void AppendRegisterValueToString(const RegisterValue &val, size_t sizeInBytes, StubResponse &response, const char *pSuffix = NULL);
+
+		//! Appends the values of all registers in the 'g' reply format. The registers that are not valid are reported as 'xx'.
+		/*! The register list should contain the layout (see PlatformRegisterList::Layout). */
+		void AppendRegisterBlock(StubResponse &response, const PlatformRegisterList &registerList, const RegisterSetContainer &registers);
+
+		//! Appends the 'NN:value;' pairs for the valid registers as reported in the stop replies
+		/*! If pIndexes is specified, only the listed registers are appended (see rfExpedited). */
+		void AppendExpeditedRegisters(StubResponse &response, const PlatformRegisterList &registerList, const RegisterSetContainer &registers, const unsigned *pIndexes = NULL, size_t indexCount = 0);
+
+		//! Returns the arena that can be used for the temporary objects and replies while handling a request
+		/*! The arena is reset before each request, i.e. after the reply to the previous one has been sent. See SessionArena for details.
+			\code
+			StubResponse response(GetSessionArena());
+			char *pBuffer = GetSessionArena()->AllocateArray<char>(length);
+			\endcode
+		*/
+		SessionArena *GetSessionArena() {return &m_SessionArena;}
 
 		StubResponse FormatGDBStatus(GDBStatus status);
+		//! Appends the "Exx" error reply for the given status without allocating memory
+		static void AppendGDBError(StubResponse &response, GDBStatus status);
 
 		void RegisterStubFeature(const char *pFeature) {m_StubFeatures[pFeature] = "+";}
+
+		typedef PacketTable<BasicGDBStub>::Handler PacketHandler;
+
+		//! Adds a handler for a packet not supported by BasicGDBStub, or replaces the handler of a supported one
+		/*! The arguments are parsed according to the grammar before the handler is called (see PacketTableBase::ParseArguments()).
+			Malformed requests are rejected without calling the handler.
+			\code
+			RegisterPacketHandler("qTStatus", NULL, &MyStub::Handle_qTStatus);
+			RegisterPacketHandler("qGetTIBAddr", ":T", &MyStub::Handle_qGetTIBAddr);
+			\endcode
+		*/
+		template <class _Stub> void RegisterPacketHandler(const char *pName, const char *pGrammar, StubResponse (_Stub::*pHandler)(const GDBRequest &))
+		{
+			m_PacketTable.Register(pName, pGrammar, static_cast<PacketHandler>(pHandler));
+		}
 		virtual void ResetAllCachesWhenResumingTarget();
 
 	};
@@ -0,0 +1,172 @@
+#include "stdafx.h"
+#include "BreakInDetector.h"
+
+using namespace BazisLib;
+using namespace GDBServerFoundation;
+
+#ifdef __linux__
+
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+GDBServerFoundation::PollBreakInDetector::PollBreakInDetector(IGDBTransport *pTransport, IBreakInTarget *pTarget, BreakInStatistics *pStatistics, BazisLib::Mutex *pStatisticsLock)
+	: m_pTransport(pTransport)
+	, m_PollHandle(pTransport->GetPollHandle())
+	, m_EventFD(eventfd(0, EFD_CLOEXEC))
+	, m_pTarget(pTarget)
+	, m_bArmed(false)
+	, m_bSocketBusy(false)
+	, m_bTerminating(false)
+	, m_bThreadStarted(false)
+	, m_WorkerThread(this, &PollBreakInDetector::WorkerThreadBody)
+	, m_pStatisticsLock(pStatisticsLock)
+	, m_pStatistics(pStatistics)
+{
+}
+
+GDBServerFoundation::PollBreakInDetector::~PollBreakInDetector()
+{
+	{
+		MutexLocker lck(m_Lock);
+		m_bTerminating = true;
+	}
+
+	if (m_bThreadStarted)
+	{
+		Wakeup();
+		m_WorkerThread.Join();
+	}
+
+	if (m_EventFD != -1)
+		close(m_EventFD);
+}
+
+void GDBServerFoundation::PollBreakInDetector::Wakeup()
+{
+	eventfd_write(m_EventFD, 1);
+}
+
+void GDBServerFoundation::PollBreakInDetector::BeginWaitingForBreakIn()
+{
+	{
+		MutexLocker lck(m_Lock);
+		m_bArmed = true;
+		m_bSocketBusy = false;
+	}
+
+	if (!m_bThreadStarted)
+		m_bThreadStarted = m_WorkerThread.Start();
+
+	//Make the worker thread add the socket to its poll() set
+	Wakeup();
+}
+
+void GDBServerFoundation::PollBreakInDetector::EndWaitingForBreakIn()
+{
+	//The worker thread only reads from the socket while holding m_Lock, so once we have set m_bArmed to false, the socket belongs to the caller.
+	//The worker will drop the socket from its poll() set on the next wakeup; there is no need to wake it up now.
+	MutexLocker lck(m_Lock);
+	m_bArmed = false;
+}
+
+int GDBServerFoundation::PollBreakInDetector::WorkerThreadBody()
+{
+	for (;;)
+	{
+		bool watchSocket;
+		{
+			MutexLocker lck(m_Lock);
+			if (m_bTerminating)
+				break;
+			watchSocket = m_bArmed && !m_bSocketBusy;
+		}
+
+		pollfd fds[2];
+		fds[0].fd = m_EventFD;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		fds[1].fd = m_PollHandle;
+		fds[1].events = POLLIN;
+		fds[1].revents = 0;
+
+		if (poll(fds, watchSocket ? 2 : 1, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (fds[0].revents & POLLIN)
+		{
+			eventfd_t value;
+			eventfd_read(m_EventFD, &value);
+		}
+
+		if (!watchSocket || !fds[1].revents)
+			continue;
+
+		MutexLocker lck(m_Lock);
+		if (!m_bArmed)
+			continue;
+
+		//IBreakInTarget::OnBreakInRequest() is required to return immediately, so it is called under m_Lock.
+		//This guarantees that no calls are in progress once EndWaitingForBreakIn() returns.
+		char ch = 0;
+		ULONGLONG arrivalTime = 0;
+		if (!m_pTransport->ReceiveByte(&ch, &arrivalTime))
+		{
+			//The connection was dropped. Stop the target, so that the session can end. This is not counted as a break-in request.
+			m_bSocketBusy = true;
+			m_pTarget->OnBreakInRequest();
+			continue;
+		}
+		else if (ch != BreakInSocket::kBreakInByte)
+		{
+			//This is the start of the next packet. It will be received by the main thread once the target stops.
+			m_pTransport->PushBack(ch);
+			m_bSocketBusy = true;
+			continue;
+		}
+
+		RecordBreakIn(arrivalTime);
+		m_pTarget->OnBreakInRequest();
+	}
+
+	return 0;
+}
+
+void GDBServerFoundation::PollBreakInDetector::RecordBreakIn(ULONGLONG arrivalTime)
+{
+	if (!m_pStatistics)
+		return;
+
+	ULONGLONG latency = 0;
+	if (arrivalTime)
+	{
+		timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		ULONGLONG nowInNanoseconds = now.tv_sec * 1000000000ULL + now.tv_nsec;
+		if (nowInNanoseconds > arrivalTime)
+			latency = nowInNanoseconds - arrivalTime;
+	}
+
+	if (m_pStatisticsLock)
+		m_pStatisticsLock->Lock();
+
+	m_pStatistics->BreakInCount++;
+	if (arrivalTime)
+	{
+		m_pStatistics->TimedBreakInCount++;
+		m_pStatistics->TotalLatencyInNanoseconds += latency;
+		if (latency > m_pStatistics->MaxLatencyInNanoseconds)
+			m_pStatistics->MaxLatencyInNanoseconds = latency;
+	}
+
+	if (m_pStatisticsLock)
+		m_pStatisticsLock->Unlock();
+}
+
+#endif
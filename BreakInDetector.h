@@ -0,0 +1,73 @@
+#pragma once
+#include <bzscore/sync.h>
+#include <bzscore/thread.h>
+#include "BreakInSocket.h"
+
+namespace GDBServerFoundation
+{
+	//! Contains the break-in latency statistics collected by PollBreakInDetector
+	struct BreakInStatistics
+	{
+		//! Amount of break-in requests (0x03 bytes) delivered to IBreakInTarget::OnBreakInRequest()
+		unsigned BreakInCount;
+		//! Amount of break-in requests for which the arrival time was reported by the OS
+		unsigned TimedBreakInCount;
+		//! Total and maximum time between the arrival of the 0x03 byte and the IBreakInTarget::OnBreakInRequest() call, in nanoseconds
+		ULONGLONG TotalLatencyInNanoseconds, MaxLatencyInNanoseconds;
+
+		BreakInStatistics()
+			: BreakInCount(0)
+			, TimedBreakInCount(0)
+			, TotalLatencyInNanoseconds(0)
+			, MaxLatencyInNanoseconds(0)
+		{
+		}
+	};
+
+	//! Detects break-in requests by polling the transport only while the stub is blocked in the target
+	/*! Unlike the BreakInSocket worker thread, this class does not interact with the socket while packets are received and handled.
+		Instead, the stub calls IBreakInMonitor::BeginWaitingForBreakIn() before blocking in the target (e.g. in ISyncGDBTarget::ResumeAndWait())
+		and the worker thread waits for either the transport (IGDBTransport::GetPollHandle()) or an eventfd in a single poll() call. Normal requests (e.g. memory reads)
+		do not cause any locking, signaling or thread switches.
+
+		If the first received byte is not 0x03, it is returned to the transport via IGDBTransport::PushBack() and the transport
+		is no longer polled until the stub returns from the target.
+
+		For sockets the arrival time of each 0x03 byte is obtained from the kernel (SO_TIMESTAMPNS), so that the statistics reflect the entire
+		latency between the moment the request reaches the machine and the IBreakInTarget::OnBreakInRequest() call.
+
+		\remarks This class is only available on Linux and requires a transport with a valid poll handle. The worker thread is created
+				 when the stub blocks in the target for the first time.
+	*/
+	class PollBreakInDetector : public IBreakInMonitor
+	{
+	private:
+		IGDBTransport *m_pTransport;
+		int m_PollHandle, m_EventFD;
+		IBreakInTarget *m_pTarget;
+
+		BazisLib::Mutex m_Lock;
+		bool m_bArmed, m_bSocketBusy, m_bTerminating, m_bThreadStarted;
+		BazisLib::MemberThread m_WorkerThread;
+
+		BazisLib::Mutex *m_pStatisticsLock;
+		BreakInStatistics *m_pStatistics;
+
+	private:
+		int WorkerThreadBody();
+		void Wakeup();
+		void RecordBreakIn(ULONGLONG arrivalTime);
+
+	public:
+		//! Creates a detector for a connected transport.
+		/*!
+			\param pStatistics Optionally specifies a structure updated on each break-in request. The structure can be shared
+				   between several detectors if pStatisticsLock is specified.
+		*/
+		PollBreakInDetector(IGDBTransport *pTransport, IBreakInTarget *pTarget, BreakInStatistics *pStatistics = NULL, BazisLib::Mutex *pStatisticsLock = NULL);
+		~PollBreakInDetector();
+
+		virtual void BeginWaitingForBreakIn() override;
+		virtual void EndWaitingForBreakIn() override;
+	};
+}
@@ -1,7 +1,7 @@
 #pragma once
-#include <bzsnet/BufferedSocket.h>
 #include <bzscore/sync.h>
 #include <bzscore/thread.h>
+#include "GDBTransport.h"
 
 namespace GDBServerFoundation
 {
@@ -12,13 +12,45 @@ namespace GDBServerFoundation
 		virtual void OnBreakInRequest()=0;
 	};
 
-	//! Encapsulates a socket with asynchronous break-in support
+	//! Allows the stub to tell the server when it is blocked inside the target, so that break-in requests only need to be monitored during that time
+	/*! Use the BreakInMonitorScope class to call the methods of this interface.
+	*/
+	class IBreakInMonitor
+	{
+	public:
+		//! Called before a potentially long blocking call to the target (e.g. ISyncGDBTarget::ResumeAndWait())
+		virtual void BeginWaitingForBreakIn()=0;
+		//! Called once the blocking call returns. After this method returns the monitor no longer reads from the connection.
+		virtual void EndWaitingForBreakIn()=0;
+	};
+
+	//! Calls IBreakInMonitor::BeginWaitingForBreakIn() and IBreakInMonitor::EndWaitingForBreakIn() for the lifetime of the object. The monitor can be NULL.
+	class BreakInMonitorScope
+	{
+	private:
+		IBreakInMonitor *m_pMonitor;
+
+	public:
+		BreakInMonitorScope(IBreakInMonitor *pMonitor)
+			: m_pMonitor(pMonitor)
+		{
+			if (m_pMonitor)
+				m_pMonitor->BeginWaitingForBreakIn();
+		}
+
+		~BreakInMonitorScope()
+		{
+			if (m_pMonitor)
+				m_pMonitor->EndWaitingForBreakIn();
+		}
+	};
+
+	//! Encapsulates a transport (e.g. a socket) with asynchronous break-in support
 	/*! This class should be used to receive packets from GDB. The main packet handling loop should look this way:
 		1. Create an instance of BreakInSocket::SocketWrapper
 		2. Use SocketWrapper to get read the packet. If the first byte received from the socket is 0x03, raise the break-in event.
-		3. If TCPSocketEx::Peek() was called, call TCPSocketEx::Discard()
-		4. Delete the BreakInSocket::SocketWrapper instance
-		5. Process the packet, send reply, etc.
+		3. Delete the BreakInSocket::SocketWrapper instance
+		4. Process the packet, send reply, etc.
 
 		The BreakInSocket class ensures that if a break-in request (0x03 byte) arrives while the packet is being processed 
 		(i.e. BreakInSocket::SocketWrapper not existing), a IBreakInTarget::OnBreakInRequest() will be called from a worker thread.
@@ -28,8 +60,12 @@ namespace GDBServerFoundation
 
 		\remarks When an instance of BreakInSocket::SocketWrapper is active, the worker thread is suspended and does not interfere
 				 with the socket. As soon as the BreakInSocket::SocketWrapper instance is deleted, the worker thread starts monitoring
-				 the socket. If it receives anything except the 0x03 byte (i.e. start of a packet), it suspends itself until the packet
-				 is handled (i.e. an instance of BreakInSocket::SocketWrapper is created and deleted).
+				 the socket. If it receives anything except the 0x03 byte (i.e. start of a packet), it returns the byte to the transport
+				 (IGDBTransport::PushBack()) and suspends itself until the packet is handled (i.e. an instance of BreakInSocket::SocketWrapper
+				 is created and deleted).
+
+		\remarks If the break-in requests are detected by other means (e.g. by a PollBreakInDetector), the worker thread can be disabled
+				 by passing false to the constructor. In that case SocketWrapper does not do any locking.
 
 	*/
 	class BreakInSocket
@@ -38,7 +74,7 @@ namespace GDBServerFoundation
 		enum {kBreakInByte = 0x03};
 
 	private:
-		BazisLib::Network::TCPSocketEx *m_pSocket;
+		IGDBTransport *m_pTransport;
 
 	private:
 		BazisLib::MemberThread m_WorkerThread;
@@ -47,6 +83,7 @@ namespace GDBServerFoundation
 		bool m_bTerminating;
 
 		IBreakInTarget *m_pTarget;
+		bool m_bUseWorkerThread;
 
 	private:
 		int WorkerThreadBody()
@@ -54,13 +91,16 @@ namespace GDBServerFoundation
 			BazisLib::MutexLocker lck(m_RecvMutex);
 			while (!m_bTerminating)
 			{
-				size_t total = 0;
-				void *pData = m_pSocket->PeekAbs(1, &total);
-				if (!pData || !total || *((char *)pData) == kBreakInByte)
+				char ch = 0;
+				bool received = m_pTransport->Receive(&ch, 1) == 1;
+				if (received && ch != kBreakInByte)
 				{
-					if (total)
-						m_pSocket->Discard(pData, 1);
-
+					//This is the start of the next packet. It will be received again by the main thread.
+					m_pTransport->PushBack(ch);
+				}
+				else
+				{
+					//A dropped connection also stops the target, so that the session can end
 					IBreakInTarget *pTarget = m_pTarget;
 					if (pTarget)
 					{
@@ -69,7 +109,8 @@ namespace GDBServerFoundation
 						m_RecvMutex.Lock();
 					}
 
-					continue;
+					if (received)
+						continue;
 				}
 
 				m_RecvMutex.Unlock();
@@ -80,25 +121,31 @@ namespace GDBServerFoundation
 		}
 
 	public:
-		BreakInSocket(BazisLib::Network::TCPSocketEx *pSock)
-			: m_pSocket(pSock)
+		BreakInSocket(IGDBTransport *pTransport, bool useWorkerThread = true)
+			: m_pTransport(pTransport)
 			, m_WorkerThread(this, &BreakInSocket::WorkerThreadBody)
 			, m_bTerminating(false)
 			, m_pTarget(NULL)
+			, m_bUseWorkerThread(useWorkerThread)
 		{
-			m_WorkerThread.Start();
+			if (m_bUseWorkerThread)
+				m_WorkerThread.Start();
 		}
 
+		//! The transport should be closed before deleting the object, so that the worker thread can exit
 		~BreakInSocket()
 		{
-			m_bTerminating = true;
-			m_Semaphore.Signal();
-			m_WorkerThread.Join();
+			if (m_bUseWorkerThread)
+			{
+				m_bTerminating = true;
+				m_Semaphore.Signal();
+				m_WorkerThread.Join();
+			}
 		}
 
-		size_t Send(const void *pBuffer, size_t size)
+		bool Send(const void *pBuffer, size_t size)
 		{
-			return m_pSocket->Send(pBuffer, size);
+			return m_pTransport->Send(pBuffer, size);
 		}
 
 		void SetTarget(IBreakInTarget *pTarget)
@@ -116,18 +163,22 @@ namespace GDBServerFoundation
 			SocketWrapper(BreakInSocket &sock)
 				: m_Socket(sock)
 			{
-				m_Socket.m_RecvMutex.Lock();
+				if (m_Socket.m_bUseWorkerThread)
+					m_Socket.m_RecvMutex.Lock();
 			}
 
-			BazisLib::Network::TCPSocketEx *operator->()
+			IGDBTransport *operator->()
 			{
-				return m_Socket.m_pSocket;
+				return m_Socket.m_pTransport;
 			}
 
 			~SocketWrapper()
 			{
-				m_Socket.m_RecvMutex.Unlock();
-				m_Socket.m_Semaphore.Signal();
+				if (m_Socket.m_bUseWorkerThread)
+				{
+					m_Socket.m_RecvMutex.Unlock();
+					m_Socket.m_Semaphore.Signal();
+				}
 			}
 		};
 	};
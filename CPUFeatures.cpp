@@ -0,0 +1,35 @@
+#include "stdafx.h"
+#include "CPUFeatures.h"
+
+using namespace GDBServerFoundation;
+
+static bool DetectAVX2()
+{
+#if defined(GDBSERVER_HAS_SSE2) && defined(_MSC_VER)
+	int regs[4];
+	__cpuid(regs, 0);
+	if (regs[0] < 7)
+		return false;
+
+	//The OS should save the YMM registers on context switches (OSXSAVE + XCR0 bits 1 and 2)
+	__cpuid(regs, 1);
+	if (!(regs[2] & (1 << 27)) || !(regs[2] & (1 << 28)))
+		return false;
+	if ((_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(regs, 7, 0);
+	return (regs[1] & (1 << 5)) != 0;
+#elif defined(GDBSERVER_HAS_SSE2) && defined(__GNUC__)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#else
+	return false;
+#endif
+}
+
+bool GDBServerFoundation::CPUFeatures::HasAVX2()
+{
+	static const bool s_bHasAVX2 = DetectAVX2();
+	return s_bHasAVX2;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+//! Defined when the SSE2 intrinsics can be used unconditionally
+#define GDBSERVER_HAS_SSE2
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__GNUC__)
+//! Marks a function using the AVX2 intrinsics. Such functions should only be called if CPUFeatures::HasAVX2() returns true.
+#define GDBSERVER_AVX2_FUNCTION __attribute__((target("avx2")))
+#else
+#define GDBSERVER_AVX2_FUNCTION
+#endif
+
+namespace GDBServerFoundation
+{
+	//! Detects the instruction set extensions used by the vectorized packet processing code
+	namespace CPUFeatures
+	{
+		//! Returns true if both the CPU and the OS support AVX2. The check is only performed once.
+		bool HasAVX2();
+
+		//! Returns the index of the lowest set bit. The value should not be 0.
+		static inline unsigned CountTrailingZeros(unsigned value)
+		{
+#ifdef _MSC_VER
+			unsigned long index;
+			_BitScanForward(&index, value);
+			return index;
+#else
+			return __builtin_ctz(value);
+#endif
+		}
+	}
+}
@@ -0,0 +1,819 @@
+#include "stdafx.h"
+#include "EventDrivenServer.h"
+#include "GDBServer.h"
+#include "GDBPacketCodec.h"
+
+using namespace BazisLib;
+using namespace GDBServerFoundation;
+using namespace GDBServerFoundation::PacketCodec;
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1u << 28)
+#endif
+
+struct GDBServerFoundation::EventDrivenServer::Session
+{
+	int Socket;
+	Reactor *pReactor;
+	IGDBStub *pStub;
+	PacketFramer Framer;
+
+	//! Contains the received bytes that have not been parsed yet
+	PacketReceiveBuffer *pReceiveBuffer;
+	//! Contains the packet being handled by a worker thread. The packet is unescaped in place and passed to the stub without copying.
+	PacketReceiveBuffer *pRequestBuffer;
+	PacketReceiveBuffer Buffers[2];
+	const char *pRequest;
+	size_t RequestLength;
+
+	enum ReplyState
+	{
+		kNoReply,
+		//! The worker thread has stored the reply in Response, but no part of it has been encoded yet
+		kReplyReady,
+		//! The parts produced by the stream of the reply are being sent
+		kReplyStreaming,
+		//! The last part (including the checksum) is being sent
+		kReplyFinishing,
+	};
+
+	//! Contains the reply produced by the worker thread. It is kept until the entire packet is sent, as the encoder references its data.
+	StubResponse Response;
+	ReplyState State;
+	//! Contains the part of the reply that has not been sent yet
+	/*! The parts of a streamed reply are produced one at a time when the previous part has been sent, so the memory used by a session
+		does not depend on the reply size. */
+	ScatterGatherEncoder Encoder;
+	//! Contains the ACKs that have not been sent yet
+	BasicBuffer Output;
+	size_t OutputOffset;
+
+	bool HandlerRunning, Closing, WaitingForOutput;
+
+	//! Allows receiving the largest packet allowed by IGDBStub::GetMaxPacketSize() with a single call
+	size_t BytesToReceiveAtOnce;
+
+	Session(int socket, Reactor *pReactor, IGDBStub *pStub)
+		: Socket(socket)
+		, pReactor(pReactor)
+		, pStub(pStub)
+		, pReceiveBuffer(&Buffers[0])
+		, pRequestBuffer(&Buffers[1])
+		, pRequest(NULL)
+		, RequestLength(0)
+		, State(kNoReply)
+		, OutputOffset(0)
+		, HandlerRunning(false)
+		, Closing(false)
+		, WaitingForOutput(false)
+		, BytesToReceiveAtOnce(0)
+	{
+	}
+
+	~Session()
+	{
+		delete pStub;
+		close(Socket);
+	}
+
+	//! Makes the receive buffer (containing the packet) the request buffer. The data following the packet is moved to the new receive buffer.
+	/*! This allows receiving more data (e.g. break-in requests) while the worker thread accesses the packet. */
+	bool DetachRequest(size_t packetSize)
+	{
+		PacketReceiveBuffer *pNewReceiveBuffer = pRequestBuffer;
+		pNewReceiveBuffer->Clear();
+
+		size_t remaining = pReceiveBuffer->GetSize() - packetSize;
+		if (remaining)
+		{
+			char *p = pNewReceiveBuffer->PrepareReceive(remaining);
+			if (!p)
+				return false;
+			memcpy(p, pReceiveBuffer->GetData() + packetSize, remaining);
+			pNewReceiveBuffer->CommitReceive(remaining);
+		}
+
+		pRequestBuffer = pReceiveBuffer;
+		pReceiveBuffer = pNewReceiveBuffer;
+		return true;
+	}
+};
+
+class GDBServerFoundation::EventDrivenServer::Reactor
+{
+private:
+	enum {kMinBytesToReceiveAtOnce = 65536, kMaxEventsPerWait = 64};
+
+	EventDrivenServer *m_pOwner;
+	int m_EpollFD, m_WakeupFD;
+	bool m_bListening;
+	size_t m_SessionCount;
+
+	BazisLib::Mutex m_CompletionLock;
+	std::vector<Session *> m_Completions;
+	std::vector<Session *> m_DeadSessions;
+
+	BazisLib::MemberThread m_Thread;
+
+	//Values used in epoll_event::data.ptr to distinguish the listening socket and the wakeup eventfd from the sessions
+	static char s_ListenerMarker, s_WakeupMarker;
+
+private:
+	int ThreadBody();
+
+	void AcceptConnections();
+	void ProcessCompletions();
+	void OnReadable(Session *pSession);
+	void ProcessInput(Session *pSession);
+	void FlushOutput(Session *pSession);
+	//! Returns false if the socket is not ready for more data or the connection was closed
+	bool SendPendingSegments(Session *pSession);
+	void SetOutputNotification(Session *pSession, bool enable);
+	void OnConnectionClosed(Session *pSession);
+
+public:
+	Reactor(EventDrivenServer *pOwner)
+		: m_pOwner(pOwner)
+		, m_EpollFD(-1)
+		, m_WakeupFD(-1)
+		, m_bListening(false)
+		, m_SessionCount(0)
+		, m_Thread(this, &Reactor::ThreadBody)
+	{
+	}
+
+	~Reactor()
+	{
+		if (m_WakeupFD != -1)
+			close(m_WakeupFD);
+		if (m_EpollFD != -1)
+			close(m_EpollFD);
+	}
+
+	bool Start(int listeningSocket)
+	{
+		m_EpollFD = epoll_create1(EPOLL_CLOEXEC);
+		m_WakeupFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (m_EpollFD == -1 || m_WakeupFD == -1)
+			return false;
+
+		epoll_event evt = {0, };
+		evt.events = EPOLLIN;
+		evt.data.ptr = &s_WakeupMarker;
+		if (epoll_ctl(m_EpollFD, EPOLL_CTL_ADD, m_WakeupFD, &evt))
+			return false;
+
+		//EPOLLEXCLUSIVE ensures that only one of the reactors is woken up per incoming connection
+		evt.events = EPOLLIN | EPOLLEXCLUSIVE;
+		evt.data.ptr = &s_ListenerMarker;
+		if (epoll_ctl(m_EpollFD, EPOLL_CTL_ADD, listeningSocket, &evt))
+			return false;
+
+		m_bListening = true;
+		return m_Thread.Start();
+	}
+
+	void Wakeup()
+	{
+		ULONGLONG one = 1;
+		ssize_t done = write(m_WakeupFD, &one, sizeof(one));
+		(void)done;
+	}
+
+	void Join()
+	{
+		m_Thread.Join();
+	}
+
+	//! Called by a worker thread once the reply to the session's request is ready
+	void PostCompletion(Session *pSession)
+	{
+		{
+			MutexLocker lck(m_CompletionLock);
+			m_Completions.push_back(pSession);
+		}
+		Wakeup();
+	}
+};
+
+char GDBServerFoundation::EventDrivenServer::Reactor::s_ListenerMarker;
+char GDBServerFoundation::EventDrivenServer::Reactor::s_WakeupMarker;
+
+int GDBServerFoundation::EventDrivenServer::Reactor::ThreadBody()
+{
+	epoll_event events[kMaxEventsPerWait];
+
+	for (;;)
+	{
+		if (m_pOwner->m_bStopping)
+		{
+			if (m_bListening)
+			{
+				epoll_ctl(m_EpollFD, EPOLL_CTL_DEL, m_pOwner->m_ListeningSocket, NULL);
+				m_bListening = false;
+			}
+
+			if (!m_SessionCount)
+				break;
+		}
+
+		int count = epoll_wait(m_EpollFD, events, kMaxEventsPerWait, -1);
+		if (count < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			void *pData = events[i].data.ptr;
+			if (pData == &s_ListenerMarker)
+				AcceptConnections();
+			else if (pData == &s_WakeupMarker)
+			{
+				ULONGLONG value;
+				ssize_t done = read(m_WakeupFD, &value, sizeof(value));
+				(void)done;
+				ProcessCompletions();
+			}
+			else
+			{
+				Session *pSession = (Session *)pData;
+				if (pSession->Closing)
+					continue;	//Closed while handling a previous event in this batch
+
+				if (events[i].events & EPOLLOUT)
+				{
+					FlushOutput(pSession);
+
+					//The packets received while the previous reply was being sent are parsed once it has been sent completely
+					if (!pSession->Closing && !(events[i].events & EPOLLIN))
+						ProcessInput(pSession);
+				}
+				if (!pSession->Closing && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+					OnReadable(pSession);
+			}
+		}
+
+		//Sessions are only deleted after the entire batch is processed, as the batch may still reference them
+		for (size_t i = 0; i < m_DeadSessions.size(); i++)
+		{
+			delete m_DeadSessions[i];
+			m_SessionCount--;
+		}
+		m_DeadSessions.clear();
+	}
+
+	return 0;
+}
+
+void GDBServerFoundation::EventDrivenServer::Reactor::AcceptConnections()
+{
+	for (;;)
+	{
+		int sock = accept4(m_pOwner->m_ListeningSocket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (sock == -1)
+			return;
+
+		int one = 1;
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		IGDBStub *pStub = NULL;
+		if (m_pOwner->m_pFactory)
+			pStub = m_pOwner->m_pFactory->CreateStub(m_pOwner->m_pServer);
+
+		if (!pStub)
+		{
+			close(sock);
+			continue;
+		}
+
+		Session *pSession = new Session(sock, this, pStub);
+		pSession->Framer.SetVerifyChecksumsWithoutACK(m_pOwner->m_bVerifyChecksumsWithoutACK);
+
+		size_t maxPacketSize = pStub->GetMaxPacketSize();
+		pSession->BytesToReceiveAtOnce = maxPacketSize + kPacketFramingSize;
+		if (pSession->BytesToReceiveAtOnce < kMinBytesToReceiveAtOnce)
+			pSession->BytesToReceiveAtOnce = kMinBytesToReceiveAtOnce;
+		pSession->Encoder.Reserve(maxPacketSize);
+
+		epoll_event evt = {0, };
+		evt.events = EPOLLIN;
+		evt.data.ptr = pSession;
+		if (epoll_ctl(m_EpollFD, EPOLL_CTL_ADD, sock, &evt))
+		{
+			delete pSession;
+			continue;
+		}
+
+		m_SessionCount++;
+	}
+}
+
+void GDBServerFoundation::EventDrivenServer::Reactor::ProcessCompletions()
+{
+	std::vector<Session *> completions;
+	{
+		MutexLocker lck(m_CompletionLock);
+		completions.swap(m_Completions);
+	}
+
+	for (size_t i = 0; i < completions.size(); i++)
+	{
+		Session *pSession = completions[i];
+		pSession->HandlerRunning = false;
+
+		if (pSession->Closing)
+		{
+			m_DeadSessions.push_back(pSession);
+			continue;
+		}
+
+		pSession->State = Session::kReplyReady;
+		FlushOutput(pSession);
+
+		//GDB may have sent more data (e.g. the ACK for the reply) while the handler was running
+		if (!pSession->Closing)
+			ProcessInput(pSession);
+	}
+}
+
+void GDBServerFoundation::EventDrivenServer::Reactor::OnReadable(Session *pSession)
+{
+	for (;;)
+	{
+		char *pFreeSpace = pSession->pReceiveBuffer->PrepareReceive(pSession->BytesToReceiveAtOnce);
+		if (!pFreeSpace)
+			break;
+
+		ssize_t done = recv(pSession->Socket, pFreeSpace, pSession->BytesToReceiveAtOnce, 0);
+		if (done > 0)
+		{
+			pSession->pReceiveBuffer->CommitReceive(done);
+			if ((size_t)done < pSession->BytesToReceiveAtOnce)
+				break;
+			continue;
+		}
+
+		if (done < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (done < 0 && errno == EINTR)
+			continue;
+
+		OnConnectionClosed(pSession);
+		return;
+	}
+
+	ProcessInput(pSession);
+}
+
+void GDBServerFoundation::EventDrivenServer::Reactor::ProcessInput(Session *pSession)
+{
+	while (!pSession->Closing && pSession->pReceiveBuffer->GetSize())
+	{
+		char *pData = pSession->pReceiveBuffer->GetData();
+		size_t size = pSession->pReceiveBuffer->GetSize();
+
+		if (pSession->State != Session::kNoReply)
+			break;	//The next packet is parsed once the current reply has been sent
+
+		if (pSession->HandlerRunning)
+		{
+			//Only break-in requests are expected while the request is being handled. Anything else will be parsed once the handler completes.
+			if (pData[0] != kBreakInByte)
+				break;
+
+			pSession->pReceiveBuffer->Discard(1);
+			pSession->pStub->OnBreakInRequest();
+			continue;
+		}
+
+		PacketFramer::Event evt = pSession->Framer.ProcessData(pData, size);
+		switch (evt.Type)
+		{
+		case PacketFramer::kBreakInRequest:
+			pSession->pStub->OnBreakInRequest();
+			break;
+		case PacketFramer::kInvalidCharacter:
+			m_pOwner->ReportProtocolError(String::sFormat(_T("Unexpected character: 0x%02X (%c)"), evt.ErrorChar & 0xFF, evt.ErrorChar));
+			break;
+		case PacketFramer::kInvalidChecksum:
+			m_pOwner->ReportProtocolError(String::sFormat(_T("Invalid packet checksum. Expected 0x%02X, got 0x%02X"), evt.ExpectedChecksum, evt.Checksum));
+			break;
+		case PacketFramer::kPacketReceived:
+			//The framer has unescaped the packet in place
+			pSession->pRequest = evt.pBody;
+			pSession->RequestLength = evt.BodyLength;
+			if (!pSession->DetachRequest(evt.ConsumedBytes))
+			{
+				OnConnectionClosed(pSession);
+				return;
+			}
+
+			if (evt.SendACK)
+			{
+				//The ACK is sent before the handler is started, as the handler may block for a long time (e.g. 'continue')
+				char ch = kACK;
+				pSession->Output.append(&ch, 1);
+				FlushOutput(pSession);
+				if (pSession->Closing)
+					return;
+			}
+
+			pSession->HandlerRunning = true;
+			m_pOwner->QueueRequest(pSession);
+			continue;	//The packet has already been removed from the receive buffer by DetachRequest()
+		case PacketFramer::kNeedMoreData:
+			break;
+		}
+
+		pSession->pReceiveBuffer->Discard(evt.ConsumedBytes);
+		if (evt.Type == PacketFramer::kNeedMoreData)
+			break;
+	}
+}
+
+void GDBServerFoundation::EventDrivenServer::Reactor::FlushOutput(Session *pSession)
+{
+	while (pSession->OutputOffset < pSession->Output.GetSize())
+	{
+		ssize_t done = send(pSession->Socket, (const char *)pSession->Output.GetConstData() + pSession->OutputOffset, pSession->Output.GetSize() - pSession->OutputOffset, MSG_NOSIGNAL);
+		if (done > 0)
+		{
+			pSession->OutputOffset += done;
+			continue;
+		}
+
+		if (done < 0 && errno == EINTR)
+			continue;
+
+		if (done < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			SetOutputNotification(pSession, true);
+			return;
+		}
+
+		OnConnectionClosed(pSession);
+		return;
+	}
+
+	pSession->Output.SetSize(0);
+	pSession->OutputOffset = 0;
+
+	//The next part of the reply is only produced when the previous one has been sent, so a slow client does not make the session buffer the entire reply
+	while (!pSession->HandlerRunning && pSession->State != Session::kNoReply)
+	{
+		if (!SendPendingSegments(pSession))
+			return;
+
+		IReplyStream *pStream = pSession->Response.GetStream();
+		switch (pSession->State)
+		{
+		case Session::kReplyReady:
+			if (pStream)
+			{
+				pSession->Encoder.EncodePart(pSession->Response.GetData(), pSession->Response.GetSize(), false, ScatterGatherEncoder::kFirstPart);
+				pSession->State = Session::kReplyStreaming;
+			}
+			else
+			{
+				pSession->Encoder.Encode(pSession->Response.GetData(), pSession->Response.GetSize(), false);
+				pSession->State = Session::kReplyFinishing;
+			}
+			break;
+		case Session::kReplyStreaming:
+			{
+				size_t partSize;
+				const char *pPart = pStream->ReadNextPart(&partSize);
+				if (pPart)
+					pSession->Encoder.EncodePart(pPart, partSize, false, 0);
+				else
+				{
+					pSession->Encoder.EncodePart(NULL, 0, false, ScatterGatherEncoder::kLastPart);
+					pSession->State = Session::kReplyFinishing;
+				}
+			}
+			break;
+		case Session::kReplyFinishing:
+			pSession->Response = StubResponse();
+			pSession->State = Session::kNoReply;
+			break;
+		default:
+			break;
+		}
+	}
+
+	SetOutputNotification(pSession, false);
+}
+
+bool GDBServerFoundation::EventDrivenServer::Reactor::SendPendingSegments(Session *pSession)
+{
+	enum {kMaxVectorsPerCall = 64};
+
+	while (pSession->Encoder.GetPendingSegmentCount())
+	{
+		const DataSegment *pSegments = pSession->Encoder.GetPendingSegments();
+		size_t count = pSession->Encoder.GetPendingSegmentCount();
+		if (count > kMaxVectorsPerCall)
+			count = kMaxVectorsPerCall;
+
+		iovec vectors[kMaxVectorsPerCall];
+		for (size_t i = 0; i < count; i++)
+		{
+			vectors[i].iov_base = (void *)pSegments[i].pData;
+			vectors[i].iov_len = pSegments[i].Length;
+		}
+
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = vectors;
+		msg.msg_iovlen = count;
+
+		ssize_t done = sendmsg(pSession->Socket, &msg, MSG_NOSIGNAL);
+		if (done > 0)
+		{
+			pSession->Encoder.OnDataSent(done);
+			continue;
+		}
+
+		if (done < 0 && errno == EINTR)
+			continue;
+
+		if (done < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			SetOutputNotification(pSession, true);
+		else
+			OnConnectionClosed(pSession);
+		return false;
+	}
+
+	return true;
+}
+
+void GDBServerFoundation::EventDrivenServer::Reactor::SetOutputNotification(Session *pSession, bool enable)
+{
+	if (pSession->WaitingForOutput == enable)
+		return;
+
+	epoll_event evt = {0, };
+	evt.events = enable ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+	evt.data.ptr = pSession;
+	epoll_ctl(m_EpollFD, EPOLL_CTL_MOD, pSession->Socket, &evt);
+	pSession->WaitingForOutput = enable;
+}
+
+void GDBServerFoundation::EventDrivenServer::Reactor::OnConnectionClosed(Session *pSession)
+{
+	if (pSession->Closing)
+		return;
+
+	pSession->Closing = true;
+	epoll_ctl(m_EpollFD, EPOLL_CTL_DEL, pSession->Socket, NULL);
+
+	if (pSession->HandlerRunning)
+	{
+		//Same as the thread-per-connection mode: a dropped connection interrupts the blocking request. The session is deleted once it completes.
+		pSession->pStub->OnBreakInRequest();
+	}
+	else
+		m_DeadSessions.push_back(pSession);
+}
+
+GDBServerFoundation::EventDrivenServer::EventDrivenServer(GDBServer *pServer, IGDBStubFactory *pFactory, unsigned reactorCount, unsigned workerCount)
+	: m_pServer(pServer)
+	, m_pFactory(pFactory)
+	, m_ReactorCount(reactorCount ? reactorCount : 1)
+	, m_WorkerCount(workerCount ? workerCount : 1)
+	, m_ListeningSocket(-1)
+	, m_bStopping(false)
+	, m_bVerifyChecksumsWithoutACK(true)
+{
+}
+
+GDBServerFoundation::EventDrivenServer::~EventDrivenServer()
+{
+	if (!m_Reactors.empty())
+	{
+		StopListening();
+		WaitForTermination();
+	}
+}
+
+BazisLib::ActionStatus GDBServerFoundation::EventDrivenServer::Start(unsigned port)
+{
+	if (m_ListeningSocket != -1)
+		return MAKE_STATUS(InvalidState);
+
+	m_ListeningSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (m_ListeningSocket == -1)
+		return MAKE_STATUS(UnknownError);
+
+	int one = 1;
+	setsockopt(m_ListeningSocket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	sockaddr_in addr = {0, };
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons((unsigned short)port);
+
+	if (bind(m_ListeningSocket, (sockaddr *)&addr, sizeof(addr)) || listen(m_ListeningSocket, SOMAXCONN))
+	{
+		close(m_ListeningSocket);
+		m_ListeningSocket = -1;
+		return MAKE_STATUS(UnknownError);
+	}
+
+	return StartThreads();
+}
+
+BazisLib::ActionStatus GDBServerFoundation::EventDrivenServer::StartUnixSocket(const char *pPath)
+{
+	if (m_ListeningSocket != -1)
+		return MAKE_STATUS(InvalidState);
+
+	sockaddr_un addr = {0, };
+	addr.sun_family = AF_UNIX;
+	if (strlen(pPath) >= sizeof(addr.sun_path))
+		return MAKE_STATUS(InvalidParameter);
+	strcpy(addr.sun_path, pPath);
+
+	m_ListeningSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (m_ListeningSocket == -1)
+		return MAKE_STATUS(UnknownError);
+
+	unlink(pPath);
+	if (bind(m_ListeningSocket, (sockaddr *)&addr, sizeof(addr)) || listen(m_ListeningSocket, SOMAXCONN))
+	{
+		close(m_ListeningSocket);
+		m_ListeningSocket = -1;
+		return MAKE_STATUS(UnknownError);
+	}
+
+	m_UnixSocketPath = pPath;
+	return StartThreads();
+}
+
+BazisLib::ActionStatus GDBServerFoundation::EventDrivenServer::StartThreads()
+{
+	for (unsigned i = 0; i < m_WorkerCount; i++)
+	{
+		m_Workers.push_back(new MemberThread(this, &EventDrivenServer::WorkerThreadBody));
+		m_Workers.back()->Start();
+	}
+
+	for (unsigned i = 0; i < m_ReactorCount; i++)
+	{
+		m_Reactors.push_back(new Reactor(this));
+		if (!m_Reactors.back()->Start(m_ListeningSocket))
+		{
+			StopListening();
+			WaitForTermination();
+			return MAKE_STATUS(UnknownError);
+		}
+	}
+
+	return MAKE_STATUS(Success);
+}
+
+void GDBServerFoundation::EventDrivenServer::StopListening()
+{
+	m_bStopping = true;
+	for (size_t i = 0; i < m_Reactors.size(); i++)
+		m_Reactors[i]->Wakeup();
+}
+
+void GDBServerFoundation::EventDrivenServer::WaitForTermination()
+{
+	for (size_t i = 0; i < m_Reactors.size(); i++)
+	{
+		m_Reactors[i]->Join();
+		delete m_Reactors[i];
+	}
+	m_Reactors.clear();
+
+	//A NULL session terminates a worker thread
+	for (size_t i = 0; i < m_Workers.size(); i++)
+		QueueRequest(NULL);
+
+	for (size_t i = 0; i < m_Workers.size(); i++)
+	{
+		m_Workers[i]->Join();
+		delete m_Workers[i];
+	}
+	m_Workers.clear();
+
+	if (m_ListeningSocket != -1)
+	{
+		close(m_ListeningSocket);
+		m_ListeningSocket = -1;
+	}
+
+	if (!m_UnixSocketPath.empty())
+	{
+		unlink(m_UnixSocketPath.c_str());
+		m_UnixSocketPath.clear();
+	}
+}
+
+void GDBServerFoundation::EventDrivenServer::QueueRequest(Session *pSession)
+{
+	{
+		MutexLocker lck(m_RequestLock);
+		m_PendingRequests.push_back(pSession);
+	}
+	m_RequestSemaphore.Signal();
+}
+
+int GDBServerFoundation::EventDrivenServer::WorkerThreadBody()
+{
+	for (;;)
+	{
+		m_RequestSemaphore.Wait();
+
+		Session *pSession;
+		{
+			MutexLocker lck(m_RequestLock);
+			ASSERT(!m_PendingRequests.empty());
+			pSession = m_PendingRequests.front();
+			m_PendingRequests.pop_front();
+		}
+
+		if (!pSession)
+			break;
+
+		//The reply is encoded and sent by the reactor thread. The parts of a streamed reply are read from the stream as the socket becomes writable.
+		pSession->Response = DispatchPacket(pSession->pStub, pSession->pRequest, pSession->RequestLength, pSession->Framer.GetNewAckEnabledPointer());
+
+		pSession->pReactor->PostCompletion(pSession);
+	}
+
+	return 0;
+}
+
+#else
+
+GDBServerFoundation::EventDrivenServer::EventDrivenServer(GDBServer *pServer, IGDBStubFactory *pFactory, unsigned reactorCount, unsigned workerCount)
+	: m_pServer(pServer)
+	, m_pFactory(pFactory)
+	, m_ReactorCount(reactorCount)
+	, m_WorkerCount(workerCount)
+	, m_ListeningSocket(-1)
+	, m_bStopping(false)
+	, m_bVerifyChecksumsWithoutACK(true)
+{
+}
+
+GDBServerFoundation::EventDrivenServer::~EventDrivenServer()
+{
+}
+
+BazisLib::ActionStatus GDBServerFoundation::EventDrivenServer::Start(unsigned port)
+{
+	return MAKE_STATUS(NotSupported);
+}
+
+BazisLib::ActionStatus GDBServerFoundation::EventDrivenServer::StartUnixSocket(const char *pPath)
+{
+	return MAKE_STATUS(NotSupported);
+}
+
+BazisLib::ActionStatus GDBServerFoundation::EventDrivenServer::StartThreads()
+{
+	return MAKE_STATUS(NotSupported);
+}
+
+void GDBServerFoundation::EventDrivenServer::StopListening()
+{
+}
+
+void GDBServerFoundation::EventDrivenServer::WaitForTermination()
+{
+}
+
+int GDBServerFoundation::EventDrivenServer::WorkerThreadBody()
+{
+	return 0;
+}
+
+void GDBServerFoundation::EventDrivenServer::QueueRequest(Session *pSession)
+{
+}
+
+#endif
+
+void GDBServerFoundation::EventDrivenServer::ReportProtocolError(const BazisLib::String &msg)
+{
+	if (m_pFactory)
+		m_pFactory->OnProtocolError(msg.c_str());
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <bzscore/status.h>
+#include <bzscore/sync.h>
+#include <bzscore/thread.h>
+#include <vector>
+#include <deque>
+#include <string>
+#include "IGDBStub.h"
+
+namespace GDBServerFoundation
+{
+	class GDBServer;
+
+	//! Implements the packet layer of the gdbserver protocol for many simultaneous connections using a small pool of epoll reactor threads
+	/*! Unlike the thread-per-connection mode of GDBServer, the reactor threads perform packet framing, acknowledgment handling and
+		break-in (0x03) detection for all sockets. Only the IGDBStub::HandleRequest() calls (that can block inside the target) are
+		dispatched to a pool of worker threads. Thus the amount of threads does not depend on the amount of open connections.
+
+		This class is normally used via GDBServer::StartEventDriven():
+		\code
+			GDBServer srv(new MyStubFactory());
+			srv.StartEventDriven(kTCPPort, 1, 8);
+			srv.WaitForTermination();
+		\endcode
+
+		\remarks The reactor is based on epoll() and is only available on Linux. On other platforms Start() returns a NotSupported error.
+				 The worker count limits the amount of requests (e.g. 'continue') that can block in the targets simultaneously.
+				 The rest of a streamed reply (see IReplyStream) is produced by the reactor thread each time the socket can accept more data,
+				 so the targets should not block inside IReplyStream::ReadNextPart().
+	*/
+	class EventDrivenServer
+	{
+	private:
+		struct Session;
+		class Reactor;
+
+	private:
+		GDBServer *m_pServer;
+		IGDBStubFactory *m_pFactory;
+		unsigned m_ReactorCount, m_WorkerCount;
+
+		int m_ListeningSocket;
+		std::string m_UnixSocketPath;
+		volatile bool m_bStopping;
+		bool m_bVerifyChecksumsWithoutACK;
+
+		std::vector<Reactor *> m_Reactors;
+		std::vector<BazisLib::MemberThread *> m_Workers;
+
+		BazisLib::Mutex m_RequestLock;
+		BazisLib::Semaphore m_RequestSemaphore;
+		std::deque<Session *> m_PendingRequests;
+
+	private:
+		int WorkerThreadBody();
+		void QueueRequest(Session *pSession);
+		void ReportProtocolError(const BazisLib::String &msg);
+		BazisLib::ActionStatus StartThreads();
+
+	public:
+		//! Creates the server. The factory is not owned by this object.
+		EventDrivenServer(GDBServer *pServer, IGDBStubFactory *pFactory, unsigned reactorCount, unsigned workerCount);
+		~EventDrivenServer();
+
+		//! Starts listening for incoming connections on the given TCP port
+		BazisLib::ActionStatus Start(unsigned port);
+
+		//! Starts listening for incoming connections on a Unix domain socket. An existing file at pPath is deleted.
+		BazisLib::ActionStatus StartUnixSocket(const char *pPath);
+
+		//! Specifies whether the packet checksums are verified in the no-ack mode. See PacketCodec::PacketFramer::SetVerifyChecksumsWithoutACK().
+		void SetVerifyChecksumsWithoutACK(bool verify) {m_bVerifyChecksumsWithoutACK = verify;}
+
+		//! Stops accepting new connections. The existing connections are not affected.
+		void StopListening();
+
+		//! Waits till StopListening() is called and the last connection is closed
+		void WaitForTermination();
+	};
+}
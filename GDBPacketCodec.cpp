@@ -0,0 +1,671 @@
+#include "stdafx.h"
+#include "GDBPacketCodec.h"
+#include "HexHelpers.h"
+#include "CPUFeatures.h"
+#include <numeric>
+
+using namespace BazisLib;
+using namespace GDBServerFoundation;
+using namespace GDBServerFoundation::HexHelpers;
+using namespace GDBServerFoundation::PacketCodec;
+
+unsigned GDBServerFoundation::PacketCodec::ComputeChecksum(const void *p, size_t length)
+{
+	unsigned char *pCh = (unsigned char *)p;
+	return std::accumulate(pCh, pCh + length, 0) & 0xFF;
+}
+
+size_t GDBServerFoundation::PacketCodec::UnescapePacket(const void *pPacket, size_t escapedSize, void *pTarget)
+{
+	size_t w = 0;
+	const char *pCh = (const char *)pPacket;
+	char *pOut = (char *)pTarget;
+
+	for (size_t r = 0; r < escapedSize; r++)
+	{
+		if (pCh[r] == kEscapeChar && r != (escapedSize - 1))
+			pOut[w++] = pCh[++r] ^ kEscapeMask;
+		else
+			pOut[w++] = pCh[r];
+	}
+
+	return w;
+}
+
+#ifdef GDBSERVER_HAS_SSE2
+
+//Processes the 16-byte blocks until the first '#' or '}' symbol is found. Returns the new read offset.
+static size_t ScanPacketBlocksSSE2(char *pPacket, size_t readOffset, size_t available, size_t *pWriteOffset, unsigned *pChecksum)
+{
+	const __m128i endChar = _mm_set1_epi8(kPacketEnd), escapeChar = _mm_set1_epi8(kEscapeChar), zero = _mm_setzero_si128();
+	__m128i sum = zero;
+	size_t r = readOffset, w = *pWriteOffset;
+
+	while (r + 16 <= available)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i *)(pPacket + r));
+		unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, endChar), _mm_cmpeq_epi8(block, escapeChar)));
+		if (mask)
+		{
+			//Only the bytes preceding the special symbol are processed here. Storing the entire block could overwrite the unscanned data.
+			size_t count = CPUFeatures::CountTrailingZeros(mask);
+			for (size_t i = 0; i < count; i++)
+				*pChecksum += (unsigned char)pPacket[r + i];
+			if (w != r)
+				memmove(pPacket + w, pPacket + r, count);
+			r += count;
+			w += count;
+			break;
+		}
+
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(block, zero));
+		if (w != r)
+			_mm_storeu_si128((__m128i *)(pPacket + w), block);
+		r += 16;
+		w += 16;
+	}
+
+	*pChecksum += _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+	*pWriteOffset = w;
+	return r;
+}
+
+GDBSERVER_AVX2_FUNCTION static size_t ScanPacketBlocksAVX2(char *pPacket, size_t readOffset, size_t available, size_t *pWriteOffset, unsigned *pChecksum)
+{
+	const __m256i endChar = _mm256_set1_epi8(kPacketEnd), escapeChar = _mm256_set1_epi8(kEscapeChar), zero = _mm256_setzero_si256();
+	__m256i sum = zero;
+	size_t r = readOffset, w = *pWriteOffset;
+
+	while (r + 32 <= available)
+	{
+		__m256i block = _mm256_loadu_si256((const __m256i *)(pPacket + r));
+		unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, endChar), _mm256_cmpeq_epi8(block, escapeChar)));
+		if (mask)
+		{
+			size_t count = CPUFeatures::CountTrailingZeros(mask);
+			for (size_t i = 0; i < count; i++)
+				*pChecksum += (unsigned char)pPacket[r + i];
+			if (w != r)
+				memmove(pPacket + w, pPacket + r, count);
+			r += count;
+			w += count;
+			break;
+		}
+
+		sum = _mm256_add_epi64(sum, _mm256_sad_epu8(block, zero));
+		if (w != r)
+			_mm256_storeu_si256((__m256i *)(pPacket + w), block);
+		r += 32;
+		w += 32;
+	}
+
+	__m128i sum128 = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+	*pChecksum += _mm_cvtsi128_si32(sum128) + _mm_cvtsi128_si32(_mm_srli_si128(sum128, 8));
+	*pWriteOffset = w;
+	return r;
+}
+
+#endif
+
+size_t GDBServerFoundation::PacketCodec::ScanPacketBody(char *pPacket, size_t available, PacketScanState *pState)
+{
+	size_t r = pState->ReadOffset, w = pState->WriteOffset;
+	unsigned checksum = pState->Checksum;
+	bool escapePending = pState->EscapePending;
+	size_t result = -1;
+
+#ifdef GDBSERVER_HAS_SSE2
+	bool useAVX2 = CPUFeatures::HasAVX2();
+#endif
+
+	for (;;)
+	{
+#ifdef GDBSERVER_HAS_SSE2
+		//Skip the blocks without special symbols. The remaining bytes (and the special symbols) are handled below one by one.
+		if (!escapePending)
+		{
+			if (useAVX2)
+				r = ScanPacketBlocksAVX2(pPacket, r, available, &w, &checksum);
+			r = ScanPacketBlocksSSE2(pPacket, r, available, &w, &checksum);
+		}
+#endif
+
+		if (r >= available)
+			break;
+
+		char ch = pPacket[r];
+		if (escapePending)
+		{
+			pPacket[w++] = ch ^ kEscapeMask;
+			escapePending = false;
+		}
+		else if (ch == kPacketEnd)
+		{
+			result = r;
+			break;
+		}
+		else if (ch == kEscapeChar)
+			escapePending = true;
+		else
+			pPacket[w++] = ch;
+
+		checksum += (unsigned char)ch;
+		r++;
+	}
+
+	pState->ReadOffset = r;
+	pState->WriteOffset = w;
+	pState->Checksum = checksum;
+	pState->EscapePending = escapePending;
+	return result;
+}
+
+void GDBServerFoundation::PacketCodec::EncodePacketReference(const char *pReply, size_t replySize, BazisLib::BasicBuffer &output)
+{
+	//Worst case: every character is escaped, plus '$' and '#xx'
+	size_t oldSize = output.GetSize();
+	if (!output.EnsureSize(oldSize + replySize * 2 + 4))
+		return;
+
+	char *pOut = (char *)output.GetData(oldSize);
+	size_t outSize = 0;
+
+	pOut[outSize++] = kPacketStart;
+
+	static const char charsToEscape[] = "#$}*";
+	unsigned char checksum = 0;
+
+	for (size_t i = 0; i < replySize; i++)
+	{
+		char charToSend = pReply[i];
+		size_t runLength = 1;
+
+		size_t remaining = replySize - i;
+		while(runLength < remaining)
+			if (pReply[i + runLength] == charToSend)
+				runLength++;
+			else
+				break;
+
+		if (strchr(charsToEscape, charToSend))
+		{
+			pOut[outSize++] = kEscapeChar;
+			pOut[outSize++] = charToSend ^ kEscapeMask;
+			checksum += kEscapeChar + (charToSend ^ kEscapeMask);
+			runLength = 1;	//RLE-encoding escaped characters seems to be unsupported by gdb
+		}
+		else
+		{
+			pOut[outSize++] = charToSend;
+			checksum += charToSend;
+		}
+
+		if (runLength > 3)
+		{
+			size_t moreCharacters = runLength - 1;
+
+			if (moreCharacters >= (126 - kRLEBase))
+				moreCharacters = (126 - kRLEBase);
+
+			char runLengthChar = (char)(kRLEBase + moreCharacters);
+			if (runLengthChar == kPacketStart || runLengthChar == kPacketEnd || runLengthChar == kEscapeChar)
+				moreCharacters = 0;
+			else
+			{
+				pOut[outSize++] = kRLEMarker;
+				pOut[outSize++] = runLengthChar;
+
+				checksum += kRLEMarker + runLengthChar;
+
+				i += moreCharacters;
+			}
+		}
+	}
+
+	pOut[outSize++] = kPacketEnd;
+	pOut[outSize++] = hexTable[(checksum >> 4) & 0x0F];
+	pOut[outSize++] = hexTable[checksum & 0x0F];
+
+	output.SetSize(oldSize + outSize);
+}
+
+#ifdef _DEBUG
+
+static void VerifyEncodedPacket(const char *pReply, size_t replySize, const char *pEncoded, size_t encodedSize)
+{
+	BasicBuffer reference;
+	EncodePacketReference(pReply, replySize, reference);
+	ASSERT(reference.GetSize() == encodedSize);
+	ASSERT(!memcmp(reference.GetConstData(), pEncoded, encodedSize));
+}
+
+#endif
+
+static inline bool IsCharacterEscaped(char ch)
+{
+	//The original encoder used strchr("#$}*", ch), that also matches the null character. The same wire format is kept here.
+	return ch == kPacketStart || ch == kPacketEnd || ch == kEscapeChar || ch == kRLEMarker || !ch;
+}
+
+#ifdef GDBSERVER_HAS_SSE2
+
+//Skips the 16-byte blocks that neither contain characters requiring escaping, nor start runs of 4 or more equal characters.
+//The skipped bytes are added to the checksum. Returns the offset of the first byte requiring special handling.
+static size_t SkipPlainReplyBytesSSE2(const char *pReply, size_t offset, size_t replySize, unsigned *pChecksum)
+{
+	const __m128i startChar = _mm_set1_epi8(kPacketStart), endChar = _mm_set1_epi8(kPacketEnd), escapeChar = _mm_set1_epi8(kEscapeChar);
+	const __m128i rleChar = _mm_set1_epi8(kRLEMarker), zero = _mm_setzero_si128();
+	__m128i sum = zero;
+
+	//Detecting the runs requires 3 more bytes after the block
+	while (offset + 16 + 3 <= replySize)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i *)(pReply + offset));
+		__m128i runs = _mm_and_si128(_mm_cmpeq_epi8(block, _mm_loadu_si128((const __m128i *)(pReply + offset + 1))),
+									 _mm_and_si128(_mm_cmpeq_epi8(block, _mm_loadu_si128((const __m128i *)(pReply + offset + 2))),
+												   _mm_cmpeq_epi8(block, _mm_loadu_si128((const __m128i *)(pReply + offset + 3)))));
+
+		__m128i escaped = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, startChar), _mm_cmpeq_epi8(block, endChar)),
+									   _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, escapeChar), _mm_cmpeq_epi8(block, rleChar)), _mm_cmpeq_epi8(block, zero)));
+
+		unsigned mask = _mm_movemask_epi8(_mm_or_si128(runs, escaped));
+		if (mask)
+		{
+			size_t count = CPUFeatures::CountTrailingZeros(mask);
+			for (size_t i = 0; i < count; i++)
+				*pChecksum += (unsigned char)pReply[offset + i];
+			offset += count;
+			break;
+		}
+
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(block, zero));
+		offset += 16;
+	}
+
+	*pChecksum += _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+	return offset;
+}
+
+GDBSERVER_AVX2_FUNCTION static size_t SkipPlainReplyBytesAVX2(const char *pReply, size_t offset, size_t replySize, unsigned *pChecksum)
+{
+	const __m256i startChar = _mm256_set1_epi8(kPacketStart), endChar = _mm256_set1_epi8(kPacketEnd), escapeChar = _mm256_set1_epi8(kEscapeChar);
+	const __m256i rleChar = _mm256_set1_epi8(kRLEMarker), zero = _mm256_setzero_si256();
+	__m256i sum = zero;
+
+	while (offset + 32 + 3 <= replySize)
+	{
+		__m256i block = _mm256_loadu_si256((const __m256i *)(pReply + offset));
+		__m256i runs = _mm256_and_si256(_mm256_cmpeq_epi8(block, _mm256_loadu_si256((const __m256i *)(pReply + offset + 1))),
+										_mm256_and_si256(_mm256_cmpeq_epi8(block, _mm256_loadu_si256((const __m256i *)(pReply + offset + 2))),
+														 _mm256_cmpeq_epi8(block, _mm256_loadu_si256((const __m256i *)(pReply + offset + 3)))));
+
+		__m256i escaped = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, startChar), _mm256_cmpeq_epi8(block, endChar)),
+										  _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, escapeChar), _mm256_cmpeq_epi8(block, rleChar)), _mm256_cmpeq_epi8(block, zero)));
+
+		unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(runs, escaped));
+		if (mask)
+		{
+			size_t count = CPUFeatures::CountTrailingZeros(mask);
+			for (size_t i = 0; i < count; i++)
+				*pChecksum += (unsigned char)pReply[offset + i];
+			offset += count;
+			break;
+		}
+
+		sum = _mm256_add_epi64(sum, _mm256_sad_epu8(block, zero));
+		offset += 32;
+	}
+
+	__m128i sum128 = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+	*pChecksum += _mm_cvtsi128_si32(sum128) + _mm_cvtsi128_si32(_mm_srli_si128(sum128, 8));
+	return offset;
+}
+
+#endif
+
+//Escapes and RLE-encodes the reply body. The _Sink class should provide AppendReplyData() for the unmodified spans of the reply
+//and AppendEncodedData() for the escape sequences and RLE markers. Returns the checksum of the encoded body.
+template <class _Sink> static unsigned char EncodeReplyBody(const char *pReply, size_t replySize, _Sink &sink)
+{
+	unsigned checksum = 0;
+	size_t spanStart = 0;
+
+#ifdef GDBSERVER_HAS_SSE2
+	bool useAVX2 = CPUFeatures::HasAVX2();
+#endif
+
+	for (size_t i = 0; i < replySize; i++)
+	{
+#ifdef GDBSERVER_HAS_SSE2
+		//Most of the hex-encoded data consists of plain characters. Only the escaped characters and the runs are handled one by one.
+		if (useAVX2)
+			i = SkipPlainReplyBytesAVX2(pReply, i, replySize, &checksum);
+		i = SkipPlainReplyBytesSSE2(pReply, i, replySize, &checksum);
+		if (i >= replySize)
+			break;
+#endif
+
+		char charToSend = pReply[i];
+		if (IsCharacterEscaped(charToSend))
+		{
+			//RLE-encoding escaped characters seems to be unsupported by gdb
+			char escapeSequence[] = {kEscapeChar, (char)(charToSend ^ kEscapeMask)};
+			sink.AppendReplyData(pReply + spanStart, i - spanStart);
+			sink.AppendEncodedData(escapeSequence, 2);
+			checksum += escapeSequence[0] + escapeSequence[1];
+			spanStart = i + 1;
+			continue;
+		}
+
+		checksum += (unsigned char)charToSend;
+
+		size_t runLength = 1;
+		size_t remaining = replySize - i;
+		while(runLength < remaining)
+			if (pReply[i + runLength] == charToSend)
+				runLength++;
+			else
+				break;
+
+		if (runLength > 3)
+		{
+			size_t moreCharacters = runLength - 1;
+
+			if (moreCharacters >= (126 - kRLEBase))
+				moreCharacters = (126 - kRLEBase);
+
+			char runLengthChar = (char)(kRLEBase + moreCharacters);
+			if (runLengthChar != kPacketStart && runLengthChar != kPacketEnd && runLengthChar != kEscapeChar)
+			{
+				char rleSequence[] = {kRLEMarker, runLengthChar};
+				sink.AppendReplyData(pReply + spanStart, i + 1 - spanStart);
+				sink.AppendEncodedData(rleSequence, 2);
+				checksum += rleSequence[0] + rleSequence[1];
+
+				i += moreCharacters;
+				spanStart = i + 1;
+			}
+		}
+	}
+
+	sink.AppendReplyData(pReply + spanStart, replySize - spanStart);
+	return (unsigned char)checksum;
+}
+
+namespace
+{
+	struct ContiguousPacketWriter
+	{
+		char *pOut;
+		size_t Size;
+
+		void AppendReplyData(const char *pData, size_t length)
+		{
+			memcpy(pOut + Size, pData, length);
+			Size += length;
+		}
+
+		void AppendEncodedData(const char *pData, size_t length)
+		{
+			memcpy(pOut + Size, pData, length);
+			Size += length;
+		}
+	};
+}
+
+void GDBServerFoundation::PacketCodec::EncodePacket(const char *pReply, size_t replySize, BazisLib::BasicBuffer &output)
+{
+	//Worst case: every character is escaped, plus '$' and '#xx'
+	size_t oldSize = output.GetSize();
+	if (!output.EnsureSize(oldSize + replySize * 2 + 4))
+		return;
+
+	ContiguousPacketWriter writer = {(char *)output.GetData(oldSize), 0};
+	writer.pOut[writer.Size++] = kPacketStart;
+
+	unsigned char checksum = EncodeReplyBody(pReply, replySize, writer);
+
+	writer.pOut[writer.Size++] = kPacketEnd;
+	writer.pOut[writer.Size++] = hexTable[(checksum >> 4) & 0x0F];
+	writer.pOut[writer.Size++] = hexTable[checksum & 0x0F];
+
+#ifdef _DEBUG
+	VerifyEncodedPacket(pReply, replySize, writer.pOut, writer.Size);
+#endif
+
+	output.SetSize(oldSize + writer.Size);
+}
+
+void GDBServerFoundation::PacketCodec::ScatterGatherEncoder::AppendExtraData(const char *pData, size_t length)
+{
+	if (!length)
+		return;
+
+	size_t offset = m_ExtraData.size();
+	m_ExtraData.insert(m_ExtraData.end(), pData, pData + length);
+
+	//Merge with the previous segment if it is also stored in m_ExtraData
+	if (!m_Records.empty() && !m_Records.back().pData)
+	{
+		m_Records.back().Length += length;
+		return;
+	}
+
+	SegmentRecord rec = {NULL, offset, length};
+	m_Records.push_back(rec);
+}
+
+void GDBServerFoundation::PacketCodec::ScatterGatherEncoder::AppendReplyData(const char *pData, size_t length)
+{
+	if (length < kMinReferencedSpan)
+	{
+		AppendExtraData(pData, length);
+		return;
+	}
+
+	SegmentRecord rec = {pData, 0, length};
+	m_Records.push_back(rec);
+}
+
+void GDBServerFoundation::PacketCodec::ScatterGatherEncoder::EncodePart(const char *pReply, size_t replySize, bool prependACK, unsigned flags)
+{
+	m_Records.clear();
+	m_ExtraData.clear();
+	m_Segments.clear();
+	m_FirstPendingSegment = 0;
+
+	if (flags & kFirstPart)
+	{
+		char header[] = {kACK, kPacketStart};
+		if (prependACK)
+			AppendExtraData(header, 2);
+		else
+			AppendExtraData(header + 1, 1);
+		m_Checksum = 0;
+	}
+
+	//The local class has access to the private methods of ScatterGatherEncoder
+	struct SegmentWriter
+	{
+		ScatterGatherEncoder *pEncoder;
+
+		void AppendReplyData(const char *pData, size_t length) {pEncoder->AppendReplyData(pData, length);}
+		void AppendEncodedData(const char *pData, size_t length) {pEncoder->AppendExtraData(pData, length);}
+	} writer = {this};
+
+	m_Checksum += EncodeReplyBody(pReply, replySize, writer);
+
+	if (flags & kLastPart)
+	{
+		unsigned char checksum = (unsigned char)m_Checksum;
+		char trailer[] = {kPacketEnd, hexTable[(checksum >> 4) & 0x0F], hexTable[checksum & 0x0F]};
+		AppendExtraData(trailer, 3);
+	}
+
+	//m_ExtraData will not be reallocated anymore, so the offsets can be converted to pointers
+	m_Segments.resize(m_Records.size());
+	for (size_t i = 0; i < m_Records.size(); i++)
+	{
+		m_Segments[i].pData = m_Records[i].pData ? m_Records[i].pData : &m_ExtraData[m_Records[i].ExtraOffset];
+		m_Segments[i].Length = m_Records[i].Length;
+	}
+
+#ifdef _DEBUG
+	if ((flags & (kFirstPart | kLastPart)) == (kFirstPart | kLastPart))
+	{
+		std::vector<char> encodedPacket;
+		for (size_t i = 0; i < m_Segments.size(); i++)
+			encodedPacket.insert(encodedPacket.end(), m_Segments[i].pData, m_Segments[i].pData + m_Segments[i].Length);
+		size_t headerSize = prependACK ? 1 : 0;
+		VerifyEncodedPacket(pReply, replySize, encodedPacket.data() + headerSize, encodedPacket.size() - headerSize);
+	}
+#endif
+}
+
+void GDBServerFoundation::PacketCodec::ScatterGatherEncoder::OnDataSent(size_t bytes)
+{
+	while (bytes && m_FirstPendingSegment < m_Segments.size())
+	{
+		Segment &seg = m_Segments[m_FirstPendingSegment];
+		if (bytes < seg.Length)
+		{
+			seg.pData += bytes;
+			seg.Length -= bytes;
+			return;
+		}
+
+		bytes -= seg.Length;
+		m_FirstPendingSegment++;
+	}
+}
+
+StubResponse GDBServerFoundation::PacketCodec::DispatchPacket(IGDBStub *pStub, const char *pPacketBody, size_t packetBodyLength, bool *pAckEnabled)
+{
+	static const char splitterChars[] = ";:,";
+	size_t splitter = packetBodyLength;
+	char splitterChar = 0;
+	for (size_t i = 0; i < packetBodyLength; i++)
+	{
+		if (strchr(splitterChars, pPacketBody[i]))
+		{
+			splitter = i;
+			splitterChar = pPacketBody[i];
+			break;
+		}
+	}
+
+	BazisLib::TempStrPointerWrapperA cmd(pPacketBody, splitter), args(pPacketBody + splitter + 1, (splitter == packetBodyLength) ? 0 : packetBodyLength - splitter - 1);
+
+	if (cmd == "QStartNoAckMode")
+	{
+		//Disables the +/- packet acknowledgment.
+		ASSERT(pAckEnabled);
+		ASSERT(*pAckEnabled);
+		*pAckEnabled = false;
+		return StandardResponses::OK;
+	}
+
+	return pStub->HandleRequest(cmd, splitterChar, args);
+}
+
+void GDBServerFoundation::PacketCodec::PacketReceiveBuffer::Discard(size_t size)
+{
+	m_ReadOffset += size;
+	if (m_ReadOffset >= m_Buffer.GetSize())
+		Clear();
+}
+
+char *GDBServerFoundation::PacketCodec::PacketReceiveBuffer::PrepareReceive(size_t size)
+{
+	size_t used = GetSize();
+	if (m_ReadOffset)
+	{
+		//Normally only an incomplete packet is moved here, as the complete ones have already been consumed
+		if (used)
+			memmove(m_Buffer.GetData(), m_Buffer.GetData(m_ReadOffset), used);
+		m_Buffer.SetSize(used);
+		m_ReadOffset = 0;
+	}
+
+	if (!m_Buffer.EnsureSize(used + size))
+		return NULL;
+	return (char *)m_Buffer.GetData(used);
+}
+
+PacketCodec::PacketFramer::Event GDBServerFoundation::PacketCodec::PacketFramer::ProcessData(char *pData, size_t size)
+{
+	Event evt = {kNeedMoreData, 0, NULL, 0, false, 0, 0, 0};
+
+	size_t pos = 0;
+	while (pos < size)
+	{
+		char ch = pData[pos];
+		if (ch == kBreakInByte)
+		{
+			evt.Type = kBreakInRequest;
+			evt.ConsumedBytes = pos + 1;
+			return evt;
+		}
+
+		//We expect the following format: [+]$<data>#<checksum>
+		if (m_bAckEnabled && !m_bAckReceived)
+		{
+			pos++;
+			if (ch != kACK)
+			{
+				evt.Type = kInvalidCharacter;
+				evt.ErrorChar = ch;
+				evt.ConsumedBytes = pos;
+				return evt;
+			}
+
+			m_bAckReceived = true;
+			continue;
+		}
+
+		if (ch != kPacketStart)
+		{
+			evt.Type = kInvalidCharacter;
+			evt.ErrorChar = ch;
+			evt.ConsumedBytes = pos + 1;
+			return evt;
+		}
+
+		char *pBody = pData + pos + 1;
+		size_t available = size - pos - 1;
+		size_t endOfPacket = ScanPacketBody(pBody, available, &m_ScanState);
+
+		if (endOfPacket == -1 || available < (endOfPacket + 3))
+		{
+			//Keep the '$' in the buffer, the scan will continue from m_ScanState once more data arrives
+			evt.ConsumedBytes = pos;
+			return evt;
+		}
+
+		size_t unescapedSize = m_ScanState.WriteOffset;
+
+		evt.ConsumedBytes = pos + 1 + endOfPacket + 3;
+		evt.Checksum = ParseHexValue(pBody + endOfPacket + 1);
+		evt.ExpectedChecksum = m_ScanState.Checksum & 0xFF;
+
+		m_bAckReceived = false;
+		m_ScanState.Reset();
+		m_bAckEnabled = m_bNewAckEnabled;
+
+		bool verifyChecksum = m_bAckEnabled || m_bVerifyChecksumsWithoutACK;
+		if (verifyChecksum && evt.Checksum != evt.ExpectedChecksum)
+		{
+			evt.Type = kInvalidChecksum;
+			return evt;
+		}
+
+		evt.Type = kPacketReceived;
+		evt.pBody = pBody;
+		evt.BodyLength = unescapedSize;
+		evt.SendACK = m_bAckEnabled;
+		return evt;
+	}
+
+	evt.ConsumedBytes = pos;
+	return evt;
+}
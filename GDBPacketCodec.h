@@ -0,0 +1,281 @@
+#pragma once
+#include <bzscore/buffer.h>
+#include <vector>
+#include "IGDBStub.h"
+#include "GDBTransport.h"
+
+namespace GDBServerFoundation
+{
+	//! Contains the packet-level primitives of the gdbserver protocol (framing, checksums, escaping and RLE encoding)
+	/*! The functions and classes declared here are shared by all server implementations (GDBServer and EventDrivenServer),
+		so that the wire format is produced and parsed by exactly one piece of code.
+	*/
+	namespace PacketCodec
+	{
+		enum
+		{
+			kACK = '+',
+			kNAK = '-',
+			kPacketStart = '$',
+			kPacketEnd = '#',
+			kEscapeChar = '}',
+			kRLEMarker = '*',
+			kEscapeMask = 0x20,
+			kRLEBase = 29,
+			kBreakInByte = 0x03,
+			//! Amount of bytes surrounding the packet body on the wire ('+', '$' and '#xx')
+			kPacketFramingSize = 4,
+		};
+
+		//! Computes the modulo-256 checksum of a packet body
+		unsigned ComputeChecksum(const void *p, size_t length);
+
+		//! Unescapes the packet body. The target buffer should be at least escapedSize bytes long. Returns the unescaped size.
+		/*! As the unescaped packet is never longer than the escaped one, pTarget can be equal to pPacket to unescape the packet in place. */
+		size_t UnescapePacket(const void *pPacket, size_t escapedSize, void *pTarget);
+
+		//! Contains the progress of ScanPacketBody() between the calls
+		struct PacketScanState
+		{
+			//! Offset of the first escaped byte that has not been scanned yet
+			size_t ReadOffset;
+			//! Amount of the unescaped bytes stored at the beginning of the packet
+			size_t WriteOffset;
+			//! Sum of the scanned escaped bytes (only the lowest 8 bits are used)
+			unsigned Checksum;
+			//! Set if the last scanned byte was the escape symbol ('}')
+			bool EscapePending;
+
+			PacketScanState()
+			{
+				Reset();
+			}
+
+			void Reset()
+			{
+				ReadOffset = WriteOffset = 0;
+				Checksum = 0;
+				EscapePending = false;
+			}
+		};
+
+		//! Searches for the end-of-packet symbol ('#'), computes the checksum and unescapes the packet in place in a single pass
+		/*! The bytes are processed in 32-byte (AVX2) or 16-byte (SSE2) blocks where the CPU supports it. Blocks without '#' and '}'
+			symbols are only added to the checksum and moved to the unescaped position.
+
+			\param pPacket Points to the first byte following the '$' symbol. The bytes before pState->ReadOffset are overwritten with the unescaped data.
+			\param available Specifies the amount of bytes available at pPacket.
+			\param pState Contains the progress of the previous calls for the same packet, so that the next call (with more data available)
+				   does not need to rescan the same bytes. Should be reset before scanning a new packet.
+			\return Offset of the '#' symbol relative to pPacket, or -1 if it was not found. Once the symbol is found, pState->WriteOffset contains
+					the unescaped packet size and pState->Checksum contains the checksum of the escaped packet.
+		*/
+		size_t ScanPacketBody(char *pPacket, size_t available, PacketScanState *pState);
+
+		//! Escapes and RLE-encodes a reply and appends the resulting packet (including '$' and '#xx') to a buffer
+		void EncodePacket(const char *pReply, size_t replySize, BazisLib::BasicBuffer &output);
+
+		//! The original byte-by-byte encoder producing the same output as EncodePacket()
+		/*! Debug builds compare the output of EncodePacket() and ScatterGatherEncoder against it. It is also used by the StubTests sample. */
+		void EncodePacketReference(const char *pReply, size_t replySize, BazisLib::BasicBuffer &output);
+
+		//! Escapes and RLE-encodes a reply into a list of segments that can be sent with a single IGDBTransport::SendSegments() call
+		/*! Unlike EncodePacket(), this class does not copy the reply. The segments reference the reply buffer directly and only the
+			packet header, escape sequences, RLE markers and the checksum are stored in an internal buffer. Short runs of reply
+			data between the escape sequences are copied to the internal buffer as well, so that the amount of segments stays low.
+
+			An encoder object can be reused for any amount of replies. The reply buffer passed to Encode() should not be
+			modified or freed until the entire packet has been sent.
+		*/
+		class ScatterGatherEncoder
+		{
+		public:
+			typedef DataSegment Segment;
+
+			enum PartFlags
+			{
+				//! The part starts the packet ('$' is sent before it)
+				kFirstPart = 0x01,
+				//! The part ends the packet ('#xx' is sent after it)
+				kLastPart = 0x02,
+			};
+
+		private:
+			enum {kMinReferencedSpan = 64};
+
+			struct SegmentRecord
+			{
+				//! Points to the reply data, or NULL if the segment is stored in m_ExtraData
+				const char *pData;
+				size_t ExtraOffset;
+				size_t Length;
+			};
+
+			std::vector<SegmentRecord> m_Records;
+			std::vector<char> m_ExtraData;
+			std::vector<Segment> m_Segments;
+			size_t m_FirstPendingSegment;
+			//! Checksum of the parts of the current packet encoded so far
+			unsigned m_Checksum;
+
+		private:
+			void AppendExtraData(const char *pData, size_t length);
+			void AppendReplyData(const char *pData, size_t length);
+
+		public:
+			ScatterGatherEncoder()
+				: m_FirstPendingSegment(0)
+				, m_Checksum(0)
+			{
+			}
+
+			//! Preallocates the internal buffers for replies up to the given size
+			void Reserve(size_t maxPacketSize)
+			{
+				m_ExtraData.reserve(maxPacketSize + kPacketFramingSize);
+			}
+
+			//! Encodes the reply, replacing any previously encoded data
+			/*!
+				\param prependACK If true, the '+' acknowledging the request is sent before the reply packet
+			*/
+			void Encode(const char *pReply, size_t replySize, bool prependACK)
+			{
+				EncodePart(pReply, replySize, prependACK, kFirstPart | kLastPart);
+			}
+
+			//! Encodes a part of a reply that is produced while it is being sent (see IReplyStream), replacing any previously encoded data
+			/*! The checksum is accumulated between the parts of the same packet. The pending segments should be sent before encoding the
+				next part. Each part is RLE-encoded separately, so the runs spanning several parts are not merged.
+				\param prependACK If true, the '+' acknowledging the request is sent before the reply packet. Only used with kFirstPart.
+				\param flags Contains the PartFlags values
+			*/
+			void EncodePart(const char *pData, size_t size, bool prependACK, unsigned flags);
+
+			//! Returns the segments that have not been sent yet
+			const Segment *GetPendingSegments() {return (m_FirstPendingSegment < m_Segments.size()) ? &m_Segments[m_FirstPendingSegment] : NULL;}
+			size_t GetPendingSegmentCount() {return m_Segments.size() - m_FirstPendingSegment;}
+
+			//! Marks the given amount of bytes as sent. Partially sent segments are adjusted accordingly.
+			void OnDataSent(size_t bytes);
+		};
+
+		//! Splits the unescaped packet into the command and arguments and passes it to the stub
+		/*!
+			\param pAckEnabled Points to the variable controlling the acknowledgment mode. The 'QStartNoAckMode' packet is
+				   handled here and resets it to false.
+		*/
+		StubResponse DispatchPacket(IGDBStub *pStub, const char *pPacketBody, size_t packetBodyLength, bool *pAckEnabled);
+
+		//! Accumulates the data received from GDB, so that the packets can be parsed and unescaped in place
+		/*! The consumed bytes are skipped by advancing the read offset. The remaining data is only moved to the beginning
+			of the buffer when PrepareReceive() is called. Thus the pointers returned by GetData() stay valid until the next
+			PrepareReceive() call and the stub can access the unescaped packets (e.g. binary payloads of 'X' and 'vFlashWrite')
+			directly in the receive buffer without copying them.
+		*/
+		class PacketReceiveBuffer
+		{
+		private:
+			BazisLib::BasicBuffer m_Buffer;
+			size_t m_ReadOffset;
+
+		public:
+			PacketReceiveBuffer()
+				: m_ReadOffset(0)
+			{
+			}
+
+			char *GetData() {return (char *)m_Buffer.GetData(m_ReadOffset);}
+			size_t GetSize() {return m_Buffer.GetSize() - m_ReadOffset;}
+
+			//! Removes the given amount of bytes from the beginning of the buffer
+			void Discard(size_t size);
+
+			//! Returns a pointer to at least size bytes of free space following the buffered data. Invalidates the pointers returned by GetData().
+			char *PrepareReceive(size_t size);
+
+			//! Appends the bytes written to the space returned by PrepareReceive() to the buffered data
+			void CommitReceive(size_t size)
+			{
+				m_Buffer.SetSize(m_Buffer.GetSize() + size);
+			}
+
+			void Clear()
+			{
+				m_Buffer.SetSize(0);
+				m_ReadOffset = 0;
+			}
+
+			//! Preallocates the buffer, so that packets of the given size can be received without reallocating it
+			void Reserve(size_t size)
+			{
+				m_Buffer.EnsureSize(m_Buffer.GetSize() + size);
+			}
+		};
+
+		//! Splits a stream of bytes received from GDB into packets, acknowledgments and break-in requests
+		/*! This class does not perform any I/O. The caller should accumulate the received data in a buffer and call
+			ProcessData() until it returns kNeedMoreData. The bytes reported via Event::ConsumedBytes should then be
+			removed from the beginning of the buffer.
+		*/
+		class PacketFramer
+		{
+		public:
+			enum EventType
+			{
+				//! The buffer does not contain a complete packet. Event::ConsumedBytes may still be non-zero.
+				kNeedMoreData,
+				//! A 0x03 byte was received outside a packet
+				kBreakInRequest,
+				//! A complete packet with a valid checksum has been received. Event::pBody points to the escaped body.
+				kPacketReceived,
+				//! An unexpected character or an invalid checksum was encountered. Event::ErrorChar or Event::Checksum describe it.
+				kInvalidCharacter,
+				kInvalidChecksum,
+			};
+
+			struct Event
+			{
+				EventType Type;
+				//! Amount of bytes at the beginning of the buffer that have been processed and should be discarded
+				size_t ConsumedBytes;
+				//! For kPacketReceived points to the packet body (following '$'). The body is unescaped in place.
+				char *pBody;
+				//! For kPacketReceived contains the length of the unescaped packet body
+				size_t BodyLength;
+				//! For kPacketReceived specifies whether the packet should be acknowledged with a '+'
+				bool SendACK;
+				char ErrorChar;
+				unsigned Checksum, ExpectedChecksum;
+			};
+
+		private:
+			bool m_bAckEnabled, m_bNewAckEnabled;
+			bool m_bAckReceived;
+			bool m_bVerifyChecksumsWithoutACK;
+			PacketScanState m_ScanState;
+
+		public:
+			PacketFramer()
+				: m_bAckEnabled(true)
+				, m_bNewAckEnabled(true)
+				, m_bAckReceived(false)
+				, m_bVerifyChecksumsWithoutACK(true)
+			{
+			}
+
+			//! Parses the next protocol event from the beginning of the buffer
+			/*! The packets are unescaped in place, so the buffer is modified. */
+			Event ProcessData(char *pData, size_t size);
+
+			//! Specifies whether the packet checksums are verified in the no-ack mode (see 'QStartNoAckMode')
+			/*! GDB enables the no-ack mode whenever the stub supports it, regardless of the transport. The checksums can only be safely
+				ignored if the transport itself guarantees the data integrity (e.g. TCP). See IGDBTransport::IsReliable(). */
+			void SetVerifyChecksumsWithoutACK(bool verify) {m_bVerifyChecksumsWithoutACK = verify;}
+
+			//! Returns a pointer to the variable that should be passed to DispatchPacket() to handle the 'QStartNoAckMode' packet.
+			/*! The new mode takes effect starting from the next packet, as GDB still acknowledges the reply to 'QStartNoAckMode'. */
+			bool *GetNewAckEnabledPointer() {return &m_bNewAckEnabled;}
+		};
+	}
+}
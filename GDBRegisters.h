@@ -1,8 +1,19 @@
 #pragma once
 #include <vector>
+#include <utility>
+#include "SessionArena.h"
 
 namespace GDBServerFoundation
 {
+	//! Specifies how a register is reported to GDB (see RegisterEntry::Flags)
+	enum RegisterFlags
+	{
+		//! The register is always included in the stop replies (e.g. the program counter, the stack pointer and the frame pointer),
+		//! so GDB does not need to read it after the target stops. If ReadFrameRelatedRegisters() does not provide it, GDBStub
+		//! reads all registers to report it only if the register cache is enabled (see GDBStub::EnableRegisterCache()).
+		rfExpedited = 0x01,
+	};
+
 	//! Describes a single register of the target platform
 	struct RegisterEntry
 	{
@@ -12,6 +23,19 @@ namespace GDBServerFoundation
 		const char *RegisterName;
 		//! The size of the register in bits
 		int SizeInBits;
+		//! A combination of RegisterFlags. Can be omitted from the initializer if no flags are needed.
+		unsigned Flags;
+	};
+
+	//! Describes the location of a register in the register block sent via the 'g' packet and the prefix reporting it in the stop replies
+	struct RegisterLayoutEntry
+	{
+		//! The offset of the register in bytes from the start of the register block
+		unsigned Offset;
+		unsigned SizeInBytes;
+		//! Contains the hex register number followed by ':' (e.g. "08:"). Not null-terminated.
+		char StopReplyPrefix[12];
+		unsigned char StopReplyPrefixLength;
 	};
 
 	/*!
@@ -22,13 +46,88 @@ namespace GDBServerFoundation
 	//! Contains a fixed list of registers defined at compile time
 	/*! An global instance of PlatformRegisterList should be initialized and provided via the IStoppedGDBTarget::GetRegisterList() method.
 		See \ref SimpleWin32Server/registers-i386.h "this example" for more details.
+
+		The layout of the register block can be computed at compile time by declaring the list via StaticRegisterList. Otherwise
+		it is computed when the stub is created.
 	*/
 	struct PlatformRegisterList
 	{
 		//! Specifies the amount of the registers
 		size_t RegisterCount;
 		//! Points to an array containing register definitions
-		RegisterEntry *Registers;
+		const RegisterEntry *Registers;
+		//! Points to an array containing the layout of each register (see StaticRegisterList), or NULL
+		const RegisterLayoutEntry *Layout;
+		//! Specifies the size in bytes of the register block (i.e. the sum of all register sizes) if Layout is not NULL
+		size_t BlockSize;
+	};
+
+	//! Computes the layout of a single register in the register block
+	constexpr RegisterLayoutEntry ComputeRegisterLayout(const RegisterEntry *pRegisters, size_t registerIndex)
+	{
+		RegisterLayoutEntry entry = {};
+		for (size_t i = 0; i < registerIndex; i++)
+			entry.Offset += (pRegisters[i].SizeInBits + 7) / 8;
+		entry.SizeInBytes = (pRegisters[registerIndex].SizeInBits + 7) / 8;
+
+		//Same as the "%02x:" format
+		unsigned number = (unsigned)pRegisters[registerIndex].RegisterIndex, digits = 2;
+		while (digits < 8 && (number >> (digits * 4)))
+			digits++;
+		for (unsigned j = 0; j < digits; j++)
+			entry.StopReplyPrefix[j] = "0123456789abcdef"[(number >> ((digits - j - 1) * 4)) & 0x0F];
+		entry.StopReplyPrefix[digits] = ':';
+		entry.StopReplyPrefixLength = (unsigned char)(digits + 1);
+		return entry;
+	}
+
+	//! Returns the size of the register block in bytes
+	constexpr size_t ComputeRegisterBlockSize(const RegisterEntry *pRegisters, size_t registerCount)
+	{
+		size_t size = 0;
+		for (size_t i = 0; i < registerCount; i++)
+			size += (pRegisters[i].SizeInBits + 7) / 8;
+		return size;
+	}
+
+	//! Declares a register list and computes the layout of its register block at compile time
+	/*! The layout allows formatting the 'g' and the stop replies without parsing any format strings or computing the register offsets:
+		\code
+		static constexpr RegisterEntry _RawRegisterList[] = {
+			{rgEAX, "eax", 32},
+			...
+		};
+
+		static constexpr StaticRegisterList<__countof(_RawRegisterList)> _RegisterLayout(_RawRegisterList);
+		static constexpr PlatformRegisterList RegisterList = _RegisterLayout.GetList();
+		\endcode
+	*/
+	template <size_t _Count> class StaticRegisterList
+	{
+	private:
+		const RegisterEntry *m_pRegisters;
+		RegisterLayoutEntry m_Layout[_Count];
+		size_t m_BlockSize;
+
+		template <size_t... _Indexes> constexpr StaticRegisterList(const RegisterEntry (&registers)[_Count], std::index_sequence<_Indexes...>)
+			: m_pRegisters(registers)
+			, m_Layout{ComputeRegisterLayout(registers, _Indexes)...}
+			, m_BlockSize(ComputeRegisterBlockSize(registers, _Count))
+		{
+		}
+
+	public:
+		constexpr StaticRegisterList(const RegisterEntry (&registers)[_Count])
+			: StaticRegisterList(registers, std::make_index_sequence<_Count>())
+		{
+		}
+
+		constexpr PlatformRegisterList GetList() const
+		{
+			return PlatformRegisterList{_Count, m_pRegisters, m_Layout, m_BlockSize};
+		}
+
+		constexpr size_t GetBlockSize() const {return m_BlockSize;}
 	};
 
 	//! Contains the value of a single register. Register values are normally passed via RegisterSetContainer objects. 
@@ -71,6 +170,116 @@ namespace GDBServerFoundation
 		}
 	};
 
+	//! References a register stored in a RegisterSetContainer. Provides the same fields as RegisterValue.
+	/*! The objects of this class are returned by RegisterSetContainer::operator[]() and should not be stored. */
+	class RegisterValueReference
+	{
+	public:
+		//! Reads or modifies the validity bit of a register
+		class ValidityFlag
+		{
+		private:
+			unsigned *m_pWord;
+			unsigned m_Mask;
+
+		public:
+			ValidityFlag(unsigned *pWord, unsigned mask)
+				: m_pWord(pWord)
+				, m_Mask(mask)
+			{
+			}
+
+			operator bool() const
+			{
+				return (*m_pWord & m_Mask) != 0;
+			}
+
+			ValidityFlag &operator=(bool valid)
+			{
+				if (valid)
+					*m_pWord |= m_Mask;
+				else
+					*m_pWord &= ~m_Mask;
+				return *this;
+			}
+		};
+
+		//! Specifies whether the value is valid
+		ValidityFlag Valid;
+		//! Specifies the size in bytes of the register. Unlike RegisterValue::SizeInBytes, it can exceed 64 bytes.
+		unsigned SizeInBytes;
+		//! Points to the register value in the target byte order
+		unsigned char *Value;
+
+	public:
+		RegisterValueReference(unsigned *pValidWord, unsigned validMask, unsigned sizeInBytes, unsigned char *pValue)
+			: Valid(pValidWord, validMask)
+			, SizeInBytes(sizeInBytes)
+			, Value(pValue)
+		{
+		}
+
+		//! Stores the value and its validity flag. Shorter values are zero-extended, longer ones are truncated.
+		RegisterValueReference &operator=(const RegisterValue &value)
+		{
+			SetValue(value.Value, value.SizeInBytes);
+			Valid = value.Valid;
+			return *this;
+		}
+
+		//! Copies the value of another register
+		RegisterValueReference &operator=(const RegisterValueReference &anotherRegister)
+		{
+			SetValue(anotherRegister.Value, anotherRegister.SizeInBytes);
+			Valid = (bool)anotherRegister.Valid;
+			return *this;
+		}
+
+		//! Stores a value of an arbitrary size and flags the register as valid. Shorter values are zero-extended, longer ones are truncated.
+		void SetValue(const void *pData, size_t size)
+		{
+			if (size > SizeInBytes)
+				size = SizeInBytes;
+			memmove(Value, pData, size);
+			memset(Value + size, 0, SizeInBytes - size);
+			Valid = true;
+		}
+
+		//! Returns a copy of the value. Only the first 64 bytes of the larger registers are copied.
+		operator RegisterValue() const
+		{
+			RegisterValue value;
+			value.Valid = Valid;
+			value.SizeInBytes = (unsigned char)(SizeInBytes < sizeof(value.Value) ? SizeInBytes : sizeof(value.Value));
+			memcpy(value.Value, Value, value.SizeInBytes);
+			return value;
+		}
+
+		//! Converts the little-endian value to a 64-bit integer
+		ULONGLONG ToUInt64() const
+		{
+			ULONGLONG result = 0;
+			memcpy(&result, Value, SizeInBytes < sizeof(result) ? SizeInBytes : sizeof(result));
+			return result;
+		}
+
+		//! Converts the little-endian value to a 32-bit integer
+		unsigned ToUInt32() const
+		{
+			unsigned result = 0;
+			memcpy(&result, Value, SizeInBytes < sizeof(result) ? SizeInBytes : sizeof(result));
+			return result;
+		}
+
+		//! Converts a little-endian value to a 16-bit integer
+		unsigned short ToUInt16() const
+		{
+			unsigned short result = 0;
+			memcpy(&result, Value, SizeInBytes < sizeof(result) ? SizeInBytes : sizeof(result));
+			return result;
+		}
+	};
+
 	//! Stores values of some or all target registers.
 	/*! This class should be used in conjunction with the target-specific register index enumeration.
 		E.g. 
@@ -80,37 +289,122 @@ namespace GDBServerFoundation
 		\code if(values[rgEAX].Valid) { ... } \endcode
 
 		Note that it's safe to use the [] operator as long as its argument is below the RegisterCount().
+
+		The values are stored in a single block laid out as described by PlatformRegisterList::Layout (i.e. as in the 'g' packet)
+		and the validity flags are stored in a separate bitmap, so the container only occupies the actual size of the register file.
+		The registers larger than 64 bytes (e.g. SVE vectors) can be accessed via RegisterValueReference::Value and
+		RegisterValueReference::SetValue().
 	*/
 	class RegisterSetContainer
 	{
+	public:
+		enum {kDefaultRegisterSize = sizeof(RegisterValue::Value)};
+
 	private:
-		std::vector<RegisterValue> m_Values;
+		enum {kBitsPerWord = sizeof(unsigned) * 8};
+
+		//! If NULL, each register occupies kDefaultRegisterSize bytes
+		const RegisterLayoutEntry *m_pLayout;
+		size_t m_RegisterCount;
+		std::vector<unsigned, ArenaAllocator<unsigned>> m_ValidBits;
+		std::vector<unsigned char, ArenaAllocator<unsigned char>> m_Values;
 
 	public:
-		//! Creates an instance of RegisterSetContainer given the number of registers
-		RegisterSetContainer(size_t registerCount)
+		//! Creates an instance of RegisterSetContainer given the number of registers. Each register can hold up to 64 bytes.
+		/*! \param pArena Specifies the arena used to store the values (see BasicGDBStub::GetSessionArena()). If it is NULL, the heap is used. */
+		RegisterSetContainer(size_t registerCount, SessionArena *pArena = NULL)
+			: m_pLayout(NULL)
+			, m_RegisterCount(registerCount)
+			, m_ValidBits((registerCount + kBitsPerWord - 1) / kBitsPerWord, 0, ArenaAllocator<unsigned>(pArena))
+			, m_Values(registerCount * kDefaultRegisterSize, 0, ArenaAllocator<unsigned char>(pArena))
 		{
-			m_Values.resize(registerCount);
 		}
 
+		//! Creates an instance of RegisterSetContainer storing the registers as described by the register list
+		/*! The register list should contain the layout (see StaticRegisterList) and should stay valid while the container exists. */
+		RegisterSetContainer(const PlatformRegisterList &registerList, SessionArena *pArena = NULL)
+			: m_pLayout(registerList.Layout)
+			, m_RegisterCount(registerList.RegisterCount)
+			, m_ValidBits((registerList.RegisterCount + kBitsPerWord - 1) / kBitsPerWord, 0, ArenaAllocator<unsigned>(pArena))
+			, m_Values(registerList.BlockSize, 0, ArenaAllocator<unsigned char>(pArena))
+		{
+			ASSERT(m_pLayout || !m_RegisterCount);
+		}
+
+		//! Creates a copy of the container stored in the heap, so that it can be kept after the arena is reset
+		RegisterSetContainer(const RegisterSetContainer &anotherContainer)
+			: m_pLayout(anotherContainer.m_pLayout)
+			, m_RegisterCount(anotherContainer.m_RegisterCount)
+			, m_ValidBits(anotherContainer.m_ValidBits.begin(), anotherContainer.m_ValidBits.end())
+			, m_Values(anotherContainer.m_Values.begin(), anotherContainer.m_Values.end())
+		{
+		}
+
+		RegisterSetContainer(RegisterSetContainer &&anotherContainer)
+			: m_pLayout(anotherContainer.m_pLayout)
+			, m_RegisterCount(anotherContainer.m_RegisterCount)
+			, m_ValidBits(std::move(anotherContainer.m_ValidBits))
+			, m_Values(std::move(anotherContainer.m_Values))
+		{
+		}
+
+		RegisterSetContainer &operator=(const RegisterSetContainer &anotherContainer) = default;
+		RegisterSetContainer &operator=(RegisterSetContainer &&anotherContainer) = default;
+
 		//! Gets or sets a register by its index
-		RegisterValue &operator[](size_t index)
+		RegisterValueReference operator[](size_t index)
 		{
-			ASSERT(index < m_Values.size());
-			return m_Values[index];
+			ASSERT(index < m_RegisterCount);
+			return RegisterValueReference(&m_ValidBits[index / kBitsPerWord], 1U << (index % kBitsPerWord), (unsigned)GetRegisterSize(index), &m_Values[GetRegisterOffset(index)]);
 		}
 
 		//! Gets a register value by its index
-		const RegisterValue &operator[](size_t index) const
+		const RegisterValueReference operator[](size_t index) const
 		{
-			ASSERT(index < m_Values.size());
-			return m_Values[index];
+			return const_cast<RegisterSetContainer *>(this)->operator[](index);
 		}
 
 		//! Returns the total amount of registers
-		size_t RegisterCount()
+		size_t RegisterCount() const
+		{
+			return m_RegisterCount;
+		}
+
+		//! Returns the offset of the register value within the block returned by GetBlock()
+		size_t GetRegisterOffset(size_t index) const
 		{
-			return m_Values.size();
+			return m_pLayout ? m_pLayout[index].Offset : index * kDefaultRegisterSize;
+		}
+
+		size_t GetRegisterSize(size_t index) const
+		{
+			return m_pLayout ? m_pLayout[index].SizeInBytes : kDefaultRegisterSize;
+		}
+
+		//! Returns the layout used by the container, or NULL if each register occupies kDefaultRegisterSize bytes
+		const RegisterLayoutEntry *GetLayout() const {return m_pLayout;}
+
+		//! Returns the values of all registers. If the container was created from a PlatformRegisterList, the block has the 'g' packet layout.
+		unsigned char *GetBlock() {return m_Values.empty() ? NULL : &m_Values[0];}
+		const unsigned char *GetBlock() const {return m_Values.empty() ? NULL : &m_Values[0];}
+		size_t GetBlockSize() const {return m_Values.size();}
+
+		//! Flags all registers as invalid. The storage is kept, so the container can be reused without allocating memory.
+		void InvalidateAll()
+		{
+			for (size_t i = 0; i < m_ValidBits.size(); i++)
+				m_ValidBits[i] = 0;
+		}
+
+		//! Returns true if all registers are flagged as valid
+		bool AllValid() const
+		{
+			for (size_t i = 0; i < m_RegisterCount / kBitsPerWord; i++)
+				if (m_ValidBits[i] != ~0U)
+					return false;
+
+			unsigned remainingBits = m_RegisterCount % kBitsPerWord;
+			return !remainingBits || (m_ValidBits.back() & ((1U << remainingBits) - 1)) == ((1U << remainingBits) - 1);
 		}
 	};
 }
\ No newline at end of file
@@ -1,40 +1,42 @@
 #include "StdAfx.h"
 #include "GDBServer.h"
+#include "GDBPacketCodec.h"
+#include "EventDrivenServer.h"
 #include "HexHelpers.h"
 
 using namespace BazisLib;
 using namespace BazisLib::Network;
-using namespace GDBServerFoundation::HexHelpers;
+using namespace GDBServerFoundation::PacketCodec;
 
-static const char kACK = '+';
-static const char kPacketStart = '$';
-static const char kPacketEnd = '#';
-static const char kEscapeChar = '}';
+const GDBServerFoundation::StubResponse GDBServerFoundation::StandardResponses::CommandNotSupported(StubResponse::FromStaticText(""));
+const GDBServerFoundation::StubResponse GDBServerFoundation::StandardResponses::InvalidArgument(StubResponse::FromStaticText("EINVALIDARG"));
+const GDBServerFoundation::StubResponse GDBServerFoundation::StandardResponses::OK(StubResponse::FromStaticText("OK"));
 
-static const char kRLEMarker = '*';
-static const char kEscapeMask = 0x20;
-static const char kRLEBase = 29;
-
-
-GDBServerFoundation::StubResponse GDBServerFoundation::StandardResponses::CommandNotSupported("");
-GDBServerFoundation::StubResponse GDBServerFoundation::StandardResponses::InvalidArgument("EINVALIDARG");
-GDBServerFoundation::StubResponse GDBServerFoundation::StandardResponses::OK("OK");
-
-#include <numeric>
-
-static unsigned computeChecksum(void *p, size_t length)
+#ifdef __linux__
+static int GetNativeSocket(TCPSocket &socket)
 {
-	unsigned char *pCh = (unsigned char *)p;
-	return std::accumulate(pCh, pCh + length, 0) & 0xFF;
+	return socket.GetSocket();
 }
+#endif
 
 void GDBServerFoundation::GDBServer::ConnectionHandler( TCPSocket &rawSocket, const InternetAddress &addr )
 {
-	enum {kBytesToReceiveAtOnce = 65536};
-
 	rawSocket.SetNoDelay(true);
-	TCPSocketEx socketExNotUsedDirectly(&rawSocket, false);
-	bool ackEnabled = true, newAckEnabled = true;
+
+#ifdef __linux__
+	int nativeSocket = GetNativeSocket(rawSocket);
+	FDTransport transport(nativeSocket, nativeSocket, false);
+#else
+	TCPSocketTransport transport(&rawSocket);
+#endif
+
+	HandleConnection(&transport);
+	rawSocket.Close();
+}
+
+void GDBServerFoundation::GDBServer::HandleConnection( IGDBTransport *pTransport )
+{
+	enum {kMinBytesToReceiveAtOnce = 65536};
 
 	IGDBStub *pStub = NULL;
 	if (m_pFactory)
@@ -42,104 +44,183 @@ void GDBServerFoundation::GDBServer::ConnectionHandler( TCPSocket &rawSocket, co
 
 	if (!pStub)
 	{
-		rawSocket.Close();
+		pTransport->Close();
 		return;
 	}
 
-	BreakInSocket breakInSocket(&socketExNotUsedDirectly);
+	size_t preferredMaxPacketSize = pTransport->GetPreferredMaxPacketSize();
+	if (preferredMaxPacketSize)
+		pStub->AdjustMaxPacketSize(preferredMaxPacketSize);
+
+	pStub->OnConnectionAccepted();
+
+	ConnectionState state;
+	state.pTransport = pTransport;
+	state.pBreakInTarget = pStub;
+
+	//If the stub reports when it blocks in the target, break-in requests are only monitored during that time and the ACKs for the fast requests
+	//are sent together with the replies
+	bool stubReportsBlocking = pStub->SetBreakInMonitor(&state);
+	bool useBreakInThread = true;
+
+#ifdef __linux__
+	PollBreakInDetector breakInDetector(pTransport, pStub, &m_BreakInStatistics, &m_StatisticsLock);
+	if (stubReportsBlocking && pTransport->GetPollHandle() != -1)
+	{
+		state.pBreakInDetector = &breakInDetector;
+		useBreakInThread = false;
+	}
+#endif
+
+	BreakInSocket breakInSocket(pTransport, useBreakInThread);
 
-	CBuffer unescapedBuffer;
+	PacketFramer framer;
+	PacketReceiveBuffer receiveBuffer;
+	bool verifyChecksumsWithoutACK = m_bVerifyChecksumsWithoutACK || !pTransport->IsReliable();
+	framer.SetVerifyChecksumsWithoutACK(verifyChecksumsWithoutACK);
+
+	//The buffers are sized so that the largest packet GDB is allowed to send can be received with a single call
+	size_t maxPacketSize = pStub->GetMaxPacketSize();
+	size_t bytesToReceiveAtOnce = maxPacketSize + kPacketFramingSize;
+	if (bytesToReceiveAtOnce < kMinBytesToReceiveAtOnce)
+		bytesToReceiveAtOnce = kMinBytesToReceiveAtOnce;
+	receiveBuffer.Reserve(bytesToReceiveAtOnce);
+	state.Encoder.Reserve(maxPacketSize);
+
+	//Once the no-ack mode is enabled, the following packets are received by the read-ahead thread. As it handles the break-in
+	//requests as well, it can only be used if no other thread reads from the transport.
+	PacketReadAheadQueue readAheadQueue(pTransport, pStub, m_ReadAheadPacketCount, bytesToReceiveAtOnce);
+	bool canReadAhead = !useBreakInThread && m_ReadAheadPacketCount;
 
 	breakInSocket.SetTarget(pStub);
 
 	for (;;)
 	{
+		if (readAheadQueue.IsStarted())
 		{
-			BreakInSocket::SocketWrapper socket(breakInSocket);
+			const PacketReadAheadQueue::QueuedPacket *pPacket = readAheadQueue.WaitForPacket();
+			if (pPacket->Type == PacketFramer::kNeedMoreData)
+				break;	//The connection has been closed
 
-			//We expect the following format: $<data>#<checksum>
-			if (!FindPacketStart(socket, ackEnabled, pStub))
+			switch (pPacket->Type)
+			{
+			case PacketFramer::kInvalidCharacter:
+				OnPacketError(String::sFormat(_T("Unexpected character: 0x%02X (%c)"), pPacket->ErrorChar & 0xFF, pPacket->ErrorChar));
+				break;
+			case PacketFramer::kInvalidChecksum:
+				OnPacketError(String::sFormat(_T("Invalid packet checksum. Expected 0x%02X, got 0x%02X"), pPacket->ExpectedChecksum, pPacket->Checksum));
+				break;
+			case PacketFramer::kPacketReceived:
+				{
+					bool ackEnabled = false;
+					HandleGDBPacketAndSendReply(pStub, pPacket->pBody, pPacket->BodyLength, state, &ackEnabled);
+				}
 				break;
+			default:
+				break;
+			}
 
-			ackEnabled = newAckEnabled;
+			readAheadQueue.ReleasePacket();
+			continue;
+		}
 
-			//Find end-of-packet symbol ('#') taking the escape symbol ('}') into account.
-			size_t available = 0;
-			char *pPacket = (char *)socket->PeekAbs(3, &available);
-			if (!pPacket || !available)
-				break;
+		PacketFramer::Event evt;
 
-			size_t searchRestartPosition = 0;
-			size_t endOfPacket = -1;
+		{
+			BreakInSocket::SocketWrapper socket(breakInSocket);
 
-			//Keep on trying until we find the end-of-packet
+			//We expect the following format: [+]$<data>#<checksum>
 			for (;;)
 			{
-				for (size_t i = searchRestartPosition; i < available; i++)
-				{
-					searchRestartPosition = i;
-					if (pPacket[i] == kEscapeChar)
-					{
-						i++;	//Simply skip the next character
-						continue;
-					}
+				evt = framer.ProcessData(receiveBuffer.GetData(), receiveBuffer.GetSize());
+				if (evt.Type != PacketFramer::kNeedMoreData)
+					break;
 
-					if (pPacket[i] == kPacketEnd)
-					{
-						endOfPacket = i;
-						break;
-					}
-				}
+				receiveBuffer.Discard(evt.ConsumedBytes);
 
-				if (endOfPacket != -1)
+				char *pFreeSpace = receiveBuffer.PrepareReceive(bytesToReceiveAtOnce);
+				if (!pFreeSpace)
 					break;
 
-				size_t newAvail = available;
-				pPacket = (char *)socket->PeekRel(kBytesToReceiveAtOnce, &newAvail);
-				if (!pPacket || newAvail == available)
+				size_t done = socket->Receive(pFreeSpace, bytesToReceiveAtOnce);
+				if (!done)
 					break;
 
-				available = newAvail;
+				receiveBuffer.CommitReceive(done);
 			}
 
-			if (endOfPacket == -1)
+			if (evt.Type == PacketFramer::kNeedMoreData)
 				break;	//The connection has been closed
 
-			size_t packetWithChecksumLength = endOfPacket + 3;
-			if (available < packetWithChecksumLength)
+			switch (evt.Type)
 			{
-				pPacket = (char *)socket->PeekAbs(packetWithChecksumLength, &available);
-				if (!pPacket || available < packetWithChecksumLength)
-					break;
+			case PacketFramer::kBreakInRequest:
+				pStub->OnBreakInRequest();
+				break;
+			case PacketFramer::kInvalidCharacter:
+				OnPacketError(String::sFormat(_T("Unexpected character: 0x%02X (%c)"), evt.ErrorChar & 0xFF, evt.ErrorChar));
+				break;
+			case PacketFramer::kInvalidChecksum:
+				OnPacketError(String::sFormat(_T("Invalid packet checksum. Expected 0x%02X, got 0x%02X"), evt.ExpectedChecksum, evt.Checksum));
+				break;
+			case PacketFramer::kPacketReceived:
+				if (evt.SendACK)
+				{
+					if (stubReportsBlocking && IsFastRequest(evt.pBody, evt.BodyLength))
+						state.ACKPending = true;
+					else
+					{
+						char ch = kACK;
+						socket->Send(&ch, 1);
+					}
+				}
+				break;
+			default:
+				break;
 			}
+		}
 
-			unsigned checksum = ParseHexValue(pPacket + endOfPacket + 1);
-			unsigned expectedChecksum = computeChecksum(pPacket, endOfPacket);
-
-			if (checksum != expectedChecksum)
+		size_t breakInBytes = 0;
+		if (evt.Type == PacketFramer::kPacketReceived)
+		{
+			//A 0x03 byte received together with the packet (e.g. "$c#63\x03") would not be seen by the break-in detector or the worker thread,
+			//as they only read from the transport. It is delivered once the stub blocks in the target (or right away if the stub does not report it).
+			breakInBytes = CountBufferedBreakInBytes(receiveBuffer.GetData() + evt.ConsumedBytes, receiveBuffer.GetSize() - evt.ConsumedBytes);
+			if (breakInBytes)
 			{
-				OnPacketError(String::sFormat(_T("Invalid packet checksum. Expected 0x%02X, got 0x%02X"), expectedChecksum, checksum));
-				continue;
+				if (stubReportsBlocking)
+					state.BreakInPending = true;
+				else
+					pStub->OnBreakInRequest();
 			}
 
-			unescapedBuffer.EnsureSize(endOfPacket);
+			HandleGDBPacketAndSendReply(pStub, evt.pBody, evt.BodyLength, state, framer.GetNewAckEnabledPointer());
 
-			size_t unescapedSize = UnescapePacket(pPacket, endOfPacket, unescapedBuffer.GetData());
-			unescapedBuffer.SetSize(unescapedSize);
-			socket->Discard(pPacket, packetWithChecksumLength);
-
-			if (ackEnabled)
+			//The stub did not block, so the request is delivered the same way as if it was received after the packet
+			if (state.BreakInPending)
 			{
-				char ch = kACK;
-				socket->Send(&ch, 1);
+				state.BreakInPending = false;
+				pStub->OnBreakInRequest();
 			}
 		}
 
-		HandleGDBPacketAndSendReply(pStub, (const char *)unescapedBuffer.GetConstData(), unescapedBuffer.GetSize(), breakInSocket, &newAckEnabled);
+		//The packet has been unescaped in place by the framer, so the stub gets the data (including binary 'X' and 'vFlashWrite' payloads)
+		//directly from the receive buffer. The packet is discarded only after it has been handled.
+		receiveBuffer.Discard(evt.ConsumedBytes + breakInBytes);
+
+		if (canReadAhead && !*framer.GetNewAckEnabledPointer())
+		{
+			//The break-in requests are now detected by the read-ahead thread
+			state.pBreakInDetector = NULL;
+			readAheadQueue.Start(receiveBuffer.GetData(), receiveBuffer.GetSize(), verifyChecksumsWithoutACK);
+			receiveBuffer.Clear();
+		}
 	}
 
 	breakInSocket.SetTarget(NULL);
-	socketExNotUsedDirectly.Close();
+	pStub->SetBreakInMonitor(NULL);
+	pTransport->Close();
+	readAheadQueue.Stop();
 	delete pStub;
 }
 
@@ -148,172 +229,205 @@ BazisLib::ActionStatus GDBServerFoundation::GDBServer::Start(unsigned port)
 	return BasicTCPServer::Start(port);
 }
 
-bool GDBServerFoundation::GDBServer::FindPacketStart(BreakInSocket::SocketWrapper &socket, bool expectingACK, IBreakInTarget *pTarget)
+BazisLib::ActionStatus GDBServerFoundation::GDBServer::StartEventDriven(unsigned port, unsigned reactorCount, unsigned workerCount)
 {
-	for (;;)
-	{
-		size_t available = 0;
-		//1. Find start of packet.
-		char *pPacket = (char *)socket->PeekAbs(1, &available);
-		if (!pPacket || !available)
-			return false;
-
-		if (pPacket[0] == BreakInSocket::kBreakInByte)
-		{
-			pTarget->OnBreakInRequest();
-			socket->Discard(pPacket, 1);
-			continue;
-		}
+	return StartEventDrivenServer(port, NULL, reactorCount, workerCount);
+}
 
-		if (expectingACK)
-		{
-			char ackChar = pPacket[0];
-			socket->Discard(pPacket, 1);
-			if (ackChar != kACK)
-			{
-				OnPacketError(String::sFormat(_T("Expected ACK ('+'), got 0x%02X (%c)"), ackChar & 0xFF, ackChar));
-				continue;
-			}
-			pPacket = (char *)socket->PeekAbs(1, &available);
-			if (!pPacket || !available)
-				return false;
-		}
+BazisLib::ActionStatus GDBServerFoundation::GDBServer::StartUnixSocket(const char *pPath, unsigned reactorCount, unsigned workerCount)
+{
+	return StartEventDrivenServer(0, pPath, reactorCount, workerCount);
+}
 
-		char firstChar = pPacket[0];
-		socket->Discard(pPacket, 1);
+BazisLib::ActionStatus GDBServerFoundation::GDBServer::StartEventDrivenServer(unsigned port, const char *pUnixSocketPath, unsigned reactorCount, unsigned workerCount)
+{
+	if (m_pEventDrivenServer)
+		return MAKE_STATUS(InvalidState);
 
-		if (firstChar != kPacketStart)
-		{
-			OnPacketError(String::sFormat(_T("Expected start of packet ('$'), got 0x%02X (%c)"), firstChar & 0xFF, firstChar));
-			continue;
-		}
+	m_pEventDrivenServer = new EventDrivenServer(this, m_pFactory, reactorCount, workerCount);
+	m_pEventDrivenServer->SetVerifyChecksumsWithoutACK(m_bVerifyChecksumsWithoutACK);
 
-		return true;
+	ActionStatus status = pUnixSocketPath ? m_pEventDrivenServer->StartUnixSocket(pUnixSocketPath) : m_pEventDrivenServer->Start(port);
+	if (!status.Successful())
+	{
+		delete m_pEventDrivenServer;
+		m_pEventDrivenServer = NULL;
 	}
+	return status;
 }
 
-size_t GDBServerFoundation::GDBServer::UnescapePacket(const void *pPacket, size_t escapedSize, void *pTarget)
+BazisLib::ActionStatus GDBServerFoundation::GDBServer::RunOnStdio()
 {
-	size_t w = 0;
-	const char *pCh = (const char *)pPacket;
-	char *pOut = (char *)pTarget;
+#ifdef __linux__
+	FDTransport transport(0, 1, false);
+	HandleConnection(&transport);
+	return MAKE_STATUS(Success);
+#else
+	return MAKE_STATUS(NotSupported);
+#endif
+}
 
-	for (size_t r = 0; r < escapedSize; r++)
-	{
-		if (pCh[r] == kEscapeChar && r != (escapedSize - 1))
-			pOut[w++] = pCh[++r] ^ kEscapeMask;
-		else
-			pOut[w++] = pCh[r];
-	}
+BazisLib::ActionStatus GDBServerFoundation::GDBServer::RunOnSerialPort(const char *pDevice, unsigned baudRate)
+{
+#ifdef __linux__
+	ActionStatus status;
+	SerialTransport transport(pDevice, baudRate, &status);
+	if (!status.Successful())
+		return status;
+
+	HandleConnection(&transport);
+	return MAKE_STATUS(Success);
+#else
+	return MAKE_STATUS(NotSupported);
+#endif
+}
+
+void GDBServerFoundation::GDBServer::WaitForTermination()
+{
+	if (m_pEventDrivenServer)
+		return m_pEventDrivenServer->WaitForTermination();
+	return BasicTCPServer::WaitForTermination();
+}
 
-	return w;
+void GDBServerFoundation::GDBServer::StopListening()
+{
+	if (m_pEventDrivenServer)
+		return m_pEventDrivenServer->StopListening();
+	return Stop(false);
 }
 
-void GDBServerFoundation::GDBServer::HandleGDBPacketAndSendReply( IGDBStub *pStub, const char *pPacketBody, size_t packetBodyLength, BreakInSocket &socket, bool *ackEnabled )
+GDBServerFoundation::GDBServer::~GDBServer()
 {
-	if (!pStub)
-		return;
+	delete m_pEventDrivenServer;
+}
+
+size_t GDBServerFoundation::GDBServer::CountBufferedBreakInBytes( const char *pData, size_t size )
+{
+	size_t count = 0;
+	while (count < size && pData[count] == BreakInSocket::kBreakInByte)
+		count++;
+	return count;
+}
 
-	static const char splitterChars[] = ";:,";
-	size_t splitter = packetBodyLength;
-	char splitterChar = 0;
-	for (size_t i = 0; i < packetBodyLength; i++)
+bool GDBServerFoundation::GDBServer::IsFastRequest( const char *pBody, size_t length )
+{
+	enum {kMaxFastMemoryReadSize = 4096};
+	if (!length)
+		return false;
+
+	switch (pBody[0])
 	{
-		if (strchr(splitterChars, pPacketBody[i]))
+	case 'g':
+	case 'G':
+	case 'p':
+	case 'P':
+	case 'H':
+	case 'T':
+	case 'z':
+	case 'Z':
+		return true;
+	case 'c':
+	case 'C':
+	case 's':
+	case 'S':
+		return true;	//The ACK is sent before the stub blocks in the target (see ConnectionState::BeginWaitingForBreakIn())
+	case 'v':
+		return length >= 5 && !memcmp(pBody, "vCont", 5);
+	case 'm':
 		{
-			splitter = i;
-			splitterChar = pPacketBody[i];
-			break;
+			//m<address>,<length>
+			size_t i = 1;
+			while (i < length && pBody[i] != ',')
+				i++;
+			if (++i >= length)
+				return false;
+
+			size_t readSize = 0;
+			for (; i < length; i++)
+			{
+				if (!HexHelpers::IsHexDigit(pBody[i]) || readSize > kMaxFastMemoryReadSize)
+					return false;
+				readSize = readSize * 16 + HexHelpers::hexToInt(pBody[i]);
+			}
+			return readSize <= kMaxFastMemoryReadSize;
 		}
+	default:
+		return false;
 	}
+}
 
-	BazisLib::TempStrPointerWrapperA cmd(pPacketBody, splitter), args(pPacketBody + splitter + 1, (splitter == packetBodyLength) ? 0 : packetBodyLength - splitter - 1);
-
-	bool isStartNoAck = (cmd == "QStartNoAckMode");
-	StubResponse response = isStartNoAck ? QStartNoAckMode(ackEnabled) : pStub->HandleRequest(cmd, splitterChar, args);
-
-	char internalBuf[4996];
-	size_t internalBufSize = 1;
-
-	internalBuf[0] = kPacketStart;
+void GDBServerFoundation::GDBServer::HandleGDBPacketAndSendReply( IGDBStub *pStub, const char *pPacketBody, size_t packetBodyLength, ConnectionState &state, bool *ackEnabled )
+{
+	if (!pStub)
+		return;
 
-	const char *pReply = response.GetData();
+	StubResponse response = DispatchPacket(pStub, pPacketBody, packetBodyLength, ackEnabled);
 
-	static const char charsToEscape[] = "#$}*";
-	unsigned char checksum = 0;
+	bool sendACK = state.ACKPending;
+	state.ACKPending = false;
 
-	for (size_t i = 0; i < response.GetSize(); i++)
+	IReplyStream *pStream = response.GetStream();
+	if (!pStream)
 	{
-		char charToSend = pReply[i];
-		size_t runLength = 1;
-
-		size_t remaining = response.GetSize() - i;
-		while(runLength < remaining)
-			if (pReply[i + runLength] == charToSend)
-				runLength++;
-			else
-				break;		
-		
-		//Maximum amount of chars appended per cycle - 3 (RLE, format "<char>*<cnt>" where <char> is escaped)
-		if (internalBufSize >= (sizeof(internalBuf) - 4))
-		{
-			socket.Send(internalBuf, internalBufSize);
-			internalBufSize = 0;
-		}
-
-		if (strchr(charsToEscape, charToSend))
-		{
-			internalBuf[internalBufSize++] = kEscapeChar;
-			internalBuf[internalBufSize++] = charToSend ^ kEscapeMask;
-			checksum += kEscapeChar + (charToSend ^ kEscapeMask);
-			runLength = 1;	//RLE-encoding escaped characters seems to be unsupported by gdb
-		}
-		else
-		{
-			internalBuf[internalBufSize++] = charToSend;
-			checksum += charToSend;
-		}
-		
-		if (runLength > 3)
-		{
-			size_t moreCharacters = runLength - 1;
+		//The pending ACK, the header, the reply and the checksum are normally sent with a single system call without copying the reply
+		state.Encoder.Encode(response.GetData(), response.GetSize(), sendACK);
+		state.SendEncodedData();
+		return;
+	}
 
-			if (moreCharacters >= (126 - kRLEBase))
-				moreCharacters = (126 - kRLEBase);
+	//Each part of a streamed reply is sent before the next one is produced, so only one part is kept in memory at a time
+	state.Encoder.EncodePart(response.GetData(), response.GetSize(), sendACK, ScatterGatherEncoder::kFirstPart);
+	bool connected = state.SendEncodedData();
 
-			char runLengthChar = kRLEBase + moreCharacters;
-			if (runLengthChar == kPacketStart || runLengthChar == kPacketEnd || runLengthChar == kEscapeChar)
-				moreCharacters = 0;
-			else
-			{
-				internalBuf[internalBufSize++] = kRLEMarker;
-				internalBuf[internalBufSize++] = runLengthChar;
+	const char *pPart;
+	size_t partSize;
+	while (connected && (pPart = pStream->ReadNextPart(&partSize)) != NULL)
+	{
+		state.Encoder.EncodePart(pPart, partSize, false, 0);
+		connected = state.SendEncodedData();
+	}
 
-				checksum += kRLEMarker + runLengthChar;
+	if (connected)
+	{
+		state.Encoder.EncodePart(NULL, 0, false, ScatterGatherEncoder::kLastPart);
+		state.SendEncodedData();
+	}
+}
 
-				i += moreCharacters;
-			}
-		}
+bool GDBServerFoundation::GDBServer::ConnectionState::SendEncodedData()
+{
+	while (Encoder.GetPendingSegmentCount())
+	{
+		size_t done = pTransport->SendSegments(Encoder.GetPendingSegments(), Encoder.GetPendingSegmentCount());
+		if (!done)
+			return false;
+		Encoder.OnDataSent(done);
 	}
+	return true;
+}
 
-	if (internalBufSize >= (sizeof(internalBuf) - 3))
+void GDBServerFoundation::GDBServer::ConnectionState::BeginWaitingForBreakIn()
+{
+	//The stub is about to block inside the target. GDB should not wait for the ACK until the target stops.
+	if (ACKPending)
 	{
-		socket.Send(internalBuf, internalBufSize);
-		internalBufSize = 0;
+		ACKPending = false;
+		char ch = kACK;
+		pTransport->Send(&ch, 1);
 	}
 
-	internalBuf[internalBufSize++] = kPacketEnd;
-	internalBuf[internalBufSize++] = hexTable[(checksum >> 4) & 0x0F];
-	internalBuf[internalBufSize++] = hexTable[checksum & 0x0F];
-	
-	socket.Send(internalBuf, internalBufSize);
-	internalBufSize = 0;
+	if (pBreakInDetector)
+		pBreakInDetector->BeginWaitingForBreakIn();
+
+	if (BreakInPending)
+	{
+		BreakInPending = false;
+		pBreakInTarget->OnBreakInRequest();
+	}
 }
 
-GDBServerFoundation::StubResponse GDBServerFoundation::GDBServer::QStartNoAckMode(bool *ackEnabled)
+void GDBServerFoundation::GDBServer::ConnectionState::EndWaitingForBreakIn()
 {
-	ASSERT(ackEnabled);
-	ASSERT(*ackEnabled);
-	*ackEnabled = false;
-	return StandardResponses::OK;
-}
+	if (pBreakInDetector)
+		pBreakInDetector->EndWaitingForBreakIn();
+}
\ No newline at end of file
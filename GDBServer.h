@@ -4,9 +4,14 @@
 #include <bzsnet/BufferedSocket.h>
 #include "IGDBStub.h"
 #include "BreakInSocket.h"
+#include "BreakInDetector.h"
+#include "GDBPacketCodec.h"
+#include "PacketReadAhead.h"
 
 namespace GDBServerFoundation
 {
+	class EventDrivenServer;
+
 	//! Implements a TCP/IP server handling the gdbserver protocol
 	/*!	The common use case for this class is to create the stub factory (implementing the IGDBStubFactory interface) and start listening for incoming connections:
 		\code
@@ -20,26 +25,69 @@ namespace GDBServerFoundation
 			return 0;
 		}		
 		\endcode
+
+		By default each connection is handled by a separate thread. If the server should handle hundreds of simultaneous connections,
+		use StartEventDriven() instead of Start() to serve all of them from a small pool of reactor threads (see EventDrivenServer).
 	*/
 	class GDBServer : private BazisLib::Network::BasicTCPServer
 	{
 	private:
 		virtual void ConnectionHandler(BazisLib::Network::TCPSocket &socket, const BazisLib::Network::InternetAddress &addr) override;
 
+		//! Contains the per-connection state used to send the replies
+		/*! If the stub reports when it blocks inside the target (see IGDBStub::SetBreakInMonitor()), the '+' acknowledging a fast request
+			(see IsFastRequest()) is not sent immediately. Instead it is sent together with the reply, or right before the stub blocks inside
+			the target (so that GDB does not time out waiting for it). The notifications are then forwarded to the actual break-in detector.
+		*/
+		class ConnectionState : public IBreakInMonitor
+		{
+		public:
+			IGDBTransport *pTransport;
+			IBreakInMonitor *pBreakInDetector;
+			IBreakInTarget *pBreakInTarget;
+			bool ACKPending;
+			//! Set when a break-in request was received together with the packet being handled. It is delivered once the stub blocks in the target.
+			bool BreakInPending;
+			PacketCodec::ScatterGatherEncoder Encoder;
+
+		public:
+			ConnectionState()
+				: pTransport(NULL)
+				, pBreakInDetector(NULL)
+				, pBreakInTarget(NULL)
+				, ACKPending(false)
+				, BreakInPending(false)
+			{
+			}
+
+			virtual void BeginWaitingForBreakIn() override;
+			virtual void EndWaitingForBreakIn() override;
+
+			//! Sends the data produced by the last Encoder call. Returns false if the connection was closed.
+			bool SendEncodedData();
+		};
+
 	private:
 		IGDBStubFactory *m_pFactory;
 		bool m_bOwnFactory;
 
-	private:
-		//! Reads the socket until the start-of-packet symbol ('$') is encountered. Returns false if the connection has been dropped.
-		bool FindPacketStart(BreakInSocket::SocketWrapper &socket, bool expectingACK, IBreakInTarget *pTarget);
+		EventDrivenServer *m_pEventDrivenServer;
+		bool m_bVerifyChecksumsWithoutACK;
+		unsigned m_ReadAheadPacketCount;
 
-		void HandleGDBPacketAndSendReply(IGDBStub *pStub, const char *pPacketBody, size_t packetBodyLength, BreakInSocket &socket, bool *ackEnabled);
+		BazisLib::Mutex m_StatisticsLock;
+		BreakInStatistics m_BreakInStatistics;
 
-		static size_t UnescapePacket(const void *pPacket, size_t escapedSize, void *pTarget);
+	private:
+		void HandleGDBPacketAndSendReply(IGDBStub *pStub, const char *pPacketBody, size_t packetBodyLength, ConnectionState &state, bool *ackEnabled);
+		//! Returns the amount of break-in bytes (0x03) at the start of the data received after a packet
+		static size_t CountBufferedBreakInBytes(const char *pData, size_t size);
+		//! Returns true if the request is normally handled without waiting for the target (or resumes it), so its ACK can be sent with the reply
+		/*! The ACKs for the other requests (e.g. 'vFlashErase', 'qRcmd' or large 'm' reads) are sent before they are handled. Otherwise GDB
+			could time out waiting for the ACK and resend a request that is still being handled. */
+		static bool IsFastRequest(const char *pBody, size_t length);
 
-		//! Disables the +/- packet acknowledgment.
-		StubResponse QStartNoAckMode(bool *ackEnabled);
+		BazisLib::ActionStatus StartEventDrivenServer(unsigned port, const char *pUnixSocketPath, unsigned reactorCount, unsigned workerCount);
 
 	public:
 		//! Creates a new instance of the GDB Server
@@ -50,22 +98,86 @@ namespace GDBServerFoundation
 		GDBServer(IGDBStubFactory *pFactory, bool own = true)
 			: m_pFactory(pFactory)
 			, m_bOwnFactory(own)
+			, m_pEventDrivenServer(NULL)
+			, m_bVerifyChecksumsWithoutACK(true)
+			, m_ReadAheadPacketCount(kDefaultReadAheadPacketCount)
 		{
 		}
 
+		~GDBServer();
+
+		enum {kDefaultReadAheadPacketCount = 8};
+
 		//! Starts listening for incoming connections
 		BazisLib::ActionStatus Start(unsigned port);
 
+		//! Starts listening for incoming connections in the event-driven mode
+		/*!
+			\param reactorCount Specifies the amount of threads performing socket I/O and packet framing for all connections.
+			\param workerCount Specifies the amount of threads calling IGDBStub::HandleRequest(). This limits the amount of requests that can be handled simultaneously.
+			\remarks This mode is only supported on Linux. See EventDrivenServer for details.
+		*/
+		BazisLib::ActionStatus StartEventDriven(unsigned port, unsigned reactorCount = 1, unsigned workerCount = 4);
+
+		//! Starts listening for incoming connections on a Unix domain socket in the event-driven mode
+		/*! Unix sockets avoid the loopback TCP stack and the port allocation when GDB runs on the same machine. Any stale socket file at pPath is replaced.
+			\remarks This mode is only supported on Linux. See StartEventDriven() for the meaning of the other arguments.
+		*/
+		BazisLib::ActionStatus StartUnixSocket(const char *pPath, unsigned reactorCount = 1, unsigned workerCount = 4);
+
+		//! Handles a single GDB session over the given transport on the calling thread. Returns once the connection is closed.
+		/*! This method allows running the same packet handling (including the break-in detection) over the transports other than TCP,
+			e.g. pipes or serial ports. The transport is closed before the method returns.
+		*/
+		void HandleConnection(IGDBTransport *pTransport);
+
+		//! Handles a single GDB session over stdin/stdout on the calling thread
+		/*! This allows starting the server directly from GDB:
+			\code
+			(gdb) target remote | my-server --stdio
+			\endcode
+			\remarks Nothing else should be written to stdout while the session is active. This mode is only supported on Linux.
+		*/
+		BazisLib::ActionStatus RunOnStdio();
+
+		//! Handles a single GDB session over a serial port (or a pseudo-terminal) on the calling thread
+		/*! The port is configured for the raw 8N1 mode. The packet size reported to GDB is adjusted to the baud rate (see SerialTransport).
+			\code
+			(gdb) set serial baud 115200
+			(gdb) target remote /dev/ttyUSB0
+			\endcode
+			\remarks This mode is only supported on Linux.
+		*/
+		BazisLib::ActionStatus RunOnSerialPort(const char *pDevice, unsigned baudRate);
+
 		//! Waits till the server is stopped by calling StopListening() and the last connection is closed.
-		void WaitForTermination()
-		{
-			return BasicTCPServer::WaitForTermination();
-		}
+		void WaitForTermination();
 
 		//! Stops listening for new incoming connections. The existing connections are not affected.
-		void StopListening()
+		void StopListening();
+
+		//! Specifies whether the packet checksums are verified after GDB enables the no-ack mode ('QStartNoAckMode')
+		/*! Skipping the verification saves a comparison per packet, but is only safe on the transports guaranteeing the data integrity (e.g. TCP).
+			GDB enables the no-ack mode regardless of the transport, so the checksums are always verified on the transports that report
+			themselves as unreliable (see IGDBTransport::IsReliable()), e.g. SerialTransport.
+			\remarks This setting only affects the connections accepted after the call.
+		*/
+		void SetVerifyChecksumsWithoutACK(bool verify) {m_bVerifyChecksumsWithoutACK = verify;}
+
+		//! Specifies how many packets can be received and decoded ahead of the one being handled once GDB enables the no-ack mode
+		/*! See PacketReadAheadQueue for details. Pass 0 to disable reading ahead.
+			\remarks Reading ahead is only used by the threaded server (see Start() and HandleConnection()) when the stub reports
+					 blocking calls via IGDBStub::SetBreakInMonitor() and the transport supports poll() (i.e. on Linux).
+					 This setting only affects the connections accepted after the call.
+		*/
+		void SetReadAheadPacketCount(unsigned count) {m_ReadAheadPacketCount = count;}
+
+		//! Returns the latency statistics for the break-in requests handled by all connections so far
+		/*! \remarks The statistics are only collected on Linux, where the break-in requests are detected by PollBreakInDetector. */
+		BreakInStatistics GetBreakInStatistics()
 		{
-			return Stop(false);
+			BazisLib::MutexLocker lck(m_StatisticsLock);
+			return m_BreakInStatistics;
 		}
 
 	protected:
@@ -1,311 +1,254 @@
 #include "stdafx.h"
 #include "GDBStub.h"
+#include "GDBStubT.h"
 #include "HexHelpers.h"
 
 using namespace GDBServerFoundation;
 
+#if _MSC_VER
+#define snprintf _snprintf
+#endif
+
 StubResponse GDBStub::Handle_QueryStopReason()
 {
 	if (!m_pTarget)
 		return StandardResponses::CommandNotSupported;
-	
-	TargetStopRecord rec;
-	memset(&rec, 0, sizeof(rec));
-	if (m_pTarget->GetLastStopRecord(&rec) != kGDBSuccess)
-		return StandardResponses::CommandNotSupported;
 
-	BazisLib::DynamicStringA strRegisters;
-	if (rec.Reason != kProcessExited)
-	{
-		RegisterSetContainer registers = InitializeRegisterSetContainer();
-		GDBStatus status = m_pTarget->ReadFrameRelatedRegisters(rec.ThreadID, registers);
-		if (status == kGDBSuccess)
-		{
-			for(size_t i = 0; i < registers.RegisterCount(); i++)
-			{
-				const RegisterValue &val = registers[i];
-				if (val.Valid)
-				{
-					strRegisters.AppendFormat("%02x:", m_pRegisters->Registers[i].RegisterIndex);
-					AppendRegisterValueToString(val, (m_pRegisters->Registers[i].SizeInBits + 7) / 8, strRegisters, ";");
-				}
-			}
-		}
-	}
+	return DoHandle_QueryStopReason(*m_pTarget);
+}
 
-	return StopRecordToStopReply(rec, strRegisters.c_str());
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_g(int threadID)
+{
+	return DoHandle_g(*m_pTarget, threadID);
 }
 
+GDBServerFoundation::RegisterSetContainer GDBServerFoundation::GDBStub::InitializeRegisterSetContainer()
+{
+	return RegisterSetContainer(*m_pRegisters, GetSessionArena());
+}
 
-GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_g(int threadID)
+GDBServerFoundation::GDBStub::CachedRegisterSet &GDBServerFoundation::GDBStub::GetCachedRegisters(int threadID)
 {
-	RegisterSetContainer registers = InitializeRegisterSetContainer();
+	for (size_t i = 0; i < m_CachedThreadCount; i++)
+		if (m_RegisterCache[i].ThreadID == threadID)
+			return m_RegisterCache[i];
 
-	StubResponse response;
-	GDBStatus status = m_pTarget->ReadTargetRegisters(threadID, registers);
-	if (status != kGDBSuccess)
-		response.Append(BazisLib::DynamicStringA::sFormat("E%02x", status & 0xFF).c_str());
+	if (m_CachedThreadCount < m_RegisterCache.size())
+		m_RegisterCache[m_CachedThreadCount].Reset(threadID);
 	else
-	{
-		BazisLib::DynamicStringA str;
-		for(size_t i = 0; i < registers.RegisterCount(); i++)
-			AppendRegisterValueToString(registers[i], (m_pRegisters->Registers[i].SizeInBits + 7) / 8, str);
-
-		response.Append(str.c_str());
-	}
-	return response;
+		m_RegisterCache.push_back(CachedRegisterSet(threadID, *m_pRegisters));
+	return m_RegisterCache[m_CachedThreadCount++];
 }
 
-GDBServerFoundation::RegisterSetContainer GDBServerFoundation::GDBStub::InitializeRegisterSetContainer()
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::FormatRegisterValue(const RegisterValueReference &value)
 {
-	RegisterSetContainer registers(m_pRegisters->RegisterCount);
-	for (size_t i = 0; i < m_pRegisters->RegisterCount; i++)
-		registers[i].SizeInBytes = (m_pRegisters->Registers[i].SizeInBits + 7) / 8;
-	return registers;
+	StubResponse response(GetSessionArena());
+	char *pText = response.AllocateAppend(value.SizeInBytes * 2);
+	if (!pText)
+		return "ENOMEM";
+
+	if (value.Valid)
+		HexHelpers::HexEncode(value.Value, value.SizeInBytes, pText);
+	else
+		memset(pText, 'x', value.SizeInBytes * 2);
+	return response;
 }
 
-GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_G( int threadID, const BazisLib::TempStringA &registerValueBlock )
+void GDBServerFoundation::GDBStub::CacheFrameRelatedRegisters(int threadID, RegisterSetContainer &registers, bool allRegistersRead)
 {
-	RegisterSetContainer registers = InitializeRegisterSetContainer();
-
-	size_t offset = 0;
+	CachedRegisterSet &cached = GetCachedRegisters(threadID);
+	if (allRegistersRead)
+		cached.Complete = true;
 	for (size_t i = 0; i < registers.RegisterCount(); i++)
 	{
-		size_t avail = registerValueBlock.size() - offset;
-		if (avail < 2U * registers[i].SizeInBytes)
-			break;
-
-		for (size_t j = 0; j < registers[i].SizeInBytes; j++)
-		{
-			registers[i].Value[j] = HexHelpers::ParseHexValue(registerValueBlock[offset], registerValueBlock[offset + 1]);
-			offset += 2;
-		}
-
-		registers[i].Valid = true;
+		if (!registers[i].Valid)
+			continue;
+		if (cached.Dirty[i])
+			registers[i] = cached.Registers[i];
+		else
+			cached.Registers[i] = registers[i];
 	}
-
-	GDBStatus status = m_pTarget->WriteTargetRegisters(threadID, registers);
-	return FormatGDBStatus(status);
 }
 
-GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_P( int threadID, const BazisLib::TempStringA &registerIndex, const BazisLib::TempStringA &registerValue )
+bool GDBServerFoundation::GDBStub::ExpeditedRegistersValid(const RegisterSetContainer &registers)
 {
-	unsigned registerNumber = 0;
-	for (size_t i = 0; i < registerIndex.size(); i++)
-		registerNumber = (registerNumber << 4) | HexHelpers::hexToInt(registerIndex[i]);
-
-	if (registerNumber >= m_pRegisters->RegisterCount)
-		return "EINVAL";
-
-	RegisterSetContainer registers = InitializeRegisterSetContainer();
+	for (size_t i = 0; i < m_ExpeditedRegisters.size(); i++)
+		if (!registers[m_ExpeditedRegisters[i]].Valid)
+			return false;
+	return true;
+}
 
-	if (registerValue.size() < 2U * registers[registerNumber].SizeInBytes)
-		return "EINVAL";
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_G( int threadID, const BazisLib::TempStringA &registerValueBlock )
+{
+	return DoHandle_G(*m_pTarget, threadID, registerValueBlock);
+}
 
-	for (size_t j = 0; j < registers[registerNumber].SizeInBytes; j++)
-		registers[registerNumber].Value[j] = HexHelpers::ParseHexValue(registerValue[j * 2], registerValue[j * 2 + 1]);
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_P( int threadID, unsigned registerNumber, const BazisLib::TempStringA &registerValue )
+{
+	return DoHandle_P(*m_pTarget, threadID, registerNumber, registerValue);
+}
 
-	registers[registerNumber].Valid = true;
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_p( int threadID, unsigned registerIndex )
+{
+	return DoHandle_p(*m_pTarget, threadID, registerIndex);
+}
 
-	GDBStatus status = m_pTarget->WriteTargetRegisters(threadID, registers);
-	return FormatGDBStatus(status);
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_m( ULONGLONG ullAddr, size_t uLength )
+{
+	return DoHandle_m(*m_pTarget, ullAddr, uLength);
 }
 
-GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_m( const BazisLib::TempStringA &addr, const BazisLib::TempStringA &length )
+const char *GDBServerFoundation::GDBStub::MemoryReadStream::ReadNextPart(size_t *pSize)
 {
-	ULONGLONG ullAddr = HexHelpers::ParseHexString<ULONGLONG>(addr);
-	size_t uLength = HexHelpers::ParseHexString<unsigned>(length);
-	size_t done = uLength;
+	if (!m_Remaining)
+		return NULL;
 
-	void *pBuf = malloc(uLength);
-	if (!pBuf)
-		return "ENOMEM";
+	size_t todo = m_Remaining, done;
+	if (todo > kMemoryReadChunkSize)
+		todo = kMemoryReadChunkSize;
 
-	StubResponse response;
-	GDBStatus status = m_pTarget->ReadTargetMemory(ullAddr, pBuf, &done);
-	if (status != kGDBSuccess)
-		response.Append(BazisLib::DynamicStringA::sFormat("E%02x", status & 0xFF).c_str());
-	else
-	{
-		ASSERT(done <= uLength);
-		if (done > uLength)
-			done = uLength;
+	//The first kMemoryReadChunkSize bytes of the buffer receive the data and the rest receives the hex-encoded text
+	if (m_Buffer.empty())
+		m_Buffer.resize(kMemoryReadChunkSize * 3);
 
-		char *pNewText = response.AllocateAppend(done * 2);
-		for (size_t i = 0, j = 0; i < done; i++)
-		{
-			unsigned char val = ((unsigned char *)pBuf)[i];
-			pNewText[j++] = HexHelpers::hexTable[(val >> 4) & 0x0F];
-			pNewText[j++] = HexHelpers::hexTable[val & 0x0F];
-		}
+	done = todo;
+	if (m_pCache->Read(*m_pTarget, m_Address, &m_Buffer[0], &done) != kGDBSuccess || !done)
+	{
+		m_Remaining = 0;
+		return NULL;
 	}
-	free(pBuf);
-	return response;
-}
-
-GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_M( const BazisLib::TempStringA &addr, const BazisLib::TempStringA &length, const BazisLib::TempStringA &data )
-{
-	ULONGLONG ullAddr = HexHelpers::ParseHexString<ULONGLONG>(addr);
-	size_t uLength = HexHelpers::ParseHexString<unsigned>(length);
 
-	if (data.length() != uLength * 2)
-		return "EINVAL";
-
-	void *pBuf = malloc(uLength);
-	if (!pBuf)
-		return "ENOMEM";
+	if (done > todo)
+		done = todo;
 
-	for (size_t i = 0; i < uLength; i++)
-		((char *)pBuf)[i] = HexHelpers::ParseHexValue(data[i*2], data[i*2+1]);
+	//A partial read ends the reply
+	m_Remaining = (done == todo) ? m_Remaining - done : 0;
+	m_Address += done;
 
-	GDBStatus status = m_pTarget->WriteTargetMemory(ullAddr, pBuf, uLength);
-	free(pBuf);
-	return FormatGDBStatus(status);
+	HexHelpers::HexEncode(&m_Buffer[0], done, &m_Buffer[kMemoryReadChunkSize]);
+	*pSize = done * 2;
+	return &m_Buffer[kMemoryReadChunkSize];
 }
 
-GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_X( const BazisLib::TempStringA &addr, const BazisLib::TempStringA &length, const BazisLib::TempStringA &binaryData )
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_M( ULONGLONG ullAddr, size_t uLength, const BazisLib::TempStringA &data )
 {
-	if (length.size() == 1 && length[0] == '0')
-		return "OK";	//GDB is probing whether the command is supported
-
-	ULONGLONG ullAddr = HexHelpers::ParseHexString<ULONGLONG>(addr);
-	size_t uLength = HexHelpers::ParseHexString<unsigned>(length);
-
-	if (binaryData.length() != uLength)
-		return "EINVAL";
+	return DoHandle_M(*m_pTarget, ullAddr, uLength, data);
+}
 
-	GDBStatus status = m_pTarget->WriteTargetMemory(ullAddr, binaryData.GetConstBuffer(), uLength);
-	return FormatGDBStatus(status);
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_X( ULONGLONG ullAddr, size_t uLength, const BazisLib::TempStringA &binaryData )
+{
+	return DoHandle_X(*m_pTarget, ullAddr, uLength, binaryData);
 }
 
-GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_qXfer( const BazisLib::TempStringA &object, const BazisLib::TempStringA &verb, const BazisLib::TempStringA &annex, const BazisLib::TempStringA &strOffset, const BazisLib::TempStringA &strLength )
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_qXfer( const BazisLib::TempStringA &object, const BazisLib::TempStringA &verb, const BazisLib::TempStringA &annex, size_t offset, size_t length )
 {
 	if (verb != "read")
 		return StandardResponses::CommandNotSupported;
 
-	BazisLib::DynamicStringA str = BuildGDBReportByName(object, annex);
-	if (str.size() == 0)
-		return StandardResponses::CommandNotSupported;
+	StubResponse report;
+	if (m_StartupSnapshot.Valid && object == "libraries" && m_StartupSnapshot.LibraryReport.GetSize())
+		report = CopySnapshotReply(m_StartupSnapshot.LibraryReport);
+	else
+		report = BuildGDBReportByName(object, annex);
 
-	size_t offset = HexHelpers::ParseHexString<unsigned>(strOffset);
-	size_t length = HexHelpers::ParseHexString<unsigned>(strLength);
+	if (report.GetSize() == 0)
+		return StandardResponses::CommandNotSupported;
 
 	bool moreData = false;
 
-	if (offset > str.length())
-		offset = str.length();
+	if (offset > report.GetSize())
+		offset = report.GetSize();
 
-	if (length >= (str.length() - offset))
-		length = str.length() - offset;
+	if (length >= (report.GetSize() - offset))
+		length = report.GetSize() - offset;
 	else
 		moreData = true;
 
-	StubResponse response;
+	StubResponse response(GetSessionArena());
 	response.Append(moreData ? "m" : "l");
-	response.Append(str.GetConstBuffer() + offset, length);
+	response.Append(report.GetData() + offset, length);
 	return response;
 }
 
-GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::HandleRequest( const BazisLib::TempStringA &requestType, char splitterChar, const BazisLib::TempStringA &requestData )
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Dispatch_qXfer( const GDBRequest &request )
 {
-	if (requestType.length() < 1)
-		return BasicGDBStub::HandleRequest(requestType, splitterChar, requestData);
-	switch(requestType[0])
-	{
-	case 'q':
-		if (requestType == "qXfer")
-		{
-			int idxVerb = requestData.find(':');
-			if (idxVerb == -1)
-				break;
-			int idxAnnex = requestData.find(':', idxVerb + 1);
-			if (idxAnnex == -1)
-				break;
-			int idxOffset = requestData.find(':', idxAnnex + 1);
-			if (idxOffset == -1)
-				break;
-			int idxLength = requestData.find(',', idxOffset + 1);
-			if (idxLength == -1)
-				break;
-			return Handle_qXfer(requestData.substr(0, idxVerb), 
-				requestData.substr(idxVerb + 1, idxAnnex - idxVerb - 1),
-				requestData.substr(idxAnnex + 1, idxOffset - idxAnnex - 1),
-				requestData.substr(idxOffset + 1, idxLength- idxOffset - 1),
-				requestData.substr(idxLength + 1));
-		}
-		break;
-	}
-	return BasicGDBStub::HandleRequest(requestType, splitterChar, requestData);
+	return Handle_qXfer(request.GetString(0), request.GetString(1), request.GetString(2), (size_t)request.Address, request.Length);
 }
 
-static BazisLib::DynamicStringA HTMLEncode(const char *pStr)
+static void AppendHTMLEncoded(StubResponse &result, const char *pStr)
 {
-	BazisLib::DynamicStringA result;
-
 	for (size_t i = 0; pStr[i]; i++)
 	{
 		char ch = pStr[i];
 		switch(ch)
 		{
 		case '<':
-			result.append("&lt;");
+			result.Append("&lt;");
 			break;
 		case '>':
-			result.append("&gt;");
+			result.Append("&gt;");
 			break;
 		case '&':
-			result.append("&amp;");
+			result.Append("&amp;");
 			break;
 		case '\"':
-			result.append("&quot;");
+			result.Append("&quot;");
 			break;
 		default:
-			result.append(1, ch);
+			result.Append(&ch, 1);
 		}
 	}
-
-	return result;
 }
 
-BazisLib::DynamicStringA GDBServerFoundation::GDBStub::BuildGDBReportByName( const BazisLib::TempStringA &name, const BazisLib::TempStringA &annex )
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::BuildGDBReportByName( const BazisLib::TempStringA &name, const BazisLib::TempStringA &annex )
 {
+	char szLine[256];
+	StubResponse result(GetSessionArena());
+
 	if (name == "libraries")
 	{
 		std::vector<DynamicLibraryRecord> libraries;
-		BazisLib::DynamicStringA result = "<library-list>\n";
 		GDBStatus status = m_pTarget->GetDynamicLibraryList(libraries);
 		if (status == kGDBNotSupported)
 			return "";
+		result.Append("<library-list>\n");
 		if (status == kGDBSuccess)
 		{
 			for (size_t i = 0; i < libraries.size(); i++)
-				result.AppendFormat("\t<library name=\"%s\"><segment address=\"0x%I64x\"/></library>\n", libraries[i].FullPath.c_str(), libraries[i].LoadAddress);
+			{
+				result.Append("\t<library name=\"");
+				result.Append(libraries[i].FullPath.c_str());
+				snprintf(szLine, sizeof(szLine), "\"><segment address=\"0x%llx\"/></library>\n", (unsigned long long)libraries[i].LoadAddress);
+				result.Append(szLine);
+			}
 		}
 
-		result += "</library-list>\n";
+		result.Append("</library-list>\n");
 		return result;
 	}
 	else if (name == "threads")
 	{
-		BazisLib::DynamicStringA result = "<?xml version=\"1.0\"?>\n<threads>\n";
 		ProvideThreadInfo();
 		if (!m_bThreadsSupported)
 			return "";
+		result.Append("<?xml version=\"1.0\"?>\n<threads>\n");
 		for (size_t i = 0; i < m_CachedThreadInfo.size(); i++)
 		{
-			result.AppendFormat("\t<thread id=\"%x\">", m_CachedThreadInfo[i].ThreadID);
-			result.append(HTMLEncode(m_CachedThreadInfo[i].UserFriendlyName.c_str()).c_str());
-			result.append("</thread>\n");
+			snprintf(szLine, sizeof(szLine), "\t<thread id=\"%x\">", m_CachedThreadInfo[i].ThreadID);
+			result.Append(szLine);
+			AppendHTMLEncoded(result, m_CachedThreadInfo[i].UserFriendlyName.c_str());
+			result.Append("</thread>\n");
 		}
-		result.AppendFormat("</threads>\n");
+		result.Append("</threads>\n");
 		return result;
 	}
 	else if (name == "memory-map")
 	{
 		static const char *MemoryTypes[3] = {"ram", "rom", "flash"};
 
-		BazisLib::DynamicStringA result = "<?xml version=\"1.0\"?>\n<!DOCTYPE memory-map PUBLIC \"+//IDN gnu.org//DTD GDB Memory Map V1.0//EN\" \"http://sourceware.org/gdb/gdb-memory-map.dtd\">\n";
-		result += "<memory-map>\n";
+		result.Append("<?xml version=\"1.0\"?>\n<!DOCTYPE memory-map PUBLIC \"+//IDN gnu.org//DTD GDB Memory Map V1.0//EN\" \"http://sourceware.org/gdb/gdb-memory-map.dtd\">\n");
+		result.Append("<memory-map>\n");
+		ProvideEmbeddedMemoryRegions();
 		for (size_t i = 0; i < m_EmbeddedMemoryRegions.size(); i++)
 		{
 			const EmbeddedMemoryRegion &region = m_EmbeddedMemoryRegions[i];
@@ -318,14 +261,19 @@ BazisLib::DynamicStringA GDBServerFoundation::GDBStub::BuildGDBReportByName( con
 				if (!blockSize)
 					blockSize = (unsigned)region.Length;
 
-				result.AppendFormat("\t<memory type=\"%s\" start=\"0x%I64x\" length = \"0x%I64x\">\n", MemoryTypes[region.Type], region.Start, region.Length);
-				result.AppendFormat("\t\t<property name=\"blocksize\">0x%x</property>\n", blockSize);
-				result.AppendFormat("\t</memory>\n");
+				snprintf(szLine, sizeof(szLine), "\t<memory type=\"%s\" start=\"0x%llx\" length = \"0x%llx\">\n", MemoryTypes[region.Type], (unsigned long long)region.Start, (unsigned long long)region.Length);
+				result.Append(szLine);
+				snprintf(szLine, sizeof(szLine), "\t\t<property name=\"blocksize\">0x%x</property>\n", blockSize);
+				result.Append(szLine);
+				result.Append("\t</memory>\n");
 			}
 			else
-				result.AppendFormat("\t<memory type=\"%s\" start=\"0x%I64x\" length = \"0x%I64x\"/>\n", MemoryTypes[region.Type], region.Start, region.Length);
+			{
+				snprintf(szLine, sizeof(szLine), "\t<memory type=\"%s\" start=\"0x%llx\" length = \"0x%llx\"/>\n", MemoryTypes[region.Type], (unsigned long long)region.Start, (unsigned long long)region.Length);
+				result.Append(szLine);
+			}
 		}
-		result += "</memory-map>\n";
+		result.Append("</memory-map>\n");
 		return result;
 	}
 	return "";
@@ -333,28 +281,14 @@ BazisLib::DynamicStringA GDBServerFoundation::GDBStub::BuildGDBReportByName( con
 
 GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_c( int threadID )
 {
-	ResetAllCachesWhenResumingTarget();
-	GDBStatus status = m_pTarget->ResumeAndWait(threadID);
-	if (status != kGDBSuccess)
-		return FormatGDBStatus(status);
-
-	return Handle_QueryStopReason();
+	return DoHandle_c(*m_pTarget, threadID);
 }
 
 GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_s( int threadID )
 {
-	ResetAllCachesWhenResumingTarget();
-	GDBStatus status = m_pTarget->Step(threadID);
-	if (status != kGDBSuccess)
-		return FormatGDBStatus(status);
-
-	return Handle_QueryStopReason();
+	return DoHandle_s(*m_pTarget, threadID);
 }
 
-#if _MSC_VER
-#define snprintf _snprintf
-#endif
-
 GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_qfThreadInfo()
 {
 	ProvideThreadInfo();
@@ -384,10 +318,9 @@ GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_qsThreadI
 	return "l";
 }
 
-GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_qThreadExtraInfo( const BazisLib::TempStringA &strThreadID )
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_qThreadExtraInfo( int threadID )
 {
 	ProvideThreadInfo();
-	int threadID = HexHelpers::ParseHexString<unsigned>(strThreadID);
 	for (size_t i = 0; i < m_CachedThreadInfo.size(); i++)
 	{
 		if (m_CachedThreadInfo[i].ThreadID == threadID)
@@ -396,12 +329,8 @@ GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_qThreadEx
 			const std::string &desc = m_CachedThreadInfo[i].UserFriendlyName;
 
 			char *pNewText = response.AllocateAppend(desc.length() * 2);
-			for (size_t i = 0, j = 0; i < desc.length(); i++)
-			{
-				unsigned char val = desc[i];
-				pNewText[j++] = HexHelpers::hexTable[(val >> 4) & 0x0F];
-				pNewText[j++] = HexHelpers::hexTable[val & 0x0F];
-			}
+			if (pNewText)
+				HexHelpers::HexEncode(desc.c_str(), desc.length(), pNewText);
 			return response;
 		}
 	}
@@ -409,20 +338,22 @@ GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_qThreadEx
 	return "";
 }
 
-GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_T( const BazisLib::TempStringA &strThreadID )
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_T( int threadID )
 {
 	ProvideThreadInfo();
-	int threadID = HexHelpers::ParseHexString<unsigned>(strThreadID);
 
 	for (size_t i = 0; i < m_CachedThreadInfo.size(); i++)
 		if (m_CachedThreadInfo[i].ThreadID == threadID)
-			return "OK";
+			return StandardResponses::OK;
 
 	return "ENOSUCHTHREAD";
 }
 
 GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_qC()
 {
+	if (m_StartupSnapshot.Valid)
+		return m_StartupSnapshot.CurrentThread;
+
 	TargetStopRecord rec;
 	memset(&rec, 0, sizeof(rec));
 	GDBStatus status = m_pTarget->GetLastStopRecord(&rec);
@@ -438,27 +369,183 @@ GDBServerFoundation::GDBStub::GDBStub( ISyncGDBTarget *pTarget, bool own /*= tru
 {
 	m_pTarget = pTarget;
 	m_bOwnStub = own;
+	m_MaxMemoryReadSize = kDefaultMaxMemoryReadSize;
+	m_bRegisterCacheEnabled = false;
+	m_CachedThreadCount = 0;
 	m_bThreadCacheValid = false;
 	m_bThreadsSupported = true;
 
 	m_pRegisters = pTarget->GetRegisterList();
+	if (!m_pRegisters->Layout)
+	{
+		//The register list was not declared via StaticRegisterList
+		m_ComputedRegisterLayout.resize(m_pRegisters->RegisterCount);
+		for (size_t i = 0; i < m_pRegisters->RegisterCount; i++)
+			m_ComputedRegisterLayout[i] = ComputeRegisterLayout(m_pRegisters->Registers, i);
+
+		m_RegisterListWithLayout = *m_pRegisters;
+		m_RegisterListWithLayout.Layout = m_ComputedRegisterLayout.empty() ? NULL : &m_ComputedRegisterLayout[0];
+		m_RegisterListWithLayout.BlockSize = ComputeRegisterBlockSize(m_pRegisters->Registers, m_pRegisters->RegisterCount);
+		m_pRegisters = &m_RegisterListWithLayout;
+	}
 
-	std::vector<DynamicLibraryRecord> libraries;
-	if (m_pTarget->GetDynamicLibraryList(libraries) != kGDBNotSupported)
-		RegisterStubFeature("qXfer:libraries:read");
+	for (size_t i = 0; i < m_pRegisters->RegisterCount; i++)
+		if (m_pRegisters->Registers[i].Flags & rfExpedited)
+			m_ExpeditedRegisters.push_back((unsigned)i);
 
-	if (m_pTarget->GetThreadList(m_CachedThreadInfo) != kGDBNotSupported)
-		RegisterStubFeature("qXfer:threads:read");
+	//The supported qXfer objects are only determined once GDB connects (see ProvideCapabilities())
+	m_bMemoryRegionsValid = false;
+	m_bCacheReadOnlyRegions = true;
+	m_TargetCapabilities = 0;
+	m_bStartupSnapshotPending = false;
 
-	IFLASHProgrammer *pProg = m_pTarget->GetFLASHProgrammer();
-	if (pProg && pProg->GetEmbeddedMemoryRegions(m_EmbeddedMemoryRegions) == kGDBSuccess && !m_EmbeddedMemoryRegions.empty())
-		RegisterStubFeature("qXfer:memory-map:read");
+	//qXfer:object:verb:annex:offset,length
+	RegisterPacketHandler("qXfer", ":S:S:S:A,L", &GDBStub::Dispatch_qXfer);
 }
 
 void GDBServerFoundation::GDBStub::ResetAllCachesWhenResumingTarget()
 {
 	BasicGDBStub::ResetAllCachesWhenResumingTarget();
 	m_bThreadCacheValid = false;
+	InvalidateStartupSnapshot();
+	m_MemoryCache.Invalidate();
+	m_StackPrefetcher.OnTargetResumed();
+	ClearRegisterCache();
+}
+
+void GDBServerFoundation::GDBStub::OnConnectionAccepted()
+{
+	if (m_bStartupSnapshotPending)
+	{
+		m_bStartupSnapshotPending = false;
+		BuildStartupSnapshot();
+	}
+}
+
+void GDBServerFoundation::GDBStub::BuildSnapshotStopReply()
+{
+	ASSERT(!m_StartupSnapshot.Valid);
+	StubResponse stopReply = DoHandle_QueryStopReason(*m_pTarget);
+	m_StartupSnapshot.StopReply = StubResponse(stopReply.GetData(), stopReply.GetSize());
+}
+
+void GDBServerFoundation::GDBStub::BuildStartupSnapshot()
+{
+	InvalidateStartupSnapshot();
+	ProvideCapabilities();
+
+	TargetStopRecord rec;
+	memset(&rec, 0, sizeof(rec));
+	if (m_pTarget->GetLastStopRecord(&rec) != kGDBSuccess)
+		return;
+
+	//The snapshot is kept across requests, so the replies are copied from the session arena to the heap
+	BuildSnapshotStopReply();
+	m_StartupSnapshot.StoppedByBreakpoint = (rec.Reason == kSignalReceived && rec.StoppedByBreakpoint);
+
+	m_StartupSnapshot.ThreadID = rec.ThreadID;
+	m_StartupSnapshot.Registers = StubResponse();
+	if (rec.Reason != kProcessExited)
+	{
+		StubResponse registers = DoHandle_g(*m_pTarget, rec.ThreadID);
+		if (registers.GetSize() && registers.GetData()[0] != 'E')
+			m_StartupSnapshot.Registers = StubResponse(registers.GetData(), registers.GetSize());
+	}
+
+	char szCurrentThread[64];
+	snprintf(szCurrentThread, sizeof(szCurrentThread), "QC%x", rec.ThreadID);
+	m_StartupSnapshot.CurrentThread = szCurrentThread;
+
+	//The thread list is kept in the thread cache until the target is resumed
+	ProvideThreadInfo();
+
+	m_StartupSnapshot.LibraryReport = StubResponse();
+	if (m_TargetCapabilities & tcDynamicLibraryList)
+	{
+		StubResponse report = BuildGDBReportByName("libraries", "");
+		m_StartupSnapshot.LibraryReport = StubResponse(report.GetData(), report.GetSize());
+	}
+
+	m_StartupSnapshot.Valid = true;
+}
+
+void GDBServerFoundation::GDBStub::ProvideEmbeddedMemoryRegions()
+{
+	if (m_bMemoryRegionsValid)
+		return;
+	m_bMemoryRegionsValid = true;
+
+	IFLASHProgrammer *pProg = m_pTarget->GetFLASHProgrammer();
+	if (!pProg || pProg->GetEmbeddedMemoryRegions(m_EmbeddedMemoryRegions) != kGDBSuccess)
+		m_EmbeddedMemoryRegions.clear();
+
+	if (m_bCacheReadOnlyRegions)
+	{
+		m_MemoryCache.ClearPersistentRegions();
+		for (size_t i = 0; i < m_EmbeddedMemoryRegions.size(); i++)
+		{
+			const EmbeddedMemoryRegion &region = m_EmbeddedMemoryRegions[i];
+			if (region.Type == mtROM || region.Type == mtFLASH)
+				m_MemoryCache.AddPersistentRegion(region.Start, region.Length);
+		}
+	}
+}
+
+void GDBServerFoundation::GDBStub::ProvideCapabilities()
+{
+	if (m_TargetCapabilities & tcCapabilitiesKnown)
+		return;
+
+	m_TargetCapabilities = m_pTarget->GetCapabilities();
+	if (!(m_TargetCapabilities & tcCapabilitiesKnown))
+	{
+		//The target does not report its capabilities, so the optional methods are called to check whether they are implemented
+		m_TargetCapabilities = tcCapabilitiesKnown;
+
+		std::vector<DynamicLibraryRecord> libraries;
+		if (m_pTarget->GetDynamicLibraryList(libraries) != kGDBNotSupported)
+			m_TargetCapabilities |= tcDynamicLibraryList;
+
+		//The thread list stays in the cache until the target is resumed
+		ProvideThreadInfo();
+		if (m_bThreadsSupported)
+			m_TargetCapabilities |= tcThreadList;
+
+		ProvideEmbeddedMemoryRegions();
+		if (!m_EmbeddedMemoryRegions.empty())
+			m_TargetCapabilities |= tcMemoryMap;
+	}
+	else if (m_TargetCapabilities & tcMemoryMap)
+		ProvideEmbeddedMemoryRegions();	//The ROM and FLASH regions should be cached starting from the first memory read
+
+	if (m_TargetCapabilities & tcDynamicLibraryList)
+		RegisterStubFeature("qXfer:libraries:read");
+	if (m_TargetCapabilities & tcThreadList)
+		RegisterStubFeature("qXfer:threads:read");
+	if (m_TargetCapabilities & tcMemoryMap)
+		RegisterStubFeature("qXfer:memory-map:read");
+	if (m_TargetCapabilities & tcBreakpointStopReasons)
+	{
+		RegisterStubFeature("swbreak");
+		RegisterStubFeature("hwbreak");
+	}
+}
+
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_qSupported( const BazisLib::TempStringA &requestData )
+{
+	//The servers that do not call OnConnectionAccepted() still get the snapshot before the other startup requests
+	OnConnectionAccepted();
+	ProvideCapabilities();
+	StubResponse response = BasicGDBStub::Handle_qSupported(requestData);
+
+	//The snapshot was built before the 'swbreak' and 'hwbreak' stop reasons were negotiated
+	if (m_StartupSnapshot.Valid && m_StartupSnapshot.StoppedByBreakpoint)
+	{
+		InvalidateStartupSnapshot();
+		BuildSnapshotStopReply();
+		m_StartupSnapshot.Valid = true;
+	}
+	return response;
 }
 
 void GDBServerFoundation::GDBStub::ProvideThreadInfo()
@@ -491,8 +578,6 @@ static DebugThreadMode modeFromAction(char action)
 
 GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_vCont( const BazisLib::TempStringA &arguments )
 {
-	ResetAllCachesWhenResumingTarget();
-
 	bool needRestore;
 	INT_PTR cookie;
 
@@ -504,7 +589,8 @@ GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_vCont( co
 	}
 
 	ProvideThreadInfo();
-	std::map<unsigned, DebugThreadMode> threadMap;
+	typedef std::map<unsigned, DebugThreadMode, std::less<unsigned>, ArenaAllocator<std::pair<const unsigned, DebugThreadMode>>> ThreadModeMap;
+	ThreadModeMap threadMap(std::less<unsigned>(), GetSessionArena());
 	for (size_t i = 0; i < m_CachedThreadInfo.size(); i++)
 		threadMap[m_CachedThreadInfo[i].ThreadID] = dtmProbe;	//We use this value as a default one for 'no action'
 	DebugThreadMode defaultMode = dtmProbe;
@@ -540,10 +626,19 @@ GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_vCont( co
 		start = end + 1;
 	}
 
-	std::list<std::pair<unsigned, INT_PTR>> restoreQueue;
+	//The registers are only written when the target is actually resumed (not for 'vCont?' or malformed requests).
+	//They are written before the thread modes are set, as setting a mode may change them (e.g. the trace flag for single-stepping).
+	GDBStatus flushStatus = FlushRegisterCache(*m_pTarget);
+	if (flushStatus != kGDBSuccess)
+		return FormatGDBStatus(flushStatus);
+
+	ResetAllCachesWhenResumingTarget();
+
+	typedef std::list<std::pair<unsigned, INT_PTR>, ArenaAllocator<std::pair<unsigned, INT_PTR>>> RestoreQueue;
+	RestoreQueue restoreQueue(GetSessionArena());
 	GDBStatus status = kGDBSuccess;
 
-	for (std::map<unsigned, DebugThreadMode>::iterator it = threadMap.begin(); it != threadMap.end(); it++)
+	for (ThreadModeMap::iterator it = threadMap.begin(); it != threadMap.end(); it++)
 	{
 		DebugThreadMode mode = it->second;
 		if (mode == dtmProbe)
@@ -565,9 +660,12 @@ GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_vCont( co
 	}
 
 	if (status == kGDBSuccess)
+	{
+		BreakInMonitorScope breakInScope(m_pBreakInMonitor);
 		status = m_pTarget->ResumeAndWait(0);
+	}
 
-	for(std::list<std::pair<unsigned, INT_PTR>>::iterator it = restoreQueue.begin(); it != restoreQueue.end(); it++)
+	for(RestoreQueue::iterator it = restoreQueue.begin(); it != restoreQueue.end(); it++)
 	{
 		needRestore = true;
 		m_pTarget->SetThreadModeForNextCont(it->first, dtmRestore, &needRestore, &it->second);
@@ -581,10 +679,12 @@ GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_vCont( co
 
 GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_k()
 {
+	InvalidateStartupSnapshot();
+	ClearRegisterCache();
 	return FormatGDBStatus(m_pTarget->Terminate());
 }
 
-GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_Zz( bool setBreakpoint, char type, const BazisLib::TempStringA &addr, const BazisLib::TempStringA &kind, const BazisLib::TempStringA &conditions )
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_Zz( bool setBreakpoint, char type, ULONGLONG ullAddr, unsigned uKind, const BazisLib::TempStringA &conditions )
 {
 	BreakpointType bpType;
 	switch(type)
@@ -611,9 +711,6 @@ GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_Zz( bool
 	if (!conditions.empty())
 		return "ENOTSUPPORTED";
 
-	ULONGLONG ullAddr = HexHelpers::ParseHexString<ULONGLONG>(addr);
-	unsigned uKind = HexHelpers::ParseHexString<unsigned>(kind);
-
 	GDBStatus status;
 	INT_PTR cookie = 0;
 
@@ -640,10 +737,9 @@ GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_Zz( bool
 
 #include "CRC32.h"
 
-GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_qCRC( const BazisLib::TempStringA &addr, const BazisLib::TempStringA &length )
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_qCRC( ULONGLONG ullAddr, size_t length )
 {
-	ULONGLONG ullAddr = HexHelpers::ParseHexString<ULONGLONG>(addr);
-	unsigned uLength = HexHelpers::ParseHexString<unsigned>(length);
+	unsigned uLength = (unsigned)length;
 
 	BazisLib::BasicBuffer buf;
 	if (!buf.EnsureSize(65536))
@@ -681,18 +777,21 @@ GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_qCRC( con
 GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_qRcmd( const BazisLib::TempStringA &command )
 {
 	std::string str, reply;
-	str.reserve(command.length() / 2);
 
 	if (command.length() % 2)
 		return "EINVAL";
 
-	for (size_t i = 0; i < command.length(); i+=2)
-	{
-		unsigned char byte = HexHelpers::ParseHexValue(command[i], command[i + 1]);
-		str.append(1, byte);
-	}
+	str.resize(command.length() / 2);
+	if (!str.empty())
+		HexHelpers::HexDecode(command.GetConstBuffer(), str.length(), &str[0]);
+
+	//Monitor commands can access the registers and modify the target memory, including FLASH
+	GDBStatus status = FlushRegisterCache(*m_pTarget);
+	if (status != kGDBSuccess)
+		return FormatGDBStatus(status);
 
-	GDBStatus status = m_pTarget->ExecuteRemoteCommand(str, reply);
+	m_MemoryCache.InvalidateAll();
+	status = m_pTarget->ExecuteRemoteCommand(str, reply);
 	if (status != kGDBSuccess)
 		return FormatGDBStatus(status);
 
@@ -701,32 +800,33 @@ GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_qRcmd( co
 
 	StubResponse response;
 	char *pNewText = response.AllocateAppend(reply.length() * 2);
-	for (size_t i = 0, j = 0; i < reply.length(); i++)
-	{
-		unsigned char val = reply[i];
-		pNewText[j++] = HexHelpers::hexTable[(val >> 4) & 0x0F];
-		pNewText[j++] = HexHelpers::hexTable[val & 0x0F];
-	}
+	if (pNewText)
+		HexHelpers::HexEncode(reply.c_str(), reply.length(), pNewText);
 	return response;
 }
 
-GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_vFlashErase( const BazisLib::TempStringA &addr, const BazisLib::TempStringA &length )
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_vFlashErase( ULONGLONG addr, size_t length )
 {
 	IFLASHProgrammer *pProg = m_pTarget->GetFLASHProgrammer();
 	if (!pProg)
 		return StandardResponses::CommandNotSupported;
-	GDBStatus status = pProg->EraseFLASH(HexHelpers::ParseHexString<ULONGLONG>(addr), HexHelpers::ParseHexString<unsigned>(length));
+	InvalidateStartupSnapshot();
+	GDBStatus status = pProg->EraseFLASH(addr, length);
+	m_MemoryCache.InvalidateRange(addr, length);
 	return FormatGDBStatus(status);
 }
 
-GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_vFlashWrite( const BazisLib::TempStringA &addr, const BazisLib::TempStringA &binaryData )
+GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_vFlashWrite( ULONGLONG addr, const BazisLib::TempStringA &binaryData )
 {
 	IFLASHProgrammer *pProg = m_pTarget->GetFLASHProgrammer();
 	if (!pProg)
 		return StandardResponses::CommandNotSupported;
+	InvalidateStartupSnapshot();
 	if (!binaryData.length())
 		return "OK";
-	GDBStatus status = pProg->WriteFLASH(HexHelpers::ParseHexString<ULONGLONG>(addr), binaryData.GetConstBuffer(), binaryData.size());
+	//The FLASH contents only change once the write is committed, so the cached pages are discarded instead of being updated
+	GDBStatus status = pProg->WriteFLASH(addr, binaryData.GetConstBuffer(), binaryData.size());
+	m_MemoryCache.InvalidateRange(addr, binaryData.size());
 	return FormatGDBStatus(status);
 }
 
@@ -735,6 +835,9 @@ GDBServerFoundation::StubResponse GDBServerFoundation::GDBStub::Handle_vFlashDon
 	IFLASHProgrammer *pProg = m_pTarget->GetFLASHProgrammer();
 	if (!pProg)
 		return StandardResponses::CommandNotSupported;
+	InvalidateStartupSnapshot();
 	GDBStatus status = pProg->CommitFLASHWrite();
+	//The pages read between the 'vFlashWrite' and 'vFlashDone' requests contain the data that has not been programmed yet
+	m_MemoryCache.InvalidateAll();
 	return FormatGDBStatus(status);
 }
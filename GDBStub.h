@@ -1,7 +1,10 @@
 #pragma once
 #include "BasicGDBStub.h"
 #include "IGDBTarget.h"
+#include "TargetMemoryCache.h"
+#include "StackPrefetcher.h"
 #include <vector>
+#include <deque>
 #include <map>
 
 namespace GDBServerFoundation
@@ -9,11 +12,56 @@ namespace GDBServerFoundation
 	//! Implements supported gdbserver packets by invoking methods of a provided IGDBTarget object
 	class GDBStub : public BasicGDBStub
 	{
+	public:
+		enum
+		{
+			//! Longer 'm' replies are read from the target and sent in parts of this size
+			kMemoryReadChunkSize = 16384,
+			kDefaultMaxMemoryReadSize = 1024 * 1024,
+		};
+
+	private:
+		//! Reads the rest of a long 'm' reply from the target while the beginning of it is being sent
+		/*! The memory used to handle an 'm' request does not depend on the requested size. If the target fails to read a chunk,
+			the reply ends before it (GDB treats shorter replies as partial reads).
+		*/
+		class MemoryReadStream : public IReplyStream
+		{
+		private:
+			ISyncGDBTarget *m_pTarget;
+			TargetMemoryCache *m_pCache;
+			ULONGLONG m_Address;
+			size_t m_Remaining;
+			std::vector<char> m_Buffer;
+
+		public:
+			MemoryReadStream()
+				: m_pTarget(NULL)
+				, m_pCache(NULL)
+				, m_Address(0)
+				, m_Remaining(0)
+			{
+			}
+
+			void Start(ISyncGDBTarget *pTarget, TargetMemoryCache *pCache, ULONGLONG addr, size_t length)
+			{
+				m_pTarget = pTarget;
+				m_pCache = pCache;
+				m_Address = addr;
+				m_Remaining = length;
+			}
+
+			virtual const char *ReadNextPart(size_t *pSize);
+		};
+
 	private:
 		ISyncGDBTarget *m_pTarget;
 		bool m_bOwnStub;
 
 		const PlatformRegisterList *m_pRegisters;
+		//! Used instead of the target's register list if it does not contain the precomputed layout
+		PlatformRegisterList m_RegisterListWithLayout;
+		std::vector<RegisterLayoutEntry> m_ComputedRegisterLayout;
 
 		std::vector<ThreadRecord> m_CachedThreadInfo;
 		bool m_bThreadCacheValid, m_bThreadsSupported;
@@ -21,6 +69,82 @@ namespace GDBServerFoundation
 		std::map<std::pair<ULONGLONG, BreakpointType>, INT_PTR> m_BreakpointMap;
 
 		std::vector<EmbeddedMemoryRegion> m_EmbeddedMemoryRegions;
+		bool m_bMemoryRegionsValid, m_bCacheReadOnlyRegions;
+
+		//! Contains the TargetCapability flags. Set to 0 until the first 'qSupported' request.
+		unsigned m_TargetCapabilities;
+
+		//! Contains the replies to the requests sent by GDB right after connecting (see EnableStartupSnapshot())
+		struct StartupSnapshot
+		{
+			bool Valid;
+			int ThreadID;
+			StubResponse StopReply;
+			//! The stop reply reports a breakpoint, so it depends on the 'swbreak' and 'hwbreak' features negotiated via 'qSupported'
+			bool StoppedByBreakpoint;
+			StubResponse Registers;
+			StubResponse CurrentThread;
+			StubResponse LibraryReport;
+
+			StartupSnapshot()
+				: Valid(false)
+				, ThreadID(0)
+				, StoppedByBreakpoint(false)
+			{
+			}
+		};
+
+		bool m_bStartupSnapshotPending;
+		StartupSnapshot m_StartupSnapshot;
+
+		MemoryReadStream m_MemoryReadStream;
+		size_t m_MaxMemoryReadSize;
+
+		TargetMemoryCache m_MemoryCache;
+		StackPrefetcher m_StackPrefetcher;
+
+		//! Contains the registers of a stopped thread (see EnableRegisterCache())
+		struct CachedRegisterSet
+		{
+			int ThreadID;
+			RegisterSetContainer Registers;
+			//! Flags the registers set via 'P' or 'G' that have not been written to the target yet
+			std::vector<bool> Dirty;
+			bool AnyDirty;
+			//! Set once all registers have been read via ReadTargetRegisters()
+			bool Complete;
+
+			CachedRegisterSet(int threadID, const PlatformRegisterList &registerList)
+				: ThreadID(threadID)
+				, Registers(registerList)
+				, Dirty(registerList.RegisterCount, false)
+				, AnyDirty(false)
+				, Complete(false)
+			{
+			}
+
+			//! Prepares the set for storing the registers of another thread without reallocating it
+			void Reset(int threadID)
+			{
+				ThreadID = threadID;
+				Registers.InvalidateAll();
+				Dirty.assign(Dirty.size(), false);
+				AnyDirty = false;
+				Complete = false;
+			}
+		};
+
+		bool m_bRegisterCacheEnabled;
+		//! The first m_CachedThreadCount entries are used. The rest are kept after the target is resumed, so that the cache does not allocate memory on each stop.
+		/*! A deque is used, so that adding a thread does not move the sets referenced by the callers of GetCachedRegisters(). */
+		std::deque<CachedRegisterSet> m_RegisterCache;
+		size_t m_CachedThreadCount;
+
+		//! The indexes of the registers marked with rfExpedited. If empty, the stop replies contain all frame-related registers.
+		std::vector<unsigned> m_ExpeditedRegisters;
+
+	private:
+		StubResponse Dispatch_qXfer(const GDBRequest &request);
 
 	public:
 		GDBStub(ISyncGDBTarget *pTarget, bool own = true);
@@ -31,48 +155,189 @@ namespace GDBServerFoundation
 				delete m_pTarget;
 		}
 
+		//! Limits the amount of bytes returned by a single 'm' request. Longer requests are truncated (GDB treats them as partial reads).
+		void SetMaxMemoryReadSize(size_t maxSize)
+		{
+			m_MaxMemoryReadSize = maxSize;
+		}
+
+		//! Returns the cache used for the 'm' requests. The cache is disabled by default (see TargetMemoryCache).
+		/*! \remarks The cache should be configured before the target is debugged:
+			\code
+				pStub->GetMemoryCache().AddUncachedRegion(0x40000000, 0x20000000);	//Peripheral registers
+				pStub->GetMemoryCache().Enable();
+			\endcode
+		*/
+		TargetMemoryCache &GetMemoryCache()
+		{
+			return m_MemoryCache;
+		}
+
+		//! Enables caching the registers of the stopped threads
+		/*! If enabled, the registers read via IStoppedGDBTarget::ReadFrameRelatedRegisters() and IStoppedGDBTarget::ReadTargetRegisters() are kept
+			until the target is resumed, so the 'g' and 'p' requests are handled without calling the target again. The values set via 'P' and 'G'
+			are stored in the cache and written to the target with one IStoppedGDBTarget::WriteTargetRegisters() call per thread before
+			the target is resumed.
+			\remarks As the register writes are deferred, the errors returned by WriteTargetRegisters() are reported in reply to the request
+					 resuming the target ('c', 's' or 'vCont') instead of 'P' or 'G'. The target is not resumed in that case.
+					 The method should be called before the connection is accepted.
+		*/
+		void EnableRegisterCache(bool enable = true)
+		{
+			m_bRegisterCacheEnabled = enable;
+		}
+
+		//! Returns the object reading the stack into the memory cache when the target stops. No windows are configured by default.
+		StackPrefetcher &GetStackPrefetcher()
+		{
+			return m_StackPrefetcher;
+		}
+
+		//! Enables or disables caching the ROM and FLASH regions reported by IFLASHProgrammer::GetEmbeddedMemoryRegions() across resumes
+		/*! The caching is enabled by default and does not depend on TargetMemoryCache::Enable(). The cached ROM and FLASH contents are
+			only discarded by the 'vFlashErase', 'vFlashWrite' and 'vFlashDone' requests or when GDB writes them explicitly.
+			\remarks The caching should be disabled for targets that modify their FLASH memory while running (e.g. EEPROM emulation).
+					 The method should be called before the connection is accepted.
+		*/
+		void EnableReadOnlyMemoryCache(bool enable = true)
+		{
+			m_bCacheReadOnlyRegions = enable;
+		}
+
+		//! Enables precomputing the replies to the requests GDB sends when it connects
+		/*! If enabled, the stub queries the target once when the connection is accepted (see OnConnectionAccepted()), or when 'qSupported'
+			is received if the server does not report it. The '?', 'g' (for the stopped thread), 'qC', 'qfThreadInfo' and 'qXfer' (threads
+			and libraries) requests are then answered from the results until the target is resumed or modified.
+			\remarks This reduces the attach latency if the target calls are slow. The method should be called before the connection is accepted
+					 (e.g. right after creating the stub).
+		*/
+		void EnableStartupSnapshot(bool enable = true)
+		{
+			m_bStartupSnapshotPending = enable;
+		}
+
+		virtual void OnConnectionAccepted();
+
+		//! The calls resuming the target ('c', 's' and 'vCont') notify the monitor, so the server only watches for break-in requests during them
+		/*! \remarks The subclasses that override the handlers with other blocking calls should wrap them into BreakInMonitorScope as well. */
+		virtual bool SetBreakInMonitor(IBreakInMonitor *pMonitor) override
+		{
+			BasicGDBStub::SetBreakInMonitor(pMonitor);
+			return true;
+		}
+
 		virtual void OnBreakInRequest()
 		{
 			if (m_pTarget)
 				m_pTarget->SendBreakInRequestAsync();
 		}
 
+		virtual StubResponse Handle_qSupported(const BazisLib::TempStringA &requestData);
 		virtual StubResponse Handle_QueryStopReason();
 		virtual StubResponse Handle_g(int threadID);
 		virtual StubResponse Handle_G(int threadID, const BazisLib::TempStringA &registerValueBlock);
-		virtual StubResponse Handle_P(int threadID, const BazisLib::TempStringA &registerIndex, const BazisLib::TempStringA &registerValue);
-		virtual StubResponse Handle_m(const BazisLib::TempStringA &addr, const BazisLib::TempStringA &length);
-		virtual StubResponse Handle_M(const BazisLib::TempStringA &addr, const BazisLib::TempStringA &length, const BazisLib::TempStringA &data);
-		virtual StubResponse Handle_X(const BazisLib::TempStringA &addr, const BazisLib::TempStringA &length, const BazisLib::TempStringA &binaryData);
+		virtual StubResponse Handle_P(int threadID, unsigned registerIndex, const BazisLib::TempStringA &registerValue);
+		virtual StubResponse Handle_p(int threadID, unsigned registerIndex);
+		virtual StubResponse Handle_m(ULONGLONG addr, size_t length);
+		virtual StubResponse Handle_M(ULONGLONG addr, size_t length, const BazisLib::TempStringA &data);
+		virtual StubResponse Handle_X(ULONGLONG addr, size_t length, const BazisLib::TempStringA &binaryData);
 
-		virtual StubResponse Handle_qXfer(const BazisLib::TempStringA &object, const BazisLib::TempStringA &verb, const BazisLib::TempStringA &annex, const BazisLib::TempStringA &offset, const BazisLib::TempStringA &length);
+		virtual StubResponse Handle_qXfer(const BazisLib::TempStringA &object, const BazisLib::TempStringA &verb, const BazisLib::TempStringA &annex, size_t offset, size_t length);
 
-		virtual StubResponse HandleRequest(const BazisLib::TempStringA &requestType, char splitterChar, const BazisLib::TempStringA &requestData);
 		virtual StubResponse Handle_c(int threadID);
 		virtual StubResponse Handle_s(int threadID);
 		virtual StubResponse Handle_qfThreadInfo();
 		virtual StubResponse Handle_qsThreadInfo();
-		virtual StubResponse Handle_qThreadExtraInfo(const BazisLib::TempStringA &strThreadID);
-		virtual StubResponse Handle_T(const BazisLib::TempStringA &strThreadID);
+		virtual StubResponse Handle_qThreadExtraInfo(int threadID);
+		virtual StubResponse Handle_T(int threadID);
 		virtual StubResponse Handle_qC();
 		virtual StubResponse Handle_vCont(const BazisLib::TempStringA &arguments);
 		virtual StubResponse Handle_k();
-		virtual StubResponse Handle_Zz(bool setBreakpoint, char type, const BazisLib::TempStringA &addr, const BazisLib::TempStringA &kind, const BazisLib::TempStringA &conditions);
-		virtual StubResponse Handle_qCRC(const BazisLib::TempStringA &addr, const BazisLib::TempStringA &length);
+		virtual StubResponse Handle_Zz(bool setBreakpoint, char type, ULONGLONG addr, unsigned kind, const BazisLib::TempStringA &conditions);
+		virtual StubResponse Handle_qCRC(ULONGLONG addr, size_t length);
 		virtual StubResponse Handle_qRcmd(const BazisLib::TempStringA &command);
 
-		virtual StubResponse Handle_vFlashErase(const BazisLib::TempStringA &addr, const BazisLib::TempStringA &length);
-		virtual StubResponse Handle_vFlashWrite(const BazisLib::TempStringA &addr, const BazisLib::TempStringA &binaryData);
+		virtual StubResponse Handle_vFlashErase(ULONGLONG addr, size_t length);
+		virtual StubResponse Handle_vFlashWrite(ULONGLONG addr, const BazisLib::TempStringA &binaryData);
 		virtual StubResponse Handle_vFlashDone();
 
 	protected:
-		virtual BazisLib::DynamicStringA BuildGDBReportByName(const BazisLib::TempStringA &name, const BazisLib::TempStringA &annex);
+		//! Builds the XML report requested via 'qXfer'. Returns an empty response if the report is not supported.
+		/*! The report is only used while handling the current request, so it can be allocated from the session arena (see GetSessionArena()). */
+		virtual StubResponse BuildGDBReportByName(const BazisLib::TempStringA &name, const BazisLib::TempStringA &annex);
+
+	protected:
+		//! Protocol code shared by GDBStub and GDBStubT
+		/*! The methods below implement the packets that are sent most frequently while stepping and inspecting the target.
+			The _Target parameter is either ISyncGDBTarget (calls via the virtual table) or StaticTargetCalls (calls that can be inlined).
+			The definitions are located in GDBStubT.h.
+		*/
+		template <class _Target> StubResponse DoHandle_QueryStopReason(_Target &target);
+		template <class _Target> StubResponse DoHandle_g(_Target &target, int threadID);
+		template <class _Target> StubResponse DoHandle_G(_Target &target, int threadID, const BazisLib::TempStringA &registerValueBlock);
+		template <class _Target> StubResponse DoHandle_P(_Target &target, int threadID, unsigned registerIndex, const BazisLib::TempStringA &registerValue);
+		template <class _Target> StubResponse DoHandle_p(_Target &target, int threadID, unsigned registerIndex);
+		template <class _Target> StubResponse DoHandle_m(_Target &target, ULONGLONG addr, size_t length);
+		template <class _Target> StubResponse DoHandle_M(_Target &target, ULONGLONG addr, size_t length, const BazisLib::TempStringA &data);
+		template <class _Target> StubResponse DoHandle_X(_Target &target, ULONGLONG addr, size_t length, const BazisLib::TempStringA &binaryData);
+		template <class _Target> StubResponse DoHandle_c(_Target &target, int threadID);
+		template <class _Target> StubResponse DoHandle_s(_Target &target, int threadID);
+
+		//! Returns the cached registers of a thread, reading all of them from the target if needed. Returns NULL if the target fails to read them.
+		template <class _Target> CachedRegisterSet *ProvideCachedRegisters(_Target &target, int threadID, GDBStatus *pStatus);
+		//! Writes the registers modified via 'P' and 'G' to the target and discards the register cache. Should be called before resuming the target.
+		/*! If some sets cannot be written, they stay dirty and the cache is kept, so that the target should not be resumed. */
+		template <class _Target> GDBStatus FlushRegisterCache(_Target &target);
 
 	protected:
 		RegisterSetContainer InitializeRegisterSetContainer();
 		void ResetAllCachesWhenResumingTarget();
 
+		CachedRegisterSet &GetCachedRegisters(int threadID);
+		//! Discards the cached registers of all threads, keeping the allocated sets for reuse
+		void ClearRegisterCache()
+		{
+			m_CachedThreadCount = 0;
+		}
+		//! Formats the reply to the 'p' request
+		StubResponse FormatRegisterValue(const RegisterValueReference &value);
+		//! Stores the registers reported in the stop reply in the cache and replaces the values modified via 'P' or 'G' with the cached ones
+		/*! \param allRegistersRead Specifies that the registers were read via ReadTargetRegisters(), so the cached set is complete */
+		void CacheFrameRelatedRegisters(int threadID, RegisterSetContainer &registers, bool allRegistersRead = false);
+		//! Returns true if all registers marked with rfExpedited are valid
+		bool ExpeditedRegistersValid(const RegisterSetContainer &registers);
+
+		//! Queries the target and stores the replies to the first requests sent by GDB (see EnableStartupSnapshot())
+		void BuildStartupSnapshot();
+		//! Stores the reply to '?' in the startup snapshot. The snapshot should not be valid while the reply is built.
+		void BuildSnapshotStopReply();
+		//! Should be called when the target state is modified, so that the outdated startup replies are no longer used
+		void InvalidateStartupSnapshot()
+		{
+			m_StartupSnapshot.Valid = false;
+		}
+
+		//! Copies a reply stored in the startup snapshot to the session arena, so that serving it does not allocate heap memory
+		StubResponse CopySnapshotReply(const StubResponse &reply)
+		{
+			StubResponse response(GetSessionArena());
+			response.Append(reply.GetData(), reply.GetSize());
+			return response;
+		}
+
+		//! Copies the written data to the memory cache, or discards the cached pages if the write has failed
+		void UpdateMemoryCacheAfterWrite(GDBStatus status, ULONGLONG addr, const void *pData, size_t size)
+		{
+			if (status == kGDBSuccess)
+				m_MemoryCache.UpdateRange(addr, pData, size);
+			else
+				m_MemoryCache.InvalidateRange(addr, size);
+		}
+
 	protected:
 		void ProvideThreadInfo();
+		void ProvideEmbeddedMemoryRegions();
+		//! Determines the optional features of the target and registers the corresponding stub features
+		void ProvideCapabilities();
 	};
 }
\ No newline at end of file
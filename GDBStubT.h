@@ -0,0 +1,395 @@
+#pragma once
+#include "GDBStub.h"
+#include "HexHelpers.h"
+
+namespace GDBServerFoundation
+{
+	//! Calls the methods of a target class directly instead of using the virtual table
+	/*! This class is used by GDBStubT to let the compiler inline the target methods into the shared protocol code (see GDBStub::DoHandle_m()).
+		The calls are qualified with the class name, so any overrides in the classes derived from _Target are ignored.
+	*/
+	template <class _Target> class StaticTargetCalls
+	{
+	private:
+		_Target *m_pTarget;
+
+	public:
+		StaticTargetCalls(_Target *pTarget)
+			: m_pTarget(pTarget)
+		{
+		}
+
+		GDBStatus GetLastStopRecord(TargetStopRecord *pRec) {return m_pTarget->_Target::GetLastStopRecord(pRec);}
+		GDBStatus ReadFrameRelatedRegisters(int threadID, RegisterSetContainer &registers) {return m_pTarget->_Target::ReadFrameRelatedRegisters(threadID, registers);}
+		GDBStatus ReadTargetRegisters(int threadID, RegisterSetContainer &registers) {return m_pTarget->_Target::ReadTargetRegisters(threadID, registers);}
+		GDBStatus WriteTargetRegisters(int threadID, const RegisterSetContainer &registers) {return m_pTarget->_Target::WriteTargetRegisters(threadID, registers);}
+		GDBStatus ReadTargetMemory(ULONGLONG Address, void *pBuffer, size_t *pSizeInBytes) {return m_pTarget->_Target::ReadTargetMemory(Address, pBuffer, pSizeInBytes);}
+		GDBStatus WriteTargetMemory(ULONGLONG Address, const void *pBuffer, size_t sizeInBytes) {return m_pTarget->_Target::WriteTargetMemory(Address, pBuffer, sizeInBytes);}
+		GDBStatus ResumeAndWait(int threadID) {return m_pTarget->_Target::ResumeAndWait(threadID);}
+		GDBStatus Step(int threadID) {return m_pTarget->_Target::Step(threadID);}
+	};
+
+	//! A version of GDBStub that binds the target type at compile time
+	/*! GDBStub calls the target via the ISyncGDBTarget interface, so every memory or register access goes through the virtual table.
+		GDBStubT uses the same protocol code, but calls the methods of _Target directly. If the target methods are defined in the class
+		declaration (e.g. a simulator copying memory from a buffer), they are inlined into the 'm', 'M', 'g', 'G' and stop reply handlers.
+		\remarks _Target should be the most derived target class. The rarely used packets (e.g. 'vCont' or 'qXfer') are still handled via the
+		ISyncGDBTarget interface.
+		\code
+		class SimulatorTarget final : public MinimalTargetBase
+		{
+			...
+		};
+
+		IGDBStub *CreateStub(GDBServer *pServer)
+		{
+			return new GDBStubT<SimulatorTarget>(new SimulatorTarget());
+		}
+		\endcode
+	*/
+	template <class _Target> class GDBStubT : public GDBStub
+	{
+	private:
+		StaticTargetCalls<_Target> m_StaticTarget;
+
+	public:
+		GDBStubT(_Target *pTarget, bool own = true)
+			: GDBStub(pTarget, own)
+			, m_StaticTarget(pTarget)
+		{
+		}
+
+		virtual StubResponse Handle_QueryStopReason() {return DoHandle_QueryStopReason(m_StaticTarget);}
+		virtual StubResponse Handle_g(int threadID) {return DoHandle_g(m_StaticTarget, threadID);}
+		virtual StubResponse Handle_G(int threadID, const BazisLib::TempStringA &registerValueBlock) {return DoHandle_G(m_StaticTarget, threadID, registerValueBlock);}
+		virtual StubResponse Handle_P(int threadID, unsigned registerIndex, const BazisLib::TempStringA &registerValue) {return DoHandle_P(m_StaticTarget, threadID, registerIndex, registerValue);}
+		virtual StubResponse Handle_p(int threadID, unsigned registerIndex) {return DoHandle_p(m_StaticTarget, threadID, registerIndex);}
+		virtual StubResponse Handle_m(ULONGLONG addr, size_t length) {return DoHandle_m(m_StaticTarget, addr, length);}
+		virtual StubResponse Handle_M(ULONGLONG addr, size_t length, const BazisLib::TempStringA &data) {return DoHandle_M(m_StaticTarget, addr, length, data);}
+		virtual StubResponse Handle_X(ULONGLONG addr, size_t length, const BazisLib::TempStringA &binaryData) {return DoHandle_X(m_StaticTarget, addr, length, binaryData);}
+		virtual StubResponse Handle_c(int threadID) {return DoHandle_c(m_StaticTarget, threadID);}
+		virtual StubResponse Handle_s(int threadID) {return DoHandle_s(m_StaticTarget, threadID);}
+	};
+
+	template <class _Target> StubResponse GDBStub::DoHandle_QueryStopReason(_Target &target)
+	{
+		if (m_StartupSnapshot.Valid)
+			return CopySnapshotReply(m_StartupSnapshot.StopReply);
+
+		TargetStopRecord rec;
+		memset(&rec, 0, sizeof(rec));
+		if (target.GetLastStopRecord(&rec) != kGDBSuccess)
+			return StandardResponses::CommandNotSupported;
+
+		StubResponse strRegisters(GetSessionArena());
+		if (rec.Reason != kProcessExited)
+		{
+			RegisterSetContainer registers = InitializeRegisterSetContainer();
+			GDBStatus status = target.ReadFrameRelatedRegisters(rec.ThreadID, registers);
+			bool allRegistersRead = false;
+			if (m_bRegisterCacheEnabled && !m_ExpeditedRegisters.empty() && (status != kGDBSuccess || !ExpeditedRegistersValid(registers)))
+			{
+				//Some of the expedited registers are not frame-related, so all registers are read and cached to avoid a follow-up 'g' or 'p' request
+				status = target.ReadTargetRegisters(rec.ThreadID, registers);
+				allRegistersRead = (status == kGDBSuccess);
+			}
+
+			if (status == kGDBSuccess)
+			{
+				if (m_bRegisterCacheEnabled)
+					CacheFrameRelatedRegisters(rec.ThreadID, registers, allRegistersRead);
+				if (m_ExpeditedRegisters.empty())
+					AppendExpeditedRegisters(strRegisters, *m_pRegisters, registers);
+				else
+					AppendExpeditedRegisters(strRegisters, *m_pRegisters, registers, &m_ExpeditedRegisters[0], m_ExpeditedRegisters.size());
+				m_StackPrefetcher.Prefetch(target, m_MemoryCache, registers);
+			}
+		}
+
+		strRegisters.Append("", 1);	//Null-terminate the register list
+		return StopRecordToStopReply(rec, strRegisters.GetData());
+	}
+
+	template <class _Target> StubResponse GDBStub::DoHandle_g(_Target &target, int threadID)
+	{
+		if (m_StartupSnapshot.Valid && threadID == m_StartupSnapshot.ThreadID && m_StartupSnapshot.Registers.GetSize())
+			return CopySnapshotReply(m_StartupSnapshot.Registers);
+
+		StubResponse response(GetSessionArena());
+		GDBStatus status;
+
+		if (m_bRegisterCacheEnabled)
+		{
+			CachedRegisterSet *pCached = ProvideCachedRegisters(target, threadID, &status);
+			if (pCached)
+				AppendRegisterBlock(response, *m_pRegisters, pCached->Registers);
+			else
+				AppendGDBError(response, status);
+			return response;
+		}
+
+		RegisterSetContainer registers = InitializeRegisterSetContainer();
+		status = target.ReadTargetRegisters(threadID, registers);
+		if (status != kGDBSuccess)
+			AppendGDBError(response, status);
+		else
+			AppendRegisterBlock(response, *m_pRegisters, registers);
+		return response;
+	}
+
+	template <class _Target> StubResponse GDBStub::DoHandle_G(_Target &target, int threadID, const BazisLib::TempStringA &registerValueBlock)
+	{
+		InvalidateStartupSnapshot();
+		RegisterSetContainer registers = InitializeRegisterSetContainer();
+
+		//The container has the same layout as the 'G' packet, so the whole block is decoded at once
+		size_t decodedSize = registerValueBlock.size() / 2;
+		if (decodedSize > registers.GetBlockSize())
+			decodedSize = registers.GetBlockSize();
+
+		if (decodedSize)
+			HexHelpers::HexDecode(registerValueBlock.GetConstBuffer(), decodedSize, registers.GetBlock());
+
+		for (size_t i = 0; i < registers.RegisterCount(); i++)
+		{
+			if (registers.GetRegisterOffset(i) + registers.GetRegisterSize(i) > decodedSize)
+				break;
+			registers[i].Valid = true;
+		}
+
+		if (m_bRegisterCacheEnabled)
+		{
+			//The registers are written to the target before it is resumed (see FlushRegisterCache())
+			CachedRegisterSet &cached = GetCachedRegisters(threadID);
+			for (size_t i = 0; i < registers.RegisterCount(); i++)
+			{
+				if (!registers[i].Valid)
+					continue;
+				cached.Registers[i] = registers[i];
+				cached.Dirty[i] = true;
+				cached.AnyDirty = true;
+			}
+			return StandardResponses::OK;
+		}
+
+		GDBStatus status = target.WriteTargetRegisters(threadID, registers);
+		return FormatGDBStatus(status);
+	}
+
+	template <class _Target> StubResponse GDBStub::DoHandle_P(_Target &target, int threadID, unsigned registerNumber, const BazisLib::TempStringA &registerValue)
+	{
+		if (registerNumber >= m_pRegisters->RegisterCount)
+			return "EINVAL";
+
+		InvalidateStartupSnapshot();
+		if (m_bRegisterCacheEnabled)
+		{
+			CachedRegisterSet &cached = GetCachedRegisters(threadID);
+			RegisterValueReference value = cached.Registers[registerNumber];
+			if (registerValue.size() < 2U * value.SizeInBytes)
+				return "EINVAL";
+
+			HexHelpers::HexDecode(registerValue.GetConstBuffer(), value.SizeInBytes, value.Value);
+			value.Valid = true;
+			cached.Dirty[registerNumber] = true;
+			cached.AnyDirty = true;
+			return StandardResponses::OK;
+		}
+
+		RegisterSetContainer registers = InitializeRegisterSetContainer();
+
+		if (registerValue.size() < 2U * registers[registerNumber].SizeInBytes)
+			return "EINVAL";
+
+		HexHelpers::HexDecode(registerValue.GetConstBuffer(), registers[registerNumber].SizeInBytes, registers[registerNumber].Value);
+
+		registers[registerNumber].Valid = true;
+
+		GDBStatus status = target.WriteTargetRegisters(threadID, registers);
+		return FormatGDBStatus(status);
+	}
+
+	template <class _Target> StubResponse GDBStub::DoHandle_p(_Target &target, int threadID, unsigned registerNumber)
+	{
+		if (registerNumber >= m_pRegisters->RegisterCount)
+			return "EINVAL";
+
+		GDBStatus status;
+		if (m_bRegisterCacheEnabled)
+		{
+			//The registers reported in the stop reply are already cached, so reading them does not involve the target
+			CachedRegisterSet &cached = GetCachedRegisters(threadID);
+			if (!cached.Registers[registerNumber].Valid && !ProvideCachedRegisters(target, threadID, &status))
+				return FormatGDBStatus(status);
+			return FormatRegisterValue(cached.Registers[registerNumber]);
+		}
+
+		RegisterSetContainer registers = InitializeRegisterSetContainer();
+		status = target.ReadTargetRegisters(threadID, registers);
+		if (status != kGDBSuccess)
+			return FormatGDBStatus(status);
+		return FormatRegisterValue(registers[registerNumber]);
+	}
+
+	template <class _Target> StubResponse GDBStub::DoHandle_m(_Target &target, ULONGLONG ullAddr, size_t requestedLength)
+	{
+		m_StackPrefetcher.OnMemoryRead(ullAddr, requestedLength);
+		if (requestedLength > m_MaxMemoryReadSize)
+			requestedLength = m_MaxMemoryReadSize;
+
+		//Only the first chunk is read here. The rest is read by m_MemoryReadStream while the reply is being sent.
+		size_t uLength = requestedLength;
+		if (uLength > kMemoryReadChunkSize)
+			uLength = kMemoryReadChunkSize;
+
+		size_t done = uLength;
+
+		void *pBuf = GetSessionArena()->Allocate(uLength);
+		if (!pBuf)
+			return "ENOMEM";
+
+		StubResponse response(GetSessionArena());
+		GDBStatus status = m_MemoryCache.Read(target, ullAddr, pBuf, &done);
+		if (status != kGDBSuccess)
+			AppendGDBError(response, status);
+		else
+		{
+			ASSERT(done <= uLength);
+			if (done > uLength)
+				done = uLength;
+
+			char *pNewText = response.AllocateAppend(done * 2);
+			if (!pNewText)
+				return "ENOMEM";
+			HexHelpers::HexEncode(pBuf, done, pNewText);
+
+			if (done == uLength && uLength < requestedLength)
+			{
+				m_MemoryReadStream.Start(m_pTarget, &m_MemoryCache, ullAddr + done, requestedLength - done);
+				response.SetStream(&m_MemoryReadStream);
+			}
+		}
+		return response;
+	}
+
+	template <class _Target> StubResponse GDBStub::DoHandle_M(_Target &target, ULONGLONG ullAddr, size_t uLength, const BazisLib::TempStringA &data)
+	{
+		if (data.length() != uLength * 2)
+			return "EINVAL";
+
+		void *pBuf = GetSessionArena()->Allocate(uLength);
+		if (!pBuf)
+			return "ENOMEM";
+
+		if (!HexHelpers::HexDecode(data.GetConstBuffer(), uLength, pBuf))
+			return "EINVAL";
+
+		InvalidateStartupSnapshot();
+		GDBStatus status = target.WriteTargetMemory(ullAddr, pBuf, uLength);
+		UpdateMemoryCacheAfterWrite(status, ullAddr, pBuf, uLength);
+		return FormatGDBStatus(status);
+	}
+
+	template <class _Target> StubResponse GDBStub::DoHandle_X(_Target &target, ULONGLONG ullAddr, size_t uLength, const BazisLib::TempStringA &binaryData)
+	{
+		if (!uLength)
+			return "OK";	//GDB is probing whether the command is supported
+
+		if (binaryData.length() != uLength)
+			return "EINVAL";
+
+		InvalidateStartupSnapshot();
+		GDBStatus status = target.WriteTargetMemory(ullAddr, binaryData.GetConstBuffer(), uLength);
+		UpdateMemoryCacheAfterWrite(status, ullAddr, binaryData.GetConstBuffer(), uLength);
+		return FormatGDBStatus(status);
+	}
+
+	template <class _Target> StubResponse GDBStub::DoHandle_c(_Target &target, int threadID)
+	{
+		GDBStatus status = FlushRegisterCache(target);
+		if (status != kGDBSuccess)
+			return FormatGDBStatus(status);
+
+		ResetAllCachesWhenResumingTarget();
+		{
+			BreakInMonitorScope breakInScope(m_pBreakInMonitor);
+			status = target.ResumeAndWait(threadID);
+		}
+		if (status != kGDBSuccess)
+			return FormatGDBStatus(status);
+
+		return Handle_QueryStopReason();
+	}
+
+	template <class _Target> StubResponse GDBStub::DoHandle_s(_Target &target, int threadID)
+	{
+		GDBStatus status = FlushRegisterCache(target);
+		if (status != kGDBSuccess)
+			return FormatGDBStatus(status);
+
+		ResetAllCachesWhenResumingTarget();
+		{
+			BreakInMonitorScope breakInScope(m_pBreakInMonitor);
+			status = target.Step(threadID);
+		}
+		if (status != kGDBSuccess)
+			return FormatGDBStatus(status);
+
+		return Handle_QueryStopReason();
+	}
+
+	template <class _Target> GDBStub::CachedRegisterSet *GDBStub::ProvideCachedRegisters(_Target &target, int threadID, GDBStatus *pStatus)
+	{
+		CachedRegisterSet &cached = GetCachedRegisters(threadID);
+		if (!cached.Complete)
+		{
+			RegisterSetContainer registers = InitializeRegisterSetContainer();
+			*pStatus = target.ReadTargetRegisters(threadID, registers);
+			if (*pStatus != kGDBSuccess)
+				return NULL;
+
+			//The registers modified via 'P' or 'G' keep the new values
+			for (size_t i = 0; i < registers.RegisterCount(); i++)
+				if (!cached.Dirty[i])
+					cached.Registers[i] = registers[i];
+
+			cached.Complete = true;
+		}
+
+		*pStatus = kGDBSuccess;
+		return &cached;
+	}
+
+	template <class _Target> GDBStatus GDBStub::FlushRegisterCache(_Target &target)
+	{
+		GDBStatus result = kGDBSuccess;
+		for (size_t j = 0; j < m_CachedThreadCount; j++)
+		{
+			CachedRegisterSet &cached = m_RegisterCache[j];
+			if (!cached.AnyDirty)
+				continue;
+
+			RegisterSetContainer registers = InitializeRegisterSetContainer();
+			for (size_t i = 0; i < registers.RegisterCount(); i++)
+				if (cached.Dirty[i])
+					registers[i] = cached.Registers[i];
+
+			GDBStatus status = target.WriteTargetRegisters(cached.ThreadID, registers);
+			if (status != kGDBSuccess)
+			{
+				//The set stays dirty, so that the write is retried before the next resume
+				if (result == kGDBSuccess)
+					result = status;
+				continue;
+			}
+
+			//The target is not resumed if another set fails, so the written values stay cached
+			cached.Dirty.assign(cached.Dirty.size(), false);
+			cached.AnyDirty = false;
+		}
+
+		if (result == kGDBSuccess)
+			ClearRegisterCache();
+		return result;
+	}
+}
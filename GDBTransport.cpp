@@ -0,0 +1,361 @@
+#include "stdafx.h"
+#include "GDBTransport.h"
+
+using namespace BazisLib;
+using namespace GDBServerFoundation;
+
+size_t GDBServerFoundation::TCPSocketTransport::Receive(void *pBuffer, size_t size)
+{
+	if (!size)
+		return 0;
+
+	if (m_bHasPushedBackByte)
+	{
+		m_bHasPushedBackByte = false;
+		*((char *)pBuffer) = m_PushedBackByte;
+		return 1;
+	}
+
+	size_t done = m_pSocket->Recv(pBuffer, size);
+	if (done == (size_t)-1)
+		return 0;
+	return done;
+}
+
+bool GDBServerFoundation::TCPSocketTransport::ReceiveByte(char *pCh, ULONGLONG *pArrivalTime)
+{
+	*pArrivalTime = 0;
+	return Receive(pCh, 1) == 1;
+}
+
+void GDBServerFoundation::TCPSocketTransport::PushBack(char ch)
+{
+	ASSERT(!m_bHasPushedBackByte);
+	m_PushedBackByte = ch;
+	m_bHasPushedBackByte = true;
+}
+
+bool GDBServerFoundation::TCPSocketTransport::Send(const void *pBuffer, size_t size)
+{
+	return m_pSocket->Send(pBuffer, size) == size;
+}
+
+size_t GDBServerFoundation::TCPSocketTransport::SendSegments(const DataSegment *pSegments, size_t count)
+{
+	//The segments are gathered into one buffer, so that the packet still goes out with a single Send() call
+	m_SendBuffer.SetSize(0);
+	for (size_t i = 0; i < count; i++)
+		m_SendBuffer.append(pSegments[i].pData, pSegments[i].Length);
+
+	if (!Send(m_SendBuffer.GetConstData(), m_SendBuffer.GetSize()))
+		return 0;
+	return m_SendBuffer.GetSize();
+}
+
+void GDBServerFoundation::TCPSocketTransport::Close()
+{
+	m_pSocket->Close();
+}
+
+#ifdef __linux__
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+GDBServerFoundation::FDTransport::FDTransport(int readFD, int writeFD, bool ownDescriptors)
+	: m_ReadFD(readFD)
+	, m_WriteFD(writeFD)
+	, m_bOwnDescriptors(ownDescriptors)
+	, m_bIsSocket(false)
+	, m_PushedBackByte(0)
+	, m_bHasPushedBackByte(false)
+{
+	struct stat st;
+	if (!fstat(m_WriteFD, &st))
+		m_bIsSocket = S_ISSOCK(st.st_mode) && (m_ReadFD == m_WriteFD);
+
+	if (m_bIsSocket)
+	{
+#ifdef SO_TIMESTAMPNS
+		//Allows reporting the arrival time of the break-in requests (see BreakInStatistics)
+		int one = 1;
+		setsockopt(m_ReadFD, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+#endif
+	}
+}
+
+GDBServerFoundation::FDTransport::~FDTransport()
+{
+	if (m_bOwnDescriptors)
+		Close();
+}
+
+size_t GDBServerFoundation::FDTransport::Receive(void *pBuffer, size_t size)
+{
+	if (!size)
+		return 0;
+
+	if (m_bHasPushedBackByte)
+	{
+		m_bHasPushedBackByte = false;
+		*((char *)pBuffer) = m_PushedBackByte;
+		return 1;
+	}
+
+	for (;;)
+	{
+		ssize_t done = read(m_ReadFD, pBuffer, size);
+		if (done < 0 && errno == EINTR)
+			continue;
+		return (done > 0) ? done : 0;
+	}
+}
+
+bool GDBServerFoundation::FDTransport::ReceiveByte(char *pCh, ULONGLONG *pArrivalTime)
+{
+	*pArrivalTime = 0;
+	if (!m_bIsSocket || m_bHasPushedBackByte)
+		return Receive(pCh, 1) == 1;
+
+	iovec vec;
+	vec.iov_base = pCh;
+	vec.iov_len = 1;
+
+	char control[CMSG_SPACE(sizeof(timespec))];
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &vec;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ssize_t done;
+	do
+		done = recvmsg(m_ReadFD, &msg, 0);
+	while (done < 0 && errno == EINTR);
+
+	if (done != 1)
+		return false;
+
+#ifdef SO_TIMESTAMPNS
+	for (cmsghdr *pHeader = CMSG_FIRSTHDR(&msg); pHeader; pHeader = CMSG_NXTHDR(&msg, pHeader))
+	{
+		if (pHeader->cmsg_level == SOL_SOCKET && pHeader->cmsg_type == SCM_TIMESTAMPNS)
+		{
+			timespec ts;
+			memcpy(&ts, CMSG_DATA(pHeader), sizeof(ts));
+			*pArrivalTime = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		}
+	}
+#endif
+
+	return true;
+}
+
+void GDBServerFoundation::FDTransport::PushBack(char ch)
+{
+	ASSERT(!m_bHasPushedBackByte);
+	m_PushedBackByte = ch;
+	m_bHasPushedBackByte = true;
+}
+
+bool GDBServerFoundation::FDTransport::Send(const void *pBuffer, size_t size)
+{
+	DataSegment segment = {(const char *)pBuffer, size};
+	while (segment.Length)
+	{
+		size_t done = SendSegments(&segment, 1);
+		if (!done)
+			return false;
+		segment.pData += done;
+		segment.Length -= done;
+	}
+	return true;
+}
+
+//Same as writev(), but writing to a pipe closed by the reader fails with EPIPE instead of raising SIGPIPE.
+//The signal is blocked for the calling thread only, and the SIGPIPE generated by this call is consumed before unblocking it,
+//so the signal disposition of the rest of the process is not affected.
+static ssize_t WriteWithoutSIGPIPE(int fd, const iovec *pVectors, int count)
+{
+	sigset_t sigpipeMask, oldMask, pending;
+	sigemptyset(&sigpipeMask);
+	sigaddset(&sigpipeMask, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &sigpipeMask, &oldMask);
+
+	//A SIGPIPE that was pending before the call is left for its owner
+	sigpending(&pending);
+	bool sigpipeWasPending = sigismember(&pending, SIGPIPE) == 1;
+
+	ssize_t done = writev(fd, pVectors, count);
+	int error = errno;
+
+	if (done < 0 && error == EPIPE && !sigpipeWasPending)
+	{
+		timespec noWait = {0, 0};
+		while (sigtimedwait(&sigpipeMask, NULL, &noWait) == -1 && errno == EINTR)
+		{
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+	errno = error;
+	return done;
+}
+
+size_t GDBServerFoundation::FDTransport::SendSegments(const DataSegment *pSegments, size_t count)
+{
+	enum {kMaxVectorsPerCall = 256};
+
+	iovec vectors[kMaxVectorsPerCall];
+	if (count > kMaxVectorsPerCall)
+		count = kMaxVectorsPerCall;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		vectors[i].iov_base = (void *)pSegments[i].pData;
+		vectors[i].iov_len = pSegments[i].Length;
+	}
+
+	for (;;)
+	{
+		ssize_t done;
+		if (m_bIsSocket)
+		{
+			msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = vectors;
+			msg.msg_iovlen = count;
+			done = sendmsg(m_WriteFD, &msg, MSG_NOSIGNAL);
+		}
+		else
+			done = WriteWithoutSIGPIPE(m_WriteFD, vectors, (int)count);
+
+		if (done < 0 && errno == EINTR)
+			continue;
+		return (done > 0) ? done : 0;
+	}
+}
+
+void GDBServerFoundation::FDTransport::Close()
+{
+	if (m_bOwnDescriptors)
+	{
+		if (m_ReadFD != -1)
+			close(m_ReadFD);
+		if (m_WriteFD != -1 && m_WriteFD != m_ReadFD)
+			close(m_WriteFD);
+		m_ReadFD = m_WriteFD = -1;
+	}
+	else if (m_bIsSocket)
+		shutdown(m_ReadFD, SHUT_RDWR);	//The socket is closed by its owner, but the pending calls should return now
+}
+
+static speed_t TranslateBaudRate(unsigned baudRate)
+{
+	switch(baudRate)
+	{
+	case 9600:
+		return B9600;
+	case 19200:
+		return B19200;
+	case 38400:
+		return B38400;
+	case 57600:
+		return B57600;
+	case 115200:
+		return B115200;
+	case 230400:
+		return B230400;
+#ifdef B460800
+	case 460800:
+		return B460800;
+#endif
+#ifdef B921600
+	case 921600:
+		return B921600;
+#endif
+#ifdef B1000000
+	case 1000000:
+		return B1000000;
+#endif
+#ifdef B2000000
+	case 2000000:
+		return B2000000;
+#endif
+#ifdef B3000000
+	case 3000000:
+		return B3000000;
+#endif
+	default:
+		return B0;
+	}
+}
+
+GDBServerFoundation::SerialTransport::SerialTransport(const char *pDevice, unsigned baudRate, ActionStatus *pStatus)
+	: FDTransport(-1, -1, true)
+	, m_BytesPerSecond(baudRate / 10)	//8 data bits, 1 start bit and 1 stop bit
+{
+	speed_t speed = TranslateBaudRate(baudRate);
+	if (speed == B0)
+	{
+		ASSIGN_STATUS(pStatus, InvalidParameter);
+		return;
+	}
+
+	int fd = open(pDevice, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		ASSIGN_STATUS(pStatus, UnknownError);
+		return;
+	}
+
+	termios tio;
+	if (tcgetattr(fd, &tio))
+	{
+		close(fd);
+		ASSIGN_STATUS(pStatus, UnknownError);
+		return;
+	}
+
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+
+	if (tcsetattr(fd, TCSANOW, &tio))
+	{
+		close(fd);
+		ASSIGN_STATUS(pStatus, UnknownError);
+		return;
+	}
+
+	tcflush(fd, TCIOFLUSH);
+	m_ReadFD = m_WriteFD = fd;
+	ASSIGN_STATUS(pStatus, Success);
+}
+
+size_t GDBServerFoundation::SerialTransport::GetPreferredMaxPacketSize()
+{
+	size_t budget = (size_t)((ULONGLONG)m_BytesPerSecond * kMaxPacketTransferTimeInMs / 1000);
+	if (budget > kMaxPreferredPacketSize)
+		budget = kMaxPreferredPacketSize;
+
+	size_t packetSize = kMinPreferredPacketSize;
+	while (packetSize * 2 <= budget)
+		packetSize *= 2;
+	return packetSize;
+}
+
+#endif
@@ -0,0 +1,154 @@
+#pragma once
+#include <bzscore/buffer.h>
+#include <bzscore/status.h>
+#include <bzsnet/BufferedSocket.h>
+
+namespace GDBServerFoundation
+{
+	//! Describes a contiguous block of data sent with IGDBTransport::SendSegments()
+	struct DataSegment
+	{
+		const char *pData;
+		size_t Length;
+	};
+
+	//! Represents a bidirectional byte stream between the server and GDB (e.g. a TCP connection, a Unix socket or a pipe pair)
+	/*! The packet framing, acknowledgment handling and break-in detection are implemented on top of this interface, so they work the
+		same way regardless of the underlying connection. See GDBServer::HandleConnection() for running a session over a custom transport.
+
+		\remarks Receive() and PushBack() are never called concurrently. Send() and SendSegments() can be called while another thread
+				 is blocked in Receive().
+	*/
+	class IGDBTransport
+	{
+	public:
+		//! Receives up to size bytes. Blocks until at least one byte is available. Returns 0 if the connection has been closed.
+		virtual size_t Receive(void *pBuffer, size_t size)=0;
+
+		//! Receives a single byte checked by the break-in detectors
+		/*!
+			\param pArrivalTime Receives the time when the byte has been received by the OS (CLOCK_REALTIME, in nanoseconds), or 0 if the transport does not report it.
+			\return False if the connection has been closed.
+		*/
+		virtual bool ReceiveByte(char *pCh, ULONGLONG *pArrivalTime)=0;
+
+		//! Makes the next Receive() call return the given byte first. Used by the break-in detectors to return the first byte of the next packet.
+		virtual void PushBack(char ch)=0;
+
+		//! Sends the entire buffer. Returns false if the connection has been closed.
+		virtual bool Send(const void *pBuffer, size_t size)=0;
+
+		//! Sends the given segments, normally with a single system call. Returns the amount of bytes sent, or 0 if the connection has been closed.
+		virtual size_t SendSegments(const DataSegment *pSegments, size_t count)=0;
+
+		//! Returns a descriptor that can be passed to poll() to wait for incoming data, or -1 if the transport does not have one
+		virtual int GetPollHandle() {return -1;}
+
+		//! Returns the maximum packet size that should be reported to GDB over this transport, or 0 if the transport has no preference
+		virtual size_t GetPreferredMaxPacketSize() {return 0;}
+
+		//! Returns false if the data can be corrupted on the way (e.g. a serial line), so the packet checksums should always be verified
+		virtual bool IsReliable() {return true;}
+
+		//! Closes the connection, unblocking any pending Receive() calls where possible
+		virtual void Close()=0;
+
+		virtual ~IGDBTransport() {}
+	};
+
+#ifdef __linux__
+	//! Implements a transport over POSIX file descriptors: TCP or Unix domain sockets, or a pair of pipes (e.g. stdin/stdout)
+	/*! \remarks Writing to a connection closed by GDB results in an error rather than terminating the process. Sockets use MSG_NOSIGNAL.
+				 For other descriptors (e.g. pipes) SIGPIPE is blocked for the writing thread during each write, so the signal
+				 disposition of the process is not changed.
+	*/
+	class FDTransport : public IGDBTransport
+	{
+	protected:
+		int m_ReadFD, m_WriteFD;
+		bool m_bOwnDescriptors, m_bIsSocket;
+
+		char m_PushedBackByte;
+		bool m_bHasPushedBackByte;
+
+	public:
+		//! Creates a transport over the given descriptors. For sockets, readFD and writeFD should be the same.
+		/*!
+			\param ownDescriptors If true, the descriptors are closed by Close() and the destructor.
+		*/
+		FDTransport(int readFD, int writeFD, bool ownDescriptors);
+		~FDTransport();
+
+		virtual size_t Receive(void *pBuffer, size_t size) override;
+		virtual bool ReceiveByte(char *pCh, ULONGLONG *pArrivalTime) override;
+		virtual void PushBack(char ch) override;
+		virtual bool Send(const void *pBuffer, size_t size) override;
+		virtual size_t SendSegments(const DataSegment *pSegments, size_t count) override;
+		virtual void Close() override;
+
+		virtual int GetPollHandle() override
+		{
+			return m_ReadFD;
+		}
+	};
+
+	//! Implements a transport over a serial port (e.g. a UART bridge or a pseudo-terminal)
+	/*! The port is switched to the raw 8N1 mode with the given baud rate. The segments produced by PacketCodec::ScatterGatherEncoder
+		are written with a single writev() call (see FDTransport::SendSegments()), so the tty driver receives the whole packet at once
+		and paces it to the line speed itself.
+
+		As each packet takes a noticeable time on the wire, the suggested maximum packet size (see GetPreferredMaxPacketSize()) is
+		the largest power of 2 that can be transferred within kMaxPacketTransferTimeInMs, so that large reads are split into as few
+		packets as possible without running into GDB's reply timeout (see 'set remotetimeout').
+
+		The transport is reported as unreliable (see IsReliable()), so the checksums are verified even if GDB enables the no-ack mode.
+	*/
+	class SerialTransport : public FDTransport
+	{
+	private:
+		size_t m_BytesPerSecond;
+
+	public:
+		enum
+		{
+			kMaxPacketTransferTimeInMs = 1000,
+			kMinPreferredPacketSize = 0x100,
+			kMaxPreferredPacketSize = 0x10000,
+		};
+
+		//! Opens and configures a serial port. Check pStatus or IsValid() to ensure the port has been opened successfully.
+		SerialTransport(const char *pDevice, unsigned baudRate, BazisLib::ActionStatus *pStatus = NULL);
+
+		bool IsValid() {return m_ReadFD != -1;}
+
+		virtual size_t GetPreferredMaxPacketSize() override;
+		virtual bool IsReliable() override {return false;}
+	};
+#endif
+
+	//! Implements a transport over a BazisLib TCP socket. Used on platforms where FDTransport is not available.
+	class TCPSocketTransport : public IGDBTransport
+	{
+	private:
+		BazisLib::Network::TCPSocket *m_pSocket;
+		BazisLib::BasicBuffer m_SendBuffer;
+
+		char m_PushedBackByte;
+		bool m_bHasPushedBackByte;
+
+	public:
+		TCPSocketTransport(BazisLib::Network::TCPSocket *pSocket)
+			: m_pSocket(pSocket)
+			, m_PushedBackByte(0)
+			, m_bHasPushedBackByte(false)
+		{
+		}
+
+		virtual size_t Receive(void *pBuffer, size_t size) override;
+		virtual bool ReceiveByte(char *pCh, ULONGLONG *pArrivalTime) override;
+		virtual void PushBack(char ch) override;
+		virtual bool Send(const void *pBuffer, size_t size) override;
+		virtual size_t SendSegments(const DataSegment *pSegments, size_t count) override;
+		virtual void Close() override;
+	};
+}
@@ -0,0 +1,219 @@
+#include "stdafx.h"
+#include "HexHelpers.h"
+#include "CPUFeatures.h"
+
+using namespace GDBServerFoundation;
+using namespace GDBServerFoundation::HexHelpers;
+
+#define X kInvalidHexDigit
+const unsigned char GDBServerFoundation::HexHelpers::HexDigitValues[256] = {
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, X, X, X, X, X, X,
+	X, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+};
+#undef X
+
+//Contains the 2-character hex representations of all byte values
+static const char s_HexBytes[513] =
+	"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+	"202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+	"404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+	"606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+	"808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+	"a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+	"c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+	"e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+static inline void EncodeBytesScalar(const unsigned char *pData, size_t size, char *pHex)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		const char *pPair = s_HexBytes + pData[i] * 2;
+		pHex[i * 2] = pPair[0];
+		pHex[i * 2 + 1] = pPair[1];
+	}
+}
+
+static inline bool DecodeBytesScalar(const char *pHex, size_t size, unsigned char *pData)
+{
+	unsigned invalid = 0;
+	for (size_t i = 0; i < size; i++)
+	{
+		unsigned high = HexDigitValues[(unsigned char)pHex[i * 2]], low = HexDigitValues[(unsigned char)pHex[i * 2 + 1]];
+		invalid |= high | low;
+		pData[i] = (unsigned char)(((high & 0x0F) << 4) | (low & 0x0F));
+	}
+	return !(invalid & kInvalidHexDigit);
+}
+
+#ifdef GDBSERVER_HAS_SSE2
+
+/*
+	The vectorized versions convert 16 (SSE2) or 32 (AVX2) bytes at once using arithmetic instead of table lookups:
+		- Encoding: each nibble N is converted to N + '0', plus ('a' - '0' - 10) if N > 9.
+		- Decoding: each character C is a digit if (C - '0') <= 9 and a letter if ((C | 0x20) - 'a') <= 5 (unsigned comparisons).
+		  Then the pairs of nibbles are combined via 16-bit shifts and packed into bytes.
+*/
+
+static inline __m128i NibblesToHexChars(__m128i nibbles)
+{
+	__m128i letterOffset = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+	return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letterOffset);
+}
+
+static size_t EncodeBlocksSSE2(const unsigned char *pData, size_t size, char *pHex)
+{
+	const __m128i lowNibbleMask = _mm_set1_epi8(0x0F);
+	size_t offset = 0;
+	for (; (offset + 16) <= size; offset += 16)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i *)(pData + offset));
+		__m128i high = NibblesToHexChars(_mm_and_si128(_mm_srli_epi16(block, 4), lowNibbleMask));
+		__m128i low = NibblesToHexChars(_mm_and_si128(block, lowNibbleMask));
+
+		_mm_storeu_si128((__m128i *)(pHex + offset * 2), _mm_unpacklo_epi8(high, low));
+		_mm_storeu_si128((__m128i *)(pHex + offset * 2 + 16), _mm_unpackhi_epi8(high, low));
+	}
+	return offset;
+}
+
+//Converts 16 characters to nibble values and clears the corresponding bytes of pValidMask for the characters that are not hex digits
+static inline __m128i HexCharsToNibbles(__m128i chars, __m128i *pValidMask)
+{
+	__m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+	__m128i letter = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+	__m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+	__m128i isLetter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+
+	*pValidMask = _mm_and_si128(*pValidMask, _mm_or_si128(isDigit, isLetter));
+	return _mm_or_si128(_mm_and_si128(isDigit, digit), _mm_and_si128(isLetter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+}
+
+//Combines the pairs of nibbles (high nibble first) into 16-bit values
+static inline __m128i CombineNibblePairs(__m128i nibbles)
+{
+	return _mm_or_si128(_mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0xFF)), 4), _mm_srli_epi16(nibbles, 8));
+}
+
+static size_t DecodeBlocksSSE2(const char *pHex, size_t size, unsigned char *pData, bool *pValid)
+{
+	__m128i validMask = _mm_set1_epi8(-1);
+	size_t offset = 0;
+	for (; (offset + 16) <= size; offset += 16)
+	{
+		__m128i first = HexCharsToNibbles(_mm_loadu_si128((const __m128i *)(pHex + offset * 2)), &validMask);
+		__m128i second = HexCharsToNibbles(_mm_loadu_si128((const __m128i *)(pHex + offset * 2 + 16)), &validMask);
+		_mm_storeu_si128((__m128i *)(pData + offset), _mm_packus_epi16(CombineNibblePairs(first), CombineNibblePairs(second)));
+	}
+
+	*pValid = (_mm_movemask_epi8(validMask) == 0xFFFF);
+	return offset;
+}
+
+GDBSERVER_AVX2_FUNCTION static inline __m256i NibblesToHexCharsAVX2(__m256i nibbles)
+{
+	__m256i letterOffset = _mm256_and_si256(_mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9)), _mm256_set1_epi8('a' - '0' - 10));
+	return _mm256_add_epi8(_mm256_add_epi8(nibbles, _mm256_set1_epi8('0')), letterOffset);
+}
+
+GDBSERVER_AVX2_FUNCTION static size_t EncodeBlocksAVX2(const unsigned char *pData, size_t size, char *pHex)
+{
+	const __m256i lowNibbleMask = _mm256_set1_epi8(0x0F);
+	size_t offset = 0;
+	for (; (offset + 32) <= size; offset += 32)
+	{
+		__m256i block = _mm256_loadu_si256((const __m256i *)(pData + offset));
+		__m256i high = NibblesToHexCharsAVX2(_mm256_and_si256(_mm256_srli_epi16(block, 4), lowNibbleMask));
+		__m256i low = NibblesToHexCharsAVX2(_mm256_and_si256(block, lowNibbleMask));
+
+		//The unpack instructions work within 128-bit lanes, so the halves should be swapped before storing
+		__m256i first = _mm256_unpacklo_epi8(high, low), second = _mm256_unpackhi_epi8(high, low);
+		_mm256_storeu_si256((__m256i *)(pHex + offset * 2), _mm256_permute2x128_si256(first, second, 0x20));
+		_mm256_storeu_si256((__m256i *)(pHex + offset * 2 + 32), _mm256_permute2x128_si256(first, second, 0x31));
+	}
+	return offset;
+}
+
+GDBSERVER_AVX2_FUNCTION static inline __m256i HexCharsToNibblesAVX2(__m256i chars, __m256i *pValidMask)
+{
+	__m256i digit = _mm256_sub_epi8(chars, _mm256_set1_epi8('0'));
+	__m256i letter = _mm256_sub_epi8(_mm256_or_si256(chars, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+	__m256i isDigit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+	__m256i isLetter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8(5)), letter);
+
+	*pValidMask = _mm256_and_si256(*pValidMask, _mm256_or_si256(isDigit, isLetter));
+	return _mm256_or_si256(_mm256_and_si256(isDigit, digit), _mm256_and_si256(isLetter, _mm256_add_epi8(letter, _mm256_set1_epi8(10))));
+}
+
+GDBSERVER_AVX2_FUNCTION static inline __m256i CombineNibblePairsAVX2(__m256i nibbles)
+{
+	return _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(nibbles, _mm256_set1_epi16(0xFF)), 4), _mm256_srli_epi16(nibbles, 8));
+}
+
+GDBSERVER_AVX2_FUNCTION static size_t DecodeBlocksAVX2(const char *pHex, size_t size, unsigned char *pData, bool *pValid)
+{
+	__m256i validMask = _mm256_set1_epi8(-1);
+	size_t offset = 0;
+	for (; (offset + 32) <= size; offset += 32)
+	{
+		__m256i first = HexCharsToNibblesAVX2(_mm256_loadu_si256((const __m256i *)(pHex + offset * 2)), &validMask);
+		__m256i second = HexCharsToNibblesAVX2(_mm256_loadu_si256((const __m256i *)(pHex + offset * 2 + 32)), &validMask);
+
+		//The pack instruction interleaves the 64-bit halves of the lanes, so they should be reordered
+		__m256i packed = _mm256_packus_epi16(CombineNibblePairsAVX2(first), CombineNibblePairsAVX2(second));
+		_mm256_storeu_si256((__m256i *)(pData + offset), _mm256_permute4x64_epi64(packed, 0xD8));
+	}
+
+	*pValid = (_mm256_movemask_epi8(validMask) == -1);
+	return offset;
+}
+
+#endif
+
+void GDBServerFoundation::HexHelpers::HexEncode(const void *pData, size_t size, char *pHex)
+{
+	const unsigned char *pBytes = (const unsigned char *)pData;
+	size_t done = 0;
+
+#ifdef GDBSERVER_HAS_SSE2
+	if (size >= 32 && CPUFeatures::HasAVX2())
+		done = EncodeBlocksAVX2(pBytes, size, pHex);
+	done += EncodeBlocksSSE2(pBytes + done, size - done, pHex + done * 2);
+#endif
+
+	EncodeBytesScalar(pBytes + done, size - done, pHex + done * 2);
+}
+
+bool GDBServerFoundation::HexHelpers::HexDecode(const char *pHex, size_t size, void *pData)
+{
+	unsigned char *pBytes = (unsigned char *)pData;
+	size_t done = 0;
+	bool valid = true;
+
+#ifdef GDBSERVER_HAS_SSE2
+	bool blocksValid;
+	if (size >= 32 && CPUFeatures::HasAVX2())
+	{
+		done = DecodeBlocksAVX2(pHex, size, pBytes, &blocksValid);
+		valid = blocksValid;
+	}
+
+	done += DecodeBlocksSSE2(pHex + done * 2, size - done, pBytes + done, &blocksValid);
+	valid = valid && blocksValid;
+#endif
+
+	return DecodeBytesScalar(pHex + done * 2, size - done, pBytes + done) && valid;
+}
@@ -8,19 +8,35 @@ namespace GDBServerFoundation
 	{
 		const char hexTable[17] = "0123456789abcdef";
 
-		//! Converts a single hex character (0-9,a-f,A-F) to its integral value
+		enum {kInvalidHexDigit = 0x80};
+
+		//! Maps each character to its hex digit value, or to kInvalidHexDigit if the character is not a hex digit
+		extern const unsigned char HexDigitValues[256];
+
+		//! Converts a single hex character (0-9,a-f,A-F) to its integral value. Returns 0 for other characters.
 		static inline unsigned hexToInt(char hexChar)
 		{
-			//TODO: convert to a table-based version
-			if (hexChar >= '0' && hexChar <= '9')
-				return hexChar - '0';
-			if (hexChar >= 'A' && hexChar <= 'F')
-				return hexChar + 0x0A - 'A';
-			if (hexChar >= 'a' && hexChar <= 'f')
-				return hexChar + 0x0A - 'a';
-			return 0;
+			return HexDigitValues[(unsigned char)hexChar] & 0x0F;
 		}
 
+		//! Returns true if the character is a hex digit (0-9,a-f,A-F)
+		static inline bool IsHexDigit(char hexChar)
+		{
+			return !(HexDigitValues[(unsigned char)hexChar] & kInvalidHexDigit);
+		}
+
+		//! Converts binary data to lowercase hex characters
+		/*! The output buffer should have space for 2 * size characters. No null terminator is written.
+			The SSE2 or AVX2 (if supported by the CPU) version is used for large blocks.
+		*/
+		void HexEncode(const void *pData, size_t size, char *pHex);
+
+		//! Converts 2 * size hex characters into size bytes
+		/*! The characters other than hex digits are converted to 0 (as in hexToInt()).
+			\return False if the input contained characters other than hex digits
+		*/
+		bool HexDecode(const char *pHex, size_t size, void *pData);
+
 		//! Converts a single two-character hex value into a byte
 		static inline unsigned ParseHexValue(const char *p)
 		{
@@ -2,56 +2,263 @@
 #include <string>
 #include <bzscore/buffer.h>
 #include "BreakInSocket.h"
+#include "SessionArena.h"
 
 namespace GDBServerFoundation
 {
+	//! Produces the rest of a long reply while it is being sent (see StubResponse::SetStream())
+	/*! The stream allows sending replies that are much larger than the memory used to produce them. The server calls ReadNextPart()
+		until it returns NULL and sends each part right away, so GDB receives the beginning of the reply before the rest is produced.
+		The stream object is owned by the stub and should stay valid until the next request is passed to the stub.
+	*/
+	class IReplyStream
+	{
+	public:
+		//! Returns the next part of the reply (not escaped or RLE-encoded) or NULL if the reply is complete
+		/*! The returned data should stay valid until the next call. */
+		virtual const char *ReadNextPart(size_t *pSize)=0;
+		virtual ~IReplyStream(){}
+	};
+
 	//! Contains the response sent to GDB by the target. The response it not escaped or RLE-encoded and does not include packet header and checksum.
+	/*! Short responses (e.g. "OK", "E01" or most stop replies) are stored inside the object, so creating and returning them does not
+		allocate any memory. Longer responses are stored in a heap block that is moved (not copied) when the response is returned
+		by value. The responses created with FromStaticText() (e.g. StandardResponses::OK) only reference the text until they are modified.
+
+		A response created with a SessionArena stores the longer text in the arena instead of the heap. Such responses should only
+		be returned from the request handlers of the stub owning the arena. Copies of them use the heap, so they can be kept for longer.
+
+		If a stream is attached to the response (see SetStream()), the text stored in the response is only the beginning of the reply.
+		The rest is read from the stream when the reply is sent.
+	*/
 	class StubResponse
 	{
-		BazisLib::BasicBuffer m_Buffer;
+	public:
+		enum
+		{
+			kInlineCapacity = 128,
+			kGrowthStep = 4096,
+		};
+
+	private:
+		//! Points to m_InlineData, a heap or arena block, or a static text (if m_Capacity is 0)
+		char *m_pData;
+		size_t m_Size, m_Capacity;
+		//! If not NULL, the blocks are allocated from the arena and are never freed
+		SessionArena *m_pArena;
+		IReplyStream *m_pStream;
+		char m_InlineData[kInlineCapacity];
+
+	private:
+		bool IsHeapAllocated() const {return m_pData != m_InlineData && m_Capacity && !m_pArena;}
+
+		void Release()
+		{
+			if (IsHeapAllocated())
+				free(m_pData);
+			m_pData = m_InlineData;
+			m_Size = 0;
+			m_Capacity = kInlineCapacity;
+			m_pStream = NULL;
+		}
+
+		//! Ensures that the response owns a writable buffer of at least the given size
+		bool Reserve(size_t size)
+		{
+			if (m_Capacity >= size)
+				return true;
+
+			size_t newCapacity = size + kGrowthStep;
+			char *pNewData;
+			if (m_pArena && size > kInlineCapacity)
+			{
+				pNewData = (char *)m_pArena->Allocate(newCapacity, 1);
+				if (pNewData)
+					memcpy(pNewData, m_pData, m_Size);
+			}
+			else if (IsHeapAllocated())
+				pNewData = (char *)realloc(m_pData, newCapacity);
+			else if (size <= kInlineCapacity)
+			{
+				//A static text is converted to the inline storage
+				memmove(m_InlineData, m_pData, m_Size);
+				m_pData = m_InlineData;
+				m_Capacity = kInlineCapacity;
+				return true;
+			}
+			else
+			{
+				pNewData = (char *)malloc(newCapacity);
+				if (pNewData)
+					memcpy(pNewData, m_pData, m_Size);
+			}
+
+			if (!pNewData)
+				return false;
+
+			m_pData = pNewData;
+			m_Capacity = newCapacity;
+			return true;
+		}
+
+		void Assign(const void *pData, size_t length, SessionArena *pArena = NULL)
+		{
+			m_pArena = pArena;
+			m_pStream = NULL;
+			m_pData = m_InlineData;
+			m_Size = 0;
+			m_Capacity = kInlineCapacity;
+			if (length && Reserve(length))
+			{
+				memcpy(m_pData, pData, length);
+				m_Size = length;
+			}
+		}
+
+		void MoveFrom(StubResponse &anotherResponse)
+		{
+			if (anotherResponse.m_pData == anotherResponse.m_InlineData)
+				Assign(anotherResponse.m_InlineData, anotherResponse.m_Size, anotherResponse.m_pArena);
+			else
+			{
+				//Steal the heap or arena block or the static text pointer
+				m_pData = anotherResponse.m_pData;
+				m_Size = anotherResponse.m_Size;
+				m_Capacity = anotherResponse.m_Capacity;
+				m_pArena = anotherResponse.m_pArena;
+			}
+
+			m_pStream = anotherResponse.m_pStream;
+			anotherResponse.m_pData = anotherResponse.m_InlineData;
+			anotherResponse.m_Size = 0;
+			anotherResponse.m_Capacity = kInlineCapacity;
+			anotherResponse.m_pStream = NULL;
+		}
+
+		void CopyFrom(const StubResponse &anotherResponse)
+		{
+			if (!anotherResponse.m_Capacity)
+			{
+				//Static texts are shared between all copies
+				m_pData = anotherResponse.m_pData;
+				m_Size = anotherResponse.m_Size;
+				m_Capacity = 0;
+				m_pArena = NULL;
+			}
+			else
+				Assign(anotherResponse.m_pData, anotherResponse.m_Size);
+			m_pStream = anotherResponse.m_pStream;
+		}
 
 	public:
 		StubResponse(const StubResponse &anotherResponse)
-			: m_Buffer(anotherResponse.m_Buffer.GetSize())
 		{
-			memcpy(m_Buffer.GetData(), anotherResponse.m_Buffer.GetConstData(), anotherResponse.m_Buffer.GetSize());
-			m_Buffer.SetSize(anotherResponse.m_Buffer.GetSize());
+			CopyFrom(anotherResponse);
+		}
+
+		StubResponse(StubResponse &&anotherResponse)
+		{
+			MoveFrom(anotherResponse);
 		}
 
 		StubResponse()
+			: m_pData(m_InlineData)
+			, m_Size(0)
+			, m_Capacity(kInlineCapacity)
+			, m_pArena(NULL)
+			, m_pStream(NULL)
+		{
+		}
+
+		//! Creates an empty response that allocates the memory for the longer texts from the given arena
+		explicit StubResponse(SessionArena *pArena)
+			: m_pData(m_InlineData)
+			, m_Size(0)
+			, m_Capacity(kInlineCapacity)
+			, m_pArena(pArena)
+			, m_pStream(NULL)
 		{
 		}
 
 		StubResponse(const char *pText)
-			: m_Buffer(pText, strlen(pText))
 		{
+			Assign(pText, strlen(pText));
 		}
 
 		StubResponse(const void *pData, size_t length)
-			: m_Buffer((const char *)pData, length)
 		{
+			Assign(pData, length);
 		}
 
-		size_t GetSize() {return m_Buffer.GetSize();}
-		const char *GetData() {return (const char *)m_Buffer.GetConstData();}
+		~StubResponse()
+		{
+			Release();
+		}
+
+		StubResponse &operator=(const StubResponse &anotherResponse)
+		{
+			if (this != &anotherResponse)
+			{
+				Release();
+				CopyFrom(anotherResponse);
+			}
+			return *this;
+		}
+
+		StubResponse &operator=(StubResponse &&anotherResponse)
+		{
+			if (this != &anotherResponse)
+			{
+				Release();
+				MoveFrom(anotherResponse);
+			}
+			return *this;
+		}
+
+		//! Creates a response referencing a text that stays valid and unchanged for the lifetime of the program (e.g. a string literal)
+		/*! Copying such a response does not copy the text. The text is only copied once the response is modified. */
+		static StubResponse FromStaticText(const char *pText)
+		{
+			StubResponse response;
+			response.m_pData = (char *)pText;
+			response.m_Size = strlen(pText);
+			response.m_Capacity = 0;
+			return response;
+		}
+
+		size_t GetSize() const {return m_Size;}
+		const char *GetData() const {return m_pData;}
+
+		//! Specifies the stream producing the rest of the reply after the text stored in the response (see IReplyStream)
+		void SetStream(IReplyStream *pStream) {m_pStream = pStream;}
+		IReplyStream *GetStream() const {return m_pStream;}
+
+		//! Checks whether the response matches the given text (e.g. "OK")
+		bool Equals(const char *pText) const
+		{
+			size_t length = strlen(pText);
+			return length == m_Size && !memcmp(m_pData, pText, length);
+		}
 
 		void Append(const char *pStr)
 		{
-			m_Buffer.append(pStr, strlen(pStr), 4096);
+			Append(pStr, strlen(pStr));
 		}
 
 		void Append(const char *pStr, size_t length)
 		{
-			m_Buffer.append(pStr, length, 4096);
+			char *pTarget = AllocateAppend(length);
+			if (pTarget)
+				memcpy(pTarget, pStr, length);
 		}
 
 		char *AllocateAppend(size_t length)
 		{
-			size_t oldSize = m_Buffer.GetSize();
-			if (!m_Buffer.EnsureSize(oldSize + length))
+			size_t oldSize = m_Size;
+			if (!Reserve(oldSize + length))
 				return NULL;
-			m_Buffer.SetSize(oldSize + length);
-			return (char *)m_Buffer.GetData(oldSize);
+			m_Size = oldSize + length;
+			return m_pData + oldSize;
 		}
 
 		StubResponse &operator+=(const char *pStr)
@@ -64,9 +271,9 @@ namespace GDBServerFoundation
 	//! Contains common responses sent by gdbserver to GDB
 	struct StandardResponses
 	{
-		static StubResponse CommandNotSupported;
-		static StubResponse InvalidArgument;
-		static StubResponse OK;
+		static const StubResponse CommandNotSupported;
+		static const StubResponse InvalidArgument;
+		static const StubResponse OK;
 	};
 
 	//! Defines a GDB stub capable of handling raw gdbserver requests. Use the GDBStub class to instantiate.
@@ -75,6 +282,24 @@ namespace GDBServerFoundation
 	public:
 		//! Handles a fully unescaped RLE-expanded request from GDB
 		virtual StubResponse HandleRequest(const BazisLib::TempStringA &requestType, char splitterChar, const BazisLib::TempStringA &requestData)=0;
+
+		//! Provides an object that should be notified each time the stub blocks inside the target (e.g. when resuming it)
+		/*! \return If the stub notifies the monitor around every blocking call, it should return true. In that case the server
+					 does not need to monitor the connection for break-in requests while the other requests are handled.
+		*/
+		virtual bool SetBreakInMonitor(IBreakInMonitor *pMonitor) {return false;}
+
+		//! Returns the maximum packet size reported to GDB via the 'PacketSize' feature, or 0 if it is not reported
+		/*! The server uses this value to size the receive and reply buffers, so that the largest packets can be received with a single call. */
+		virtual size_t GetMaxPacketSize() {return 0;}
+
+		//! Called before the first request if the transport has a preferred maximum packet size (see IGDBTransport::GetPreferredMaxPacketSize())
+		virtual void AdjustMaxPacketSize(size_t preferredMaxPacketSize) {}
+
+		//! Called by the server once the connection is set up, before the first request is received
+		/*! The stub can use this to prepare the replies to the first requests while GDB is still sending them. */
+		virtual void OnConnectionAccepted() {}
+
 		virtual ~IGDBStub(){}
 	};
 
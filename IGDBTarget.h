@@ -137,6 +137,24 @@ namespace GDBServerFoundation
 		virtual GDBStatus CommitFLASHWrite()=0;
 	};
 
+	//! Lists the optional target features that can be reported via IStoppedGDBTarget::GetCapabilities()
+	enum TargetCapability
+	{
+		//! IStoppedGDBTarget::GetDynamicLibraryList() is implemented
+		tcDynamicLibraryList = 0x01,
+		//! IStoppedGDBTarget::GetThreadList() is implemented
+		tcThreadList = 0x02,
+		//! IStoppedGDBTarget::GetFLASHProgrammer() returns an object providing a non-empty list of memory regions
+		tcMemoryMap = 0x04,
+		//! GetLastStopRecord() sets TargetStopRecord::StoppedByBreakpoint for all software and hardware breakpoints
+		/*! The stub then reports the 'swbreak' and 'hwbreak' features to GDB. The target should report the address of the breakpoint
+			instruction (i.e. after adjusting the program counter on architectures like x86) as the program counter. */
+		tcBreakpointStopReasons = 0x08,
+
+		//! Should be set if the other flags are valid. Otherwise GDBStub finds out the capabilities by calling the methods listed above.
+		tcCapabilitiesKnown = 0x80000000,
+	};
+
 	//! Defines methods called when the target is stopped.
 	/*! This interface defines the methods of the GDB target that are called when the target is stopped. 
 		Actual targets should implement the ISyncGDBTarget interface instead.
@@ -158,8 +176,8 @@ namespace GDBServerFoundation
 		/*!
 			\return See the GDBStatus description for a list of valid return codes.
 			\param threadID Specifies the ID of the thread to query
-			\param registers Contains the storage for the register values. The storage is initialized with RegisterValue
-							 instances flagged as invalid and sizes set based on the GetRegisterList() call.
+			\param registers Contains the storage for the register values. Initially all registers are flagged as invalid
+							 and have the sizes set based on the GetRegisterList() call.
 			\remarks If this method returns an error, GDB will read all registers using the
 					 ReadTargetRegisters() method. Thus it only makes sense to implement this
 					 method if reading frame-related registers instead of all registers saves time.
@@ -279,6 +297,18 @@ namespace GDBServerFoundation
 
 		//! Returns a pointer to an IFLASHProgrammer instance, or NULL if not supported. The returned instance should be persistent (e.g. the same object that implements IStoppedGDBTarget).
 		virtual IFLASHProgrammer *GetFLASHProgrammer()=0;
+
+		//! Returns a combination of the TargetCapability flags describing the optional methods implemented by the target
+		/*! This allows GDBStub to report the supported features to GDB without enumerating the libraries and threads of the target.
+			The lists are then only requested when GDB actually needs them.
+			\remarks The default implementation returns 0 (capabilities unknown). In that case GDBStub calls GetDynamicLibraryList(),
+					 GetThreadList() and GetFLASHProgrammer() once when GDB connects to find out whether they are supported.
+		*/
+		virtual unsigned GetCapabilities()
+		{
+			return 0;
+		}
+
 		virtual ~IStoppedGDBTarget(){}
 	};
 
@@ -319,6 +349,16 @@ namespace GDBServerFoundation
 			//! If Reason == kProcessExited, contains the exit code of the process
 			int ExitCode;
 		} Extension;
+
+		//! Set if the target was stopped by a breakpoint or a watchpoint set via IStoppedGDBTarget::CreateBreakpoint(). Extension.SignalNumber should be SIGTRAP.
+		/*! Reporting the breakpoint kind lets GDB handle the stop without reading the program counter and the memory back.
+			The software and hardware breakpoints are only reported if the target has the tcBreakpointStopReasons capability.
+		*/
+		bool StoppedByBreakpoint;
+		//! If StoppedByBreakpoint is set, specifies the type of the breakpoint or the watchpoint
+		BreakpointType BreakpointKind;
+		//! If BreakpointKind is a watchpoint, contains the data address that has triggered it
+		ULONGLONG WatchAddress;
 	};
 
 	//! Defines a GDB target
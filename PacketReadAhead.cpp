@@ -0,0 +1,206 @@
+#include "stdafx.h"
+#include "PacketReadAhead.h"
+
+using namespace BazisLib;
+using namespace GDBServerFoundation;
+using namespace GDBServerFoundation::PacketCodec;
+
+GDBServerFoundation::PacketReadAheadQueue::PacketReadAheadQueue(IGDBTransport *pTransport, IBreakInTarget *pTarget, unsigned packetCount, size_t bytesToReceiveAtOnce)
+	: m_pTransport(pTransport)
+	, m_pTarget(pTarget)
+	, m_pReceiveBuffers(NULL)
+	, m_pPinCounts(NULL)
+	, m_CurrentBuffer(0)
+	, m_BytesToReceiveAtOnce(bytesToReceiveAtOnce)
+	, m_pPackets(new QueuedPacket[packetCount ? packetCount : 1])
+	, m_PacketCount(packetCount ? packetCount : 1)
+	, m_WriteIndex(0)
+	, m_ReadIndex(0)
+	, m_bHandlingPacket(false)
+	, m_bTerminating(false)
+	, m_bStarted(false)
+	, m_ReaderThread(this, &PacketReadAheadQueue::ReaderThreadBody)
+{
+	for (unsigned i = 0; i < m_PacketCount; i++)
+		m_FreeSlots.Signal();
+
+	m_pReceiveBuffers = new PacketReceiveBuffer[m_PacketCount + 1];
+	m_pPinCounts = new unsigned[m_PacketCount + 1];
+	memset(m_pPinCounts, 0, (m_PacketCount + 1) * sizeof(unsigned));
+
+	//The queue is only started after 'QStartNoAckMode' has been handled. GDB still acknowledges the reply to it, so the framer expects a '+' before the first packet.
+	*m_Framer.GetNewAckEnabledPointer() = false;
+}
+
+GDBServerFoundation::PacketReadAheadQueue::~PacketReadAheadQueue()
+{
+	Stop();
+	delete[] m_pPackets;
+	delete[] m_pReceiveBuffers;
+	delete[] m_pPinCounts;
+}
+
+void GDBServerFoundation::PacketReadAheadQueue::Start(const char *pReceivedData, size_t receivedSize, bool verifyChecksums)
+{
+	ASSERT(!m_bStarted);
+	m_Framer.SetVerifyChecksumsWithoutACK(verifyChecksums);
+
+	//The other buffers are only allocated if the reader thread has to switch to them
+	PacketReceiveBuffer &buffer = m_pReceiveBuffers[m_CurrentBuffer];
+	buffer.Reserve(m_BytesToReceiveAtOnce + receivedSize);
+	if (receivedSize)
+	{
+		memcpy(buffer.PrepareReceive(receivedSize), pReceivedData, receivedSize);
+		buffer.CommitReceive(receivedSize);
+	}
+
+	m_bStarted = m_ReaderThread.Start();
+}
+
+void GDBServerFoundation::PacketReadAheadQueue::Stop()
+{
+	if (!m_bStarted)
+		return;
+
+	{
+		MutexLocker lck(m_Lock);
+		m_bTerminating = true;
+	}
+
+	m_FreeSlots.Signal();
+	m_ReaderThread.Join();
+	m_bStarted = false;
+}
+
+const GDBServerFoundation::PacketReadAheadQueue::QueuedPacket * GDBServerFoundation::PacketReadAheadQueue::WaitForPacket()
+{
+	m_QueuedPackets.Wait();
+
+	MutexLocker lck(m_Lock);
+	m_bHandlingPacket = true;
+	return &m_pPackets[m_ReadIndex];
+}
+
+void GDBServerFoundation::PacketReadAheadQueue::ReleasePacket()
+{
+	{
+		MutexLocker lck(m_Lock);
+		m_bHandlingPacket = false;
+
+		unsigned bufferIndex = m_pPackets[m_ReadIndex].BufferIndex;
+		if (bufferIndex != kNoBuffer)
+			m_pPinCounts[bufferIndex]--;
+	}
+
+	m_ReadIndex = (m_ReadIndex + 1) % m_PacketCount;
+	m_FreeSlots.Signal();
+}
+
+bool GDBServerFoundation::PacketReadAheadQueue::QueueEvent(const PacketFramer::Event &evt)
+{
+	m_FreeSlots.Wait();
+	{
+		MutexLocker lck(m_Lock);
+		if (m_bTerminating)
+			return false;
+	}
+
+	QueuedPacket &packet = m_pPackets[m_WriteIndex];
+	packet.Type = evt.Type;
+	packet.pBody = NULL;
+	packet.BodyLength = 0;
+	packet.ErrorChar = evt.ErrorChar;
+	packet.Checksum = evt.Checksum;
+	packet.ExpectedChecksum = evt.ExpectedChecksum;
+	packet.BufferIndex = kNoBuffer;
+
+	if (evt.Type == PacketFramer::kPacketReceived)
+	{
+		packet.pBody = evt.pBody;
+		packet.BodyLength = evt.BodyLength;
+		packet.BufferIndex = m_CurrentBuffer;
+
+		MutexLocker lck(m_Lock);
+		m_pPinCounts[m_CurrentBuffer]++;
+	}
+
+	m_WriteIndex = (m_WriteIndex + 1) % m_PacketCount;
+	m_QueuedPackets.Signal();
+	return true;
+}
+
+void GDBServerFoundation::PacketReadAheadQueue::SwitchToUnpinnedBuffer()
+{
+	unsigned newBuffer = m_CurrentBuffer;
+	{
+		MutexLocker lck(m_Lock);
+		if (!m_pPinCounts[m_CurrentBuffer])
+			return;
+
+		//The pin counts can only decrease while the reader thread is running, so the found buffer stays unpinned
+		for (unsigned i = 0; i <= m_PacketCount; i++)
+			if (!m_pPinCounts[i])
+			{
+				newBuffer = i;
+				break;
+			}
+	}
+
+	ASSERT(newBuffer != m_CurrentBuffer);
+	PacketReceiveBuffer &oldBuffer = m_pReceiveBuffers[m_CurrentBuffer], &buffer = m_pReceiveBuffers[newBuffer];
+	buffer.Clear();
+
+	//Only the incomplete packet at the end of the old buffer is moved. The old buffer is left intact, as the queued packets point into it.
+	size_t remaining = oldBuffer.GetSize();
+	char *pSpace = buffer.PrepareReceive(remaining + m_BytesToReceiveAtOnce);
+	if (pSpace && remaining)
+	{
+		memcpy(pSpace, oldBuffer.GetData(), remaining);
+		buffer.CommitReceive(remaining);
+	}
+
+	m_CurrentBuffer = newBuffer;
+}
+
+int GDBServerFoundation::PacketReadAheadQueue::ReaderThreadBody()
+{
+	for (;;)
+	{
+		PacketReceiveBuffer *pBuffer = &m_pReceiveBuffers[m_CurrentBuffer];
+		PacketFramer::Event evt = m_Framer.ProcessData(pBuffer->GetData(), pBuffer->GetSize());
+		if (evt.Type == PacketFramer::kNeedMoreData)
+		{
+			pBuffer->Discard(evt.ConsumedBytes);
+
+			//Receiving into a pinned buffer could move the queued packets
+			SwitchToUnpinnedBuffer();
+			pBuffer = &m_pReceiveBuffers[m_CurrentBuffer];
+
+			char *pFreeSpace = pBuffer->PrepareReceive(m_BytesToReceiveAtOnce);
+			size_t done = pFreeSpace ? m_pTransport->Receive(pFreeSpace, m_BytesToReceiveAtOnce) : 0;
+			if (!done)
+				break;
+
+			pBuffer->CommitReceive(done);
+			continue;
+		}
+
+		if (evt.Type == PacketFramer::kBreakInRequest)
+			m_pTarget->OnBreakInRequest();
+		else if (!QueueEvent(evt))
+			return 0;
+
+		pBuffer->Discard(evt.ConsumedBytes);
+	}
+
+	{
+		//If a request is being handled, it may be blocked in the target. Stop the target, so that the session can end.
+		MutexLocker lck(m_Lock);
+		if (m_bHandlingPacket && !m_bTerminating)
+			m_pTarget->OnBreakInRequest();
+	}
+
+	PacketFramer::Event closed = {PacketFramer::kNeedMoreData, };
+	QueueEvent(closed);
+	return 0;
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include <bzscore/sync.h>
+#include <bzscore/thread.h>
+#include <bzscore/buffer.h>
+#include "GDBTransport.h"
+#include "GDBPacketCodec.h"
+#include "BreakInSocket.h"
+
+namespace GDBServerFoundation
+{
+	//! Receives, validates and unescapes the packets sent by GDB in the no-ack mode while the previous packet is being handled
+	/*! After 'QStartNoAckMode' GDB often sends several packets back to back (e.g. a burst of 'm' requests while unwinding the stack).
+		Once started, this class reads from the transport on a separate thread and stores the unescaped packets in a queue of
+		a fixed size, so that the receive and decode time is hidden behind the time spent in the target.
+
+		The packets are not copied. Each queued packet points to the receive buffer it has been unescaped in, and that buffer is
+		pinned until the packet is released. If the reader thread needs more data while the current buffer is pinned, it switches
+		to an unpinned one and only moves the incomplete packet at the end of the old buffer. As each queued packet pins at most
+		one buffer, packetCount + 1 buffers are always enough.
+
+		The break-in requests (0x03 bytes) are delivered to IBreakInTarget::OnBreakInRequest() by the reader thread as soon as
+		they are received, so no other break-in detector should read from the transport while the queue is active.
+
+		The main thread should call WaitForPacket() to get the next packet and ReleasePacket() once it has been handled:
+		\code
+		for (;;)
+		{
+			const PacketReadAheadQueue::QueuedPacket *pPacket = queue.WaitForPacket();
+			if (pPacket->Type == PacketCodec::PacketFramer::kNeedMoreData)
+				break;	//The connection has been closed
+			...
+			queue.ReleasePacket();
+		}
+		\endcode
+
+		\remarks If the queue is full, the reader thread stops receiving until a packet is released. A 0x03 byte sent after
+				 more than the queue size packets is only delivered once the queue has some free space.
+	*/
+	class PacketReadAheadQueue
+	{
+	public:
+		struct QueuedPacket
+		{
+			//! kPacketReceived, kInvalidCharacter or kInvalidChecksum. kNeedMoreData means that the connection has been closed.
+			PacketCodec::PacketFramer::EventType Type;
+			//! Points to the unescaped packet body for kPacketReceived. The body stays valid until ReleasePacket() is called.
+			const char *pBody;
+			size_t BodyLength;
+			char ErrorChar;
+			unsigned Checksum, ExpectedChecksum;
+			//! Index of the receive buffer containing the body, or kNoBuffer if the packet does not have a body
+			unsigned BufferIndex;
+		};
+
+		enum {kNoBuffer = (unsigned)-1};
+
+	private:
+		IGDBTransport *m_pTransport;
+		IBreakInTarget *m_pTarget;
+
+		PacketCodec::PacketFramer m_Framer;
+		//! m_PacketCount + 1 buffers. Only the reader thread accesses them, except for the bodies of the queued packets.
+		PacketCodec::PacketReceiveBuffer *m_pReceiveBuffers;
+		//! Amount of queued packets referencing each buffer. Protected by m_Lock.
+		unsigned *m_pPinCounts;
+		unsigned m_CurrentBuffer;
+		size_t m_BytesToReceiveAtOnce;
+
+		QueuedPacket *m_pPackets;
+		unsigned m_PacketCount;
+		//! Only modified by the reader and the main thread respectively
+		unsigned m_WriteIndex, m_ReadIndex;
+		BazisLib::Semaphore m_FreeSlots, m_QueuedPackets;
+
+		BazisLib::Mutex m_Lock;
+		bool m_bHandlingPacket, m_bTerminating, m_bStarted;
+		BazisLib::MemberThread m_ReaderThread;
+
+	private:
+		int ReaderThreadBody();
+		bool QueueEvent(const PacketCodec::PacketFramer::Event &evt);
+		//! Makes an unpinned buffer current, moving the unprocessed data to it. Called before receiving into a pinned buffer.
+		void SwitchToUnpinnedBuffer();
+
+	public:
+		//! Creates an inactive queue. Call Start() to start receiving the packets.
+		/*!
+			\param packetCount Specifies the maximum amount of packets that can be received ahead of the one being handled.
+			\param bytesToReceiveAtOnce Specifies the size of a single Receive() call. See IGDBStub::GetMaxPacketSize().
+		*/
+		PacketReadAheadQueue(IGDBTransport *pTransport, IBreakInTarget *pTarget, unsigned packetCount, size_t bytesToReceiveAtOnce);
+
+		//! Stops the reader thread. The transport should be closed before, so that the pending Receive() call returns.
+		~PacketReadAheadQueue();
+
+		//! Starts the reader thread
+		/*!
+			\param pReceivedData Specifies the data that has already been received from the transport, but not yet handled.
+			\param verifyChecksums Specifies whether the checksums of the received packets should be verified. See PacketFramer::SetVerifyChecksumsWithoutACK().
+		*/
+		void Start(const char *pReceivedData, size_t receivedSize, bool verifyChecksums);
+
+		bool IsStarted() {return m_bStarted;}
+
+		//! Waits for the next packet. The returned object stays valid until ReleasePacket() is called.
+		const QueuedPacket *WaitForPacket();
+
+		//! Returns the packet returned by the last WaitForPacket() call to the queue
+		void ReleasePacket();
+
+		//! Stops the reader thread. The transport should be closed before calling this method. Called automatically by the destructor.
+		void Stop();
+	};
+}
@@ -0,0 +1,229 @@
+#include "stdafx.h"
+#include "PacketTable.h"
+#include "HexHelpers.h"
+
+using namespace GDBServerFoundation;
+
+size_t GDBServerFoundation::PacketTableBase::AddPacket(const char *pName, const char *pGrammar)
+{
+	size_t nameLength = strlen(pName);
+	m_bRebuildNeeded = true;
+
+	for (size_t i = 0; i < m_Packets.size(); i++)
+	{
+		if (m_Packets[i].NameLength == nameLength && !memcmp(m_Packets[i].pName, pName, nameLength))
+		{
+			m_Packets[i].pGrammar = pGrammar;
+			return i;
+		}
+	}
+
+	PacketRecord record = {pName, nameLength, pGrammar};
+	m_Packets.push_back(record);
+	return m_Packets.size() - 1;
+}
+
+void GDBServerFoundation::PacketTableBase::Rebuild()
+{
+	enum {kMinSlotCount = 16, kSeedsPerTableSize = 256};
+
+	size_t slotCount = kMinSlotCount;
+	while (slotCount < m_Packets.size() * 2)
+		slotCount *= 2;
+
+	//Find a seed that maps all names to distinct slots. If there is none, try a larger table.
+	for (;;)
+	{
+		for (unsigned seed = 0; seed < kSeedsPerTableSize; seed++)
+		{
+			m_Slots.assign(slotCount, 0);
+
+			bool collision = false;
+			for (size_t i = 0; i < m_Packets.size(); i++)
+			{
+				unsigned short &slot = m_Slots[HashPacketName(m_Packets[i].pName, m_Packets[i].NameLength, seed) & (slotCount - 1)];
+				if (slot)
+				{
+					collision = true;
+					break;
+				}
+				slot = (unsigned short)(i + 1);
+			}
+
+			if (!collision)
+			{
+				m_Seed = seed;
+				m_bRebuildNeeded = false;
+				return;
+			}
+		}
+
+		slotCount *= 2;
+	}
+}
+
+int GDBServerFoundation::PacketTableBase::Lookup(const char *pName, size_t nameLength)
+{
+	if (m_bRebuildNeeded)
+		Rebuild();
+
+	if (m_Slots.empty())
+		return -1;
+
+	unsigned slot = m_Slots[HashPacketName(pName, nameLength, m_Seed) & (m_Slots.size() - 1)];
+	if (!slot)
+		return -1;
+
+	const PacketRecord &record = m_Packets[slot - 1];
+	if (record.NameLength != nameLength || memcmp(record.pName, pName, nameLength))
+		return -1;
+
+	return slot - 1;
+}
+
+size_t GDBServerFoundation::PacketTableBase::GetPacketNameLength(const BazisLib::TempStringA &requestType)
+{
+	if (requestType.empty())
+		return 0;
+
+	switch(requestType[0])
+	{
+	case 'q':
+	case 'Q':
+	case 'v':
+		return requestType.length();
+	default:
+		return 1;
+	}
+}
+
+int GDBServerFoundation::PacketTableBase::ParseRequest(const BazisLib::TempStringA &requestType, char splitterChar, const BazisLib::TempStringA &requestData, GDBRequest *pRequest)
+{
+	size_t nameLength = GetPacketNameLength(requestType);
+	if (!nameLength)
+		return kUnknownPacket;
+
+	int index = Lookup(requestType.GetConstBuffer(), nameLength);
+	if (index == -1)
+		return kUnknownPacket;
+
+	pRequest->pType = &requestType;
+	pRequest->pData = &requestData;
+	pRequest->SplitterChar = splitterChar;
+
+	const char *pGrammar = m_Packets[index].pGrammar;
+	if (!pGrammar)
+		return index;
+
+	//The arguments start right after the name and include the splitter and the request data
+	const char *pArguments = requestType.GetConstBuffer() + nameLength;
+	size_t argumentLength = requestType.length() - nameLength;
+
+	if (splitterChar)
+	{
+		if (requestData.GetConstBuffer() == pArguments + argumentLength + 1)
+			argumentLength += 1 + requestData.length();	//The request has not been split into separate buffers (see PacketCodec::DispatchPacket())
+		else
+		{
+			m_ArgumentBuffer.assign(pArguments, argumentLength);
+			m_ArgumentBuffer.append(1, splitterChar);
+			m_ArgumentBuffer.append(requestData.GetConstBuffer(), requestData.length());
+			pArguments = m_ArgumentBuffer.c_str();
+			argumentLength = m_ArgumentBuffer.length();
+		}
+	}
+
+	if (!ParseArguments(pGrammar, pArguments, argumentLength, pRequest))
+		return kMalformedPacket;
+
+	return index;
+}
+
+static bool ParseHexNumber(const char **ppArguments, const char *pEnd, ULONGLONG *pValue)
+{
+	const char *p = *ppArguments;
+	ULONGLONG value = 0;
+
+	for (; p != pEnd; p++)
+	{
+		unsigned digit = HexHelpers::HexDigitValues[(unsigned char)*p];
+		if (digit & HexHelpers::kInvalidHexDigit)
+			break;
+		value = (value << 4) | digit;
+	}
+
+	if (p == *ppArguments)
+		return false;
+
+	*ppArguments = p;
+	*pValue = value;
+	return true;
+}
+
+bool GDBServerFoundation::PacketTableBase::ParseArguments(const char *pGrammar, const char *pArguments, size_t length, GDBRequest *pRequest)
+{
+	const char *p = pArguments, *pEnd = pArguments + length;
+	unsigned stringIndex = 0;
+	ULONGLONG value;
+
+	for (const char *pField = pGrammar; *pField; pField++)
+	{
+		switch(*pField)
+		{
+		case 'A':
+			if (!ParseHexNumber(&p, pEnd, &pRequest->Address))
+				return false;
+			break;
+		case 'L':
+			if (!ParseHexNumber(&p, pEnd, &value))
+				return false;
+			pRequest->Length = (size_t)value;
+			break;
+		case 'N':
+			if (!ParseHexNumber(&p, pEnd, &value))
+				return false;
+			pRequest->Number = (unsigned)value;
+			break;
+		case 'T':
+			{
+				bool negate = (p != pEnd && *p == '-');
+				if (negate)
+					p++;
+				if (!ParseHexNumber(&p, pEnd, &value))
+					return false;
+				pRequest->ThreadID = negate ? -(int)value : (int)value;
+			}
+			break;
+		case 'C':
+			if (p == pEnd)
+				return false;
+			pRequest->Char = *p++;
+			break;
+		case 'S':
+			{
+				//A trailing 'S' takes the rest of the arguments
+				char terminator = pField[1];
+				const char *pStart = p;
+				while (p != pEnd && (!terminator || *p != terminator))
+					p++;
+
+				ASSERT(stringIndex < GDBRequest::kMaxStringFields);
+				pRequest->pStrings[stringIndex] = pStart;
+				pRequest->StringLengths[stringIndex++] = p - pStart;
+			}
+			break;
+		case '*':
+			pRequest->pPayload = p;
+			pRequest->PayloadLength = pEnd - p;
+			p = pEnd;
+			break;
+		default:
+			if (p == pEnd || *p != *pField)
+				return false;
+			p++;
+			break;
+		}
+	}
+
+	return p == pEnd;
+}
@@ -0,0 +1,202 @@
+#pragma once
+#include <bzscore/string.h>
+#include <vector>
+#include <string>
+#include "IGDBStub.h"
+
+namespace GDBServerFoundation
+{
+	//! Contains the fields of a GDB request parsed according to the grammar of its packet (see PacketTable)
+	/*! Only the fields mentioned in the grammar are set. The string fields point directly into the request. */
+	struct GDBRequest
+	{
+		enum {kMaxStringFields = 3};
+
+		//! The request type and the data following the first ',', ';' or ':' character (see IGDBStub::HandleRequest())
+		const BazisLib::TempStringA *pType, *pData;
+		char SplitterChar;
+
+		//! 'A' field
+		ULONGLONG Address;
+		//! 'L' field
+		size_t Length;
+		//! 'N' field (e.g. register index or breakpoint kind)
+		unsigned Number;
+		//! 'T' field. Can be -1 (all threads) or 0 (any thread).
+		int ThreadID;
+		//! 'C' field
+		char Char;
+
+		//! 'S' fields
+		const char *pStrings[kMaxStringFields];
+		size_t StringLengths[kMaxStringFields];
+
+		//! '*' field
+		const char *pPayload;
+		size_t PayloadLength;
+
+		BazisLib::TempStrPointerWrapperA GetString(unsigned index) const
+		{
+			return BazisLib::TempStrPointerWrapperA(pStrings[index], StringLengths[index]);
+		}
+
+		BazisLib::TempStrPointerWrapperA GetPayload() const
+		{
+			return BazisLib::TempStrPointerWrapperA(pPayload, PayloadLength);
+		}
+	};
+
+	//! Implements the packet lookup and argument parsing for PacketTable
+	class PacketTableBase
+	{
+	private:
+		struct PacketRecord
+		{
+			const char *pName;
+			size_t NameLength;
+			const char *pGrammar;
+		};
+
+		std::vector<PacketRecord> m_Packets;
+		//! Contains (packet index + 1) for each hash value, or 0 for unused values
+		std::vector<unsigned short> m_Slots;
+		unsigned m_Seed;
+		bool m_bRebuildNeeded;
+
+		std::string m_ArgumentBuffer;
+
+	private:
+		void Rebuild();
+		int Lookup(const char *pName, size_t nameLength);
+
+	protected:
+		PacketTableBase()
+			: m_Seed(0)
+			, m_bRebuildNeeded(false)
+		{
+		}
+
+		//! Adds a new packet or replaces the grammar of an existing one. Returns the packet index.
+		size_t AddPacket(const char *pName, const char *pGrammar);
+
+		enum
+		{
+			//! Returned by ParseRequest() if no packet with the given name has been registered
+			kUnknownPacket = -1,
+			//! Returned by ParseRequest() if the arguments of a registered packet do not match its grammar
+			kMalformedPacket = -2,
+		};
+
+		//! Finds the packet and parses its arguments. Returns the packet index, kUnknownPacket or kMalformedPacket.
+		int ParseRequest(const BazisLib::TempStringA &requestType, char splitterChar, const BazisLib::TempStringA &requestData, GDBRequest *pRequest);
+
+	public:
+		//! Computes the hash of a packet name. The seed is selected by Rebuild(), so that the hashes of all registered packets are unique.
+		static constexpr unsigned HashPacketName(const char *pName, size_t length, unsigned seed)
+		{
+			unsigned hash = 2166136261U ^ (seed * 0x9E3779B9U);
+			for (size_t i = 0; i < length; i++)
+				hash = (hash ^ (unsigned char)pName[i]) * 16777619U;
+			return hash ^ (hash >> 15);
+		}
+
+		//! Returns the length of the packet name within the request type
+		/*! The names of the 'q', 'Q' and 'v' packets end at the first ',', ';' or ':' character (i.e. they match the request type).
+			Other packets have single-character names followed by the arguments (e.g. 'm1000,4').
+		*/
+		static size_t GetPacketNameLength(const BazisLib::TempStringA &requestType);
+
+		//! Parses the request arguments according to the packet grammar
+		/*! The grammar consists of the following field specifiers. Any other character should be matched literally.
+			- 'A', 'L', 'N': hexadecimal GDBRequest::Address, GDBRequest::Length or GDBRequest::Number
+			- 'T': hexadecimal thread ID, optionally preceded by '-'
+			- 'C': a single character
+			- 'S': a string ending before the next literal character of the grammar
+			- '*': the rest of the arguments (can be empty)
+
+			E.g. the grammar for the 'm' packet is "A,L" and the grammar for 'qXfer' is ":S:S:S:A,L".
+			\return False if the arguments do not match the grammar
+		*/
+		static bool ParseArguments(const char *pGrammar, const char *pArguments, size_t length, GDBRequest *pRequest);
+
+		//! Checks the packet descriptors at compile time
+		template <class _Descriptor, size_t _Count> static constexpr bool ValidateDescriptors(const _Descriptor (&descriptors)[_Count])
+		{
+			for (size_t i = 0; i < _Count; i++)
+			{
+				unsigned stringFields = 0;
+				for (const char *p = descriptors[i].pGrammar; p && *p; p++)
+					if (*p == 'S')
+						stringFields++;
+				if (stringFields > GDBRequest::kMaxStringFields)
+					return false;
+
+				for (size_t j = 0; j < i; j++)
+					if (NamesEqual(descriptors[i].pName, descriptors[j].pName))
+						return false;
+			}
+			return true;
+		}
+
+	private:
+		static constexpr bool NamesEqual(const char *pFirst, const char *pSecond)
+		{
+			while (*pFirst && *pFirst == *pSecond)
+				pFirst++, pSecond++;
+			return *pFirst == *pSecond;
+		}
+	};
+
+	//! Maps the GDB packet names to the handlers via a perfect hash and parses the packet arguments once into a GDBRequest
+	/*! The packets are described by the PacketDescriptor structures (name, argument grammar and handler). The hash seed is selected
+		when the table is first used after registering new packets, so that each name maps to a distinct slot. Thus looking up a packet
+		costs one hash computation and one name comparison regardless of the amount of registered packets.
+
+		See PacketTableBase::ParseArguments() for the grammar format. A NULL grammar means that the handler parses
+		GDBRequest::pData itself.
+	*/
+	template <class _Owner> class PacketTable : public PacketTableBase
+	{
+	public:
+		typedef StubResponse (_Owner::*Handler)(const GDBRequest &request);
+
+		struct PacketDescriptor
+		{
+			const char *pName;
+			const char *pGrammar;
+			Handler pHandler;
+		};
+
+	private:
+		std::vector<Handler> m_Handlers;
+
+	public:
+		//! Adds a packet or replaces the handler of an existing one
+		void Register(const char *pName, const char *pGrammar, Handler pHandler)
+		{
+			size_t index = AddPacket(pName, pGrammar);
+			if (index == m_Handlers.size())
+				m_Handlers.push_back(pHandler);
+			else
+				m_Handlers[index] = pHandler;
+		}
+
+		template <size_t _Count> void Register(const PacketDescriptor (&descriptors)[_Count])
+		{
+			for (size_t i = 0; i < _Count; i++)
+				Register(descriptors[i].pName, descriptors[i].pGrammar, descriptors[i].pHandler);
+		}
+
+		//! Finds the handler for a request and parses its arguments. Returns NULL if the packet is unknown or malformed.
+		/*! \param pMalformed Receives true if the packet is known, but its arguments do not match the grammar. Can be NULL. */
+		Handler Find(const BazisLib::TempStringA &requestType, char splitterChar, const BazisLib::TempStringA &requestData, GDBRequest *pRequest, bool *pMalformed = NULL)
+		{
+			int index = ParseRequest(requestType, splitterChar, requestData, pRequest);
+			if (pMalformed)
+				*pMalformed = (index == kMalformedPacket);
+			if (index < 0)
+				return NULL;
+			return m_Handlers[index];
+		}
+	};
+}
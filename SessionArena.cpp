@@ -0,0 +1,79 @@
+#include "stdafx.h"
+#include "SessionArena.h"
+
+GDBServerFoundation::SessionArena::SessionArena()
+	: m_pFirstChunk(NULL)
+	, m_pCurrentChunk(NULL)
+	, m_Offset(0)
+{
+	memset(&m_Statistics, 0, sizeof(m_Statistics));
+}
+
+GDBServerFoundation::SessionArena::~SessionArena()
+{
+	while (m_pFirstChunk)
+	{
+		Chunk *pChunk = m_pFirstChunk;
+		m_pFirstChunk = pChunk->pNext;
+		free(pChunk);
+	}
+}
+
+void *GDBServerFoundation::SessionArena::AllocateFromNextChunk(size_t size, size_t alignment)
+{
+	//The Allocate() calls below count this allocation again
+	m_Statistics.ArenaAllocations--;
+
+	size_t usedBytes = GetUsedBytes();
+	Chunk *pLastChunk = m_pCurrentChunk;
+
+	//Reuse the chunks allocated while handling the previous requests first
+	for (Chunk *pChunk = m_pCurrentChunk ? m_pCurrentChunk->pNext : m_pFirstChunk; pChunk; pChunk = pChunk->pNext)
+	{
+		pLastChunk = pChunk;
+		if (size + alignment <= pChunk->Size)
+		{
+			pChunk->UsedBeforeThisChunk = usedBytes;
+			m_pCurrentChunk = pChunk;
+			m_Offset = 0;
+			return Allocate(size, alignment);
+		}
+	}
+
+	size_t chunkSize = kDefaultChunkSize;
+	if (chunkSize < size + alignment)
+		chunkSize = size + alignment;
+
+	Chunk *pChunk = (Chunk *)malloc(sizeof(Chunk) + chunkSize);
+	if (!pChunk)
+		return NULL;
+
+	m_Statistics.HeapAllocations++;
+	m_Statistics.ReservedBytes += chunkSize;
+
+	pChunk->pNext = NULL;
+	pChunk->Size = chunkSize;
+	pChunk->UsedBeforeThisChunk = usedBytes;
+
+	if (pLastChunk)
+		pLastChunk->pNext = pChunk;
+	else
+		m_pFirstChunk = pChunk;
+
+	m_pCurrentChunk = pChunk;
+	m_Offset = 0;
+	return Allocate(size, alignment);
+}
+
+void GDBServerFoundation::SessionArena::Reset()
+{
+	size_t usedBytes = GetUsedBytes();
+	if (usedBytes > m_Statistics.PeakUsage)
+		m_Statistics.PeakUsage = usedBytes;
+
+	m_Statistics.Resets++;
+	m_pCurrentChunk = m_pFirstChunk;
+	m_Offset = 0;
+	if (m_pCurrentChunk)
+		m_pCurrentChunk->UsedBeforeThisChunk = 0;
+}
@@ -0,0 +1,162 @@
+#pragma once
+#include <stddef.h>
+#include <new>
+
+namespace GDBServerFoundation
+{
+	//! Provides short-lived memory for handling a single request without using the general-purpose heap
+	/*! Each stub owns one arena (see BasicGDBStub::GetSessionArena()). The memory allocated while handling a request
+		(register sets, reply text, temporary buffers) stays valid until the reply is sent. Then the arena is reset before
+		the next request and the same memory is reused. Individual blocks are never freed.
+
+		The memory is obtained from the heap in chunks of kDefaultChunkSize bytes (or larger for large allocations).
+		The chunks are kept when the arena is reset, so once the arena has grown to the size needed by the largest request,
+		handling further requests does not allocate any heap memory. This can be checked via GetStatistics().
+
+		\remarks The arena is not thread-safe. It should only be used by the thread handling the requests of the session.
+	*/
+	class SessionArena
+	{
+	public:
+		enum
+		{
+			kDefaultChunkSize = 65536,
+			kDefaultAlignment = sizeof(void *) > 8 ? sizeof(void *) : 8,
+		};
+
+		struct Statistics
+		{
+			//! The amount of heap blocks allocated by the arena since it was created. Stays unchanged in a steady state.
+			unsigned HeapAllocations;
+			//! The amount of Allocate() calls since the arena was created
+			unsigned long long ArenaAllocations;
+			//! The amount of Reset() calls
+			unsigned long long Resets;
+			//! The total size of all chunks
+			size_t ReservedBytes;
+			//! The maximum amount of bytes used between two Reset() calls
+			size_t PeakUsage;
+		};
+
+	private:
+		struct Chunk
+		{
+			Chunk *pNext;
+			size_t Size;
+			size_t UsedBeforeThisChunk;
+			//Keeps the data following the header aligned as the heap blocks
+			size_t Reserved;
+
+			char *GetData() {return (char *)(this + 1);}
+		};
+
+		Chunk *m_pFirstChunk, *m_pCurrentChunk;
+		size_t m_Offset;
+		Statistics m_Statistics;
+
+	private:
+		SessionArena(const SessionArena &);
+		void operator=(const SessionArena &);
+
+		void *AllocateFromNextChunk(size_t size, size_t alignment);
+
+	public:
+		SessionArena();
+		~SessionArena();
+
+		//! Allocates an uninitialized block. Returns NULL if the heap is exhausted.
+		void *Allocate(size_t size, size_t alignment = kDefaultAlignment)
+		{
+			m_Statistics.ArenaAllocations++;
+			if (m_pCurrentChunk)
+			{
+				size_t offset = (m_Offset + alignment - 1) & ~(alignment - 1);
+				if (offset + size <= m_pCurrentChunk->Size)
+				{
+					m_Offset = offset + size;
+					return m_pCurrentChunk->GetData() + offset;
+				}
+			}
+			return AllocateFromNextChunk(size, alignment);
+		}
+
+		//! Allocates an uninitialized array of objects with trivial constructors and destructors
+		template <class _Type> _Type *AllocateArray(size_t count)
+		{
+			return (_Type *)Allocate(count * sizeof(_Type), __alignof(_Type) > kDefaultAlignment ? __alignof(_Type) : kDefaultAlignment);
+		}
+
+		//! Makes all memory allocated from the arena available again. The previously allocated blocks should no longer be used.
+		void Reset();
+
+		//! Returns the amount of bytes allocated since the last Reset() call
+		size_t GetUsedBytes() const
+		{
+			return m_pCurrentChunk ? m_pCurrentChunk->UsedBeforeThisChunk + m_Offset : 0;
+		}
+
+		const Statistics &GetStatistics() const {return m_Statistics;}
+	};
+
+	//! Allows using SessionArena with STL containers
+	/*! The containers using this allocator should be destroyed before the arena is reset (e.g. they should be local variables of the
+		request handler). An allocator created without an arena uses the heap.
+		\code
+		std::map<unsigned, DebugThreadMode, std::less<unsigned>, ArenaAllocator<std::pair<const unsigned, DebugThreadMode>>> threadMap(GetSessionArena());
+		\endcode
+	*/
+	template <class _Type> class ArenaAllocator
+	{
+	private:
+		template <class _Other> friend class ArenaAllocator;
+		SessionArena *m_pArena;
+
+	public:
+		typedef _Type value_type;
+
+		ArenaAllocator(SessionArena *pArena = NULL)
+			: m_pArena(pArena)
+		{
+		}
+
+		template <class _Other> ArenaAllocator(const ArenaAllocator<_Other> &anotherAllocator)
+			: m_pArena(anotherAllocator.m_pArena)
+		{
+		}
+
+		template <class _Other> struct rebind
+		{
+			typedef ArenaAllocator<_Other> other;
+		};
+
+		_Type *allocate(size_t count)
+		{
+			void *p;
+			if (m_pArena)
+				p = m_pArena->Allocate(count * sizeof(_Type), __alignof(_Type) > SessionArena::kDefaultAlignment ? __alignof(_Type) : SessionArena::kDefaultAlignment);
+			else
+				p = ::operator new(count * sizeof(_Type), std::nothrow);
+
+			if (!p)
+				throw std::bad_alloc();
+			return (_Type *)p;
+		}
+
+		void deallocate(_Type *p, size_t count)
+		{
+			//The arena memory is released by SessionArena::Reset()
+			if (!m_pArena)
+				::operator delete(p);
+		}
+
+		template <class _Other> bool operator==(const ArenaAllocator<_Other> &anotherAllocator) const
+		{
+			return m_pArena == anotherAllocator.m_pArena;
+		}
+
+		template <class _Other> bool operator!=(const ArenaAllocator<_Other> &anotherAllocator) const
+		{
+			return m_pArena != anotherAllocator.m_pArena;
+		}
+	};
+}
@@ -0,0 +1,44 @@
+#include "stdafx.h"
+#include "StackPrefetcher.h"
+
+size_t GDBServerFoundation::StackPrefetcher::AddWindow(int registerIndex, unsigned bytesBelow, unsigned bytesAbove)
+{
+	Window window;
+	memset(&window, 0, sizeof(window));
+	window.RegisterIndex = registerIndex;
+	window.BytesBelow = bytesBelow;
+	window.BytesAbove = bytesAbove;
+
+	m_Windows.push_back(window);
+	return m_Windows.size() - 1;
+}
+
+void GDBServerFoundation::StackPrefetcher::CountHits(ULONGLONG addr, size_t size)
+{
+	ULONGLONG end = addr + size;
+	for (size_t i = 0; i < m_Windows.size(); i++)
+	{
+		Window &window = m_Windows[i];
+		if (!window.Active || addr >= window.End || end <= window.Start)
+			continue;
+
+		window.HitsThisStop++;
+		if (addr >= window.Start && end <= window.End)
+			window.Stats.Hits++;
+		else
+			window.Stats.PartialHits++;
+	}
+}
+
+void GDBServerFoundation::StackPrefetcher::OnTargetResumed()
+{
+	for (size_t i = 0; i < m_Windows.size(); i++)
+	{
+		Window &window = m_Windows[i];
+		if (window.Active && !window.HitsThisStop)
+			window.Stats.UnusedPrefetches++;
+		window.Active = false;
+	}
+
+	m_bPrefetchDone = false;
+}
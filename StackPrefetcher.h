@@ -0,0 +1,134 @@
+#pragma once
+#include "TargetMemoryCache.h"
+#include <vector>
+#include <algorithm>
+
+namespace GDBServerFoundation
+{
+	//! Reads the memory around the stack and frame pointers into the memory cache when the target stops
+	/*! After each stop GDB unwinds the stack by sending many small 'm' requests for the memory just above the stack and frame pointers.
+		StackPrefetcher reads a window around each configured register with a single target call (overlapping windows are merged)
+		and stores it in TargetMemoryCache, so that those requests are handled without reaching the target.
+
+		The register values are taken from IStoppedGDBTarget::ReadFrameRelatedRegisters() when the stop reply is built, so the target
+		should report the stack and frame pointers there. The prefetched memory is only used if the memory cache is enabled.
+		\code
+			pStub->GetMemoryCache().Enable();
+			pStub->GetStackPrefetcher().AddWindow(i386::rgESP, 0, 1024);
+			pStub->GetStackPrefetcher().AddWindow(i386::rgEBP, 0, 256);
+		\endcode
+		The statistics of each window (see GetStatistics()) show whether its size should be changed: many partial hits mean that
+		GDB reads past the window, while many unused prefetches mean that the window is too large or not useful.
+	*/
+	class StackPrefetcher
+	{
+	public:
+		struct Statistics
+		{
+			//! The amount of stops when the window was read (i.e. at least one page of it was read into the cache)
+			unsigned long long Prefetches;
+			//! The amount of 'm' requests completely inside the window
+			unsigned long long Hits;
+			//! The amount of 'm' requests crossing the window boundary
+			unsigned long long PartialHits;
+			//! The amount of stops after which no 'm' request has hit the window
+			unsigned long long UnusedPrefetches;
+		};
+
+	private:
+		struct Window
+		{
+			int RegisterIndex;
+			unsigned BytesBelow, BytesAbove;
+
+			//! The range covered during the current stop. Empty if the register was not provided.
+			ULONGLONG Start, End;
+			//! Set if the range was read into the cache during the current stop
+			bool Active;
+			unsigned HitsThisStop;
+
+			Statistics Stats;
+		};
+
+		std::vector<Window> m_Windows;
+		std::vector<std::pair<ULONGLONG, ULONGLONG> > m_Ranges;
+		bool m_bPrefetchDone;
+
+	private:
+		void CountHits(ULONGLONG addr, size_t size);
+
+	public:
+		StackPrefetcher()
+			: m_bPrefetchDone(false)
+		{
+		}
+
+		//! Adds a window covering the specified amount of bytes below and above the address stored in a register. Returns the window index.
+		size_t AddWindow(int registerIndex, unsigned bytesBelow, unsigned bytesAbove);
+		void ClearWindows() {m_Windows.clear();}
+
+		size_t GetWindowCount() const {return m_Windows.size();}
+		const Statistics &GetStatistics(size_t windowIndex) const {return m_Windows[windowIndex].Stats;}
+
+		//! Reads the windows once per stop. The windows referring to the registers not provided in the register set are skipped.
+		template <class _Target> void Prefetch(_Target &target, TargetMemoryCache &cache, const RegisterSetContainer &registers);
+
+		//! Updates the window statistics. Should be called for each 'm' request.
+		void OnMemoryRead(ULONGLONG addr, size_t size)
+		{
+			if (m_bPrefetchDone)
+				CountHits(addr, size);
+		}
+
+		//! Updates the statistics of the unused windows and allows the next prefetch
+		void OnTargetResumed();
+	};
+
+	template <class _Target> void StackPrefetcher::Prefetch(_Target &target, TargetMemoryCache &cache, const RegisterSetContainer &registers)
+	{
+		if (m_bPrefetchDone || m_Windows.empty())
+			return;
+		m_bPrefetchDone = true;
+
+		m_Ranges.clear();
+		for (size_t i = 0; i < m_Windows.size(); i++)
+		{
+			Window &window = m_Windows[i];
+			window.Start = window.End = 0;
+			window.Active = false;
+			window.HitsThisStop = 0;
+			if (window.RegisterIndex < 0 || (size_t)window.RegisterIndex >= registers.RegisterCount() || !registers[window.RegisterIndex].Valid)
+				continue;
+
+			ULONGLONG value = registers[window.RegisterIndex].ToUInt64();
+			window.Start = (value > window.BytesBelow) ? value - window.BytesBelow : 0;
+			window.End = value + window.BytesAbove;
+			if (window.End > window.Start)
+				m_Ranges.push_back(std::make_pair(window.Start, window.End));
+		}
+
+		//The stack and frame pointer windows normally overlap, so they are merged to read them at once
+		std::sort(m_Ranges.begin(), m_Ranges.end());
+		for (size_t i = 0; i < m_Ranges.size();)
+		{
+			ULONGLONG start = m_Ranges[i].first, end = m_Ranges[i].second;
+			for (i++; i < m_Ranges.size() && m_Ranges[i].first <= end + cache.GetPageSize(); i++)
+				if (m_Ranges[i].second > end)
+					end = m_Ranges[i].second;
+
+			if (!cache.Prefetch(target, start, (size_t)(end - start)))
+				continue;
+
+			//Only the windows whose memory was actually read are counted
+			for (size_t j = 0; j < m_Windows.size(); j++)
+			{
+				Window &window = m_Windows[j];
+				if (window.End > window.Start && window.Start >= start && window.End <= end && !window.Active)
+				{
+					window.Active = true;
+					window.Stats.Prefetches++;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,171 @@
+#include "stdafx.h"
+#include "TargetMemoryCache.h"
+
+GDBServerFoundation::TargetMemoryCache::TargetMemoryCache()
+	: m_bEnabled(false)
+	, m_PageSize(kDefaultPageSize)
+	, m_MaxPages(kDefaultMaxCachedBytes / kDefaultPageSize)
+	, m_PersistentPageCount(0)
+	, m_UnusedPageOffset(0)
+{
+	memset(&m_Statistics, 0, sizeof(m_Statistics));
+}
+
+void GDBServerFoundation::TargetMemoryCache::Configure(size_t pageSize, size_t maxCachedBytes)
+{
+	ASSERT(pageSize && !(pageSize & (pageSize - 1)));
+	InvalidateAll();
+
+	m_PageSize = pageSize;
+	m_MaxPages = maxCachedBytes / pageSize;
+	m_PageData.clear();
+}
+
+void GDBServerFoundation::TargetMemoryCache::AddUncachedRegion(ULONGLONG start, ULONGLONG size)
+{
+	AddressRange region = {start, start + size};
+	m_UncachedRegions.push_back(region);
+	InvalidateRange(start, (size_t)size);
+}
+
+void GDBServerFoundation::TargetMemoryCache::AddPersistentRegion(ULONGLONG start, ULONGLONG size)
+{
+	AddressRange region = {start, start + size};
+	m_PersistentRegions.push_back(region);
+}
+
+void GDBServerFoundation::TargetMemoryCache::ClearPersistentRegions()
+{
+	m_PersistentRegions.clear();
+	InvalidateAll();
+}
+
+bool GDBServerFoundation::TargetMemoryCache::IsCacheable(ULONGLONG addr, size_t size) const
+{
+	//The whole pages are read from the target, so the bytes around the requested range should not be uncached either
+	ULONGLONG start = GetPageAddress(addr), end = GetPageAddress(addr + size - 1) + m_PageSize;
+
+	for (size_t i = 0; i < m_UncachedRegions.size(); i++)
+		if (m_UncachedRegions[i].Start < end && m_UncachedRegions[i].End > start)
+			return false;
+	return true;
+}
+
+bool GDBServerFoundation::TargetMemoryCache::IsPersistent(ULONGLONG addr, size_t size) const
+{
+	ULONGLONG start = GetPageAddress(addr), end = GetPageAddress(addr + size - 1) + m_PageSize;
+
+	for (size_t i = 0; i < m_PersistentRegions.size(); i++)
+		if (m_PersistentRegions[i].Start <= start && m_PersistentRegions[i].End >= end)
+			return IsCacheable(addr, size);
+	return false;
+}
+
+unsigned char *GDBServerFoundation::TargetMemoryCache::AllocatePage(ULONGLONG pageAddr)
+{
+	size_t offset;
+	if (!m_FreePageOffsets.empty())
+	{
+		offset = m_FreePageOffsets.back();
+		m_FreePageOffsets.pop_back();
+	}
+	else
+	{
+		if (m_UnusedPageOffset >= m_MaxPages * m_PageSize)
+			return NULL;
+
+		//The page storage is only allocated once the cache is actually used
+		if (m_PageData.empty())
+			m_PageData.resize(m_MaxPages * m_PageSize);
+
+		offset = m_UnusedPageOffset;
+		m_UnusedPageOffset += m_PageSize;
+	}
+
+	CachedPage &page = m_Pages[pageAddr];
+	page.Offset = offset;
+	page.Persistent = IsPersistent(pageAddr, m_PageSize);
+	if (page.Persistent)
+		m_PersistentPageCount++;
+
+	return &m_PageData[offset];
+}
+
+void GDBServerFoundation::TargetMemoryCache::FreePage(std::map<ULONGLONG, CachedPage>::iterator it)
+{
+	if (it->second.Persistent)
+		m_PersistentPageCount--;
+	m_FreePageOffsets.push_back(it->second.Offset);
+	m_Pages.erase(it);
+}
+
+size_t GDBServerFoundation::TargetMemoryCache::EvictPersistentPages(size_t pageCount)
+{
+	size_t evicted = 0;
+	for (std::map<ULONGLONG, CachedPage>::iterator it = m_Pages.begin(); it != m_Pages.end() && evicted < pageCount;)
+	{
+		if (!it->second.Persistent)
+			++it;
+		else
+		{
+			FreePage(it++);
+			evicted++;
+		}
+	}
+
+	m_Statistics.Evictions += evicted;
+	return evicted;
+}
+
+void GDBServerFoundation::TargetMemoryCache::Invalidate()
+{
+	if (!m_PersistentPageCount)
+	{
+		InvalidateAll();
+		return;
+	}
+
+	m_Statistics.Invalidations++;
+	for (std::map<ULONGLONG, CachedPage>::iterator it = m_Pages.begin(); it != m_Pages.end();)
+	{
+		if (it->second.Persistent)
+			++it;
+		else
+			FreePage(it++);
+	}
+}
+
+void GDBServerFoundation::TargetMemoryCache::InvalidateAll()
+{
+	m_Statistics.Invalidations++;
+	m_Pages.clear();
+	m_PersistentPageCount = 0;
+	m_FreePageOffsets.clear();
+	m_UnusedPageOffset = 0;
+}
+
+void GDBServerFoundation::TargetMemoryCache::InvalidateRange(ULONGLONG addr, size_t size)
+{
+	if (!size || m_Pages.empty())
+		return;
+
+	std::map<ULONGLONG, CachedPage>::iterator it = m_Pages.lower_bound(GetPageAddress(addr));
+	while (it != m_Pages.end() && it->first <= addr + size - 1)
+		FreePage(it++);
+}
+
+void GDBServerFoundation::TargetMemoryCache::UpdateRange(ULONGLONG addr, const void *pData, size_t size)
+{
+	if (!size || m_Pages.empty())
+		return;
+
+	const unsigned char *pIn = (const unsigned char *)pData;
+	std::map<ULONGLONG, CachedPage>::iterator it = m_Pages.lower_bound(GetPageAddress(addr));
+	for (; it != m_Pages.end() && it->first <= addr + size - 1; ++it)
+	{
+		//Copy the part of the written range that overlaps this page
+		ULONGLONG start = it->first > addr ? it->first : addr;
+		ULONGLONG end = it->first + m_PageSize < addr + size ? it->first + m_PageSize : addr + size;
+		memcpy(&m_PageData[it->second.Offset + (size_t)(start - it->first)], pIn + (size_t)(start - addr), (size_t)(end - start));
+	}
+}
@@ -0,0 +1,256 @@
+#pragma once
+#include "IGDBTarget.h"
+#include <vector>
+#include <map>
+
+namespace GDBServerFoundation
+{
+	//! Keeps the target memory read while the target is stopped, so that repeated 'm' requests do not reach the target
+	/*! GDB reads the same stack and data bytes many times after each stop. The cache stores the memory in aligned pages of
+		GetPageSize() bytes. When a page is missing, the whole page (and any missing pages following it within the same request)
+		is read from the target with a single call. The cache should be invalidated whenever the target runs (see GDBStub::ResetAllCachesWhenResumingTarget()).
+
+		The cache is disabled by default, as the memory-mapped registers (e.g. on embedded targets) can change or have side
+		effects when being read. Such regions should be excluded via AddUncachedRegion() before enabling the cache.
+
+		The regions that cannot change while the target is running (ROM and FLASH) can be registered via AddPersistentRegion().
+		They are cached even if the cache is disabled and are only discarded when written (see InvalidateRange()) or by InvalidateAll().
+		If the cache is full, the persistent pages are discarded to make room for the other pages, so that reading a large FLASH
+		region does not prevent caching the stack and data pages.
+		\remarks If a page cannot be read completely (e.g. it spans an unmapped address), the request is passed to the target
+				 without caching, so the target reports the partial reads exactly as without the cache.
+	*/
+	class TargetMemoryCache
+	{
+	public:
+		enum
+		{
+			kDefaultPageSize = 256,
+			kDefaultMaxCachedBytes = 1024 * 1024,
+		};
+
+		struct Statistics
+		{
+			//! The amount of pages copied from the cache
+			unsigned long long Hits;
+			//! The amount of pages read from the target and stored in the cache
+			unsigned long long Misses;
+			//! The amount of reads passed to the target without using the cache (uncached regions, unreadable pages or a full cache)
+			unsigned long long UncachedReads;
+			//! The amount of Invalidate() and InvalidateAll() calls
+			unsigned long long Invalidations;
+			//! The amount of persistent pages discarded to make room for the non-persistent ones
+			unsigned long long Evictions;
+		};
+
+	private:
+		struct AddressRange
+		{
+			ULONGLONG Start, End;
+		};
+
+		struct CachedPage
+		{
+			//! The offset of the page in m_PageData
+			size_t Offset;
+			//! The page is within a persistent region and is kept by Invalidate()
+			bool Persistent;
+		};
+
+		bool m_bEnabled;
+		size_t m_PageSize, m_MaxPages;
+
+		std::map<ULONGLONG, CachedPage> m_Pages;
+		size_t m_PersistentPageCount;
+		std::vector<unsigned char> m_PageData;
+		//! The offsets of the pages discarded by InvalidateRange(). The pages at or above m_UnusedPageOffset have never been used since the last Invalidate().
+		std::vector<size_t> m_FreePageOffsets;
+		size_t m_UnusedPageOffset;
+
+		std::vector<AddressRange> m_UncachedRegions, m_PersistentRegions;
+		std::vector<unsigned char> m_FillBuffer;
+		Statistics m_Statistics;
+
+	private:
+		const unsigned char *FindPage(ULONGLONG pageAddr) const
+		{
+			std::map<ULONGLONG, CachedPage>::const_iterator it = m_Pages.find(pageAddr);
+			if (it == m_Pages.end())
+				return NULL;
+			return &m_PageData[it->second.Offset];
+		}
+
+		//! Returns NULL if the cache is full
+		unsigned char *AllocatePage(ULONGLONG pageAddr);
+		void FreePage(std::map<ULONGLONG, CachedPage>::iterator it);
+		//! Discards up to the given amount of persistent pages and returns the amount of discarded pages
+		size_t EvictPersistentPages(size_t pageCount);
+
+		ULONGLONG GetPageAddress(ULONGLONG addr) const {return addr & ~(ULONGLONG)(m_PageSize - 1);}
+
+		template <class _Target> const unsigned char *FillPages(_Target &target, ULONGLONG firstPage, ULONGLONG lastPage);
+
+	public:
+		TargetMemoryCache();
+
+		void Enable(bool enable = true)
+		{
+			m_bEnabled = enable;
+			if (!enable)
+				Invalidate();
+		}
+
+		bool IsEnabled() const {return m_bEnabled;}
+
+		//! Sets the page size (should be a power of 2) and the maximum amount of cached memory. Discards the cached pages.
+		void Configure(size_t pageSize, size_t maxCachedBytes = kDefaultMaxCachedBytes);
+
+		size_t GetPageSize() const {return m_PageSize;}
+
+		//! Excludes a region (e.g. memory-mapped registers) from caching. The reads from it are always passed to the target.
+		void AddUncachedRegion(ULONGLONG start, ULONGLONG size);
+
+		//! Marks a region (e.g. ROM or FLASH) as unchanged while the target is running. Its pages are kept when the target is resumed.
+		void AddPersistentRegion(ULONGLONG start, ULONGLONG size);
+		//! Removes all regions added via AddPersistentRegion() and discards their pages
+		void ClearPersistentRegions();
+
+		//! Returns true if the pages containing the specified range can be cached
+		bool IsCacheable(ULONGLONG addr, size_t size) const;
+		//! Returns true if the pages containing the specified range are inside a persistent region
+		bool IsPersistent(ULONGLONG addr, size_t size) const;
+
+		//! Discards the cached pages except for the persistent ones. Should be called when the target is resumed.
+		void Invalidate();
+		//! Discards all cached pages, including the persistent ones
+		void InvalidateAll();
+		//! Discards the cached pages overlapping the specified range
+		void InvalidateRange(ULONGLONG addr, size_t size);
+		//! Updates the cached pages after the target memory has been successfully written (write-through)
+		void UpdateRange(ULONGLONG addr, const void *pData, size_t size);
+
+		//! Reads the target memory via the cache. Has the same semantics as IStoppedGDBTarget::ReadTargetMemory().
+		/*! _Target is either ISyncGDBTarget or StaticTargetCalls (see GDBStubT). */
+		template <class _Target> GDBStatus Read(_Target &target, ULONGLONG addr, void *pBuffer, size_t *pSizeInBytes);
+
+		//! Reads the pages containing the specified range that are not cached yet with one target call per run of missing pages
+		/*! Returns the amount of pages read from the target, i.e. 0 if the range cannot be cached, is already cached or could not be read.
+			The partially read ranges are cached up to the first unreadable page. */
+		template <class _Target> size_t Prefetch(_Target &target, ULONGLONG addr, size_t size);
+
+		const Statistics &GetStatistics() const {return m_Statistics;}
+	};
+
+	template <class _Target> const unsigned char *TargetMemoryCache::FillPages(_Target &target, ULONGLONG firstPage, ULONGLONG lastPage)
+	{
+		//Read the consecutive missing pages with one target call
+		size_t pageCount = 1;
+		while (firstPage + pageCount * m_PageSize <= lastPage && !FindPage(firstPage + pageCount * m_PageSize))
+			pageCount++;
+
+		size_t freePages = m_MaxPages - m_Pages.size();
+		if (freePages < pageCount && m_PersistentPageCount && !IsPersistent(firstPage, m_PageSize))
+			freePages += EvictPersistentPages(pageCount - freePages);
+
+		if (!freePages)
+			return NULL;
+		if (pageCount > freePages)
+			pageCount = freePages;
+
+		size_t size = pageCount * m_PageSize, done = size;
+		if (m_FillBuffer.size() < size)
+			m_FillBuffer.resize(size);
+
+		if (target.ReadTargetMemory(firstPage, &m_FillBuffer[0], &done) != kGDBSuccess)
+			return NULL;
+
+		if (done > size)
+			done = size;
+
+		//Only the completely read pages are stored
+		pageCount = done / m_PageSize;
+		for (size_t i = 0; i < pageCount; i++)
+		{
+			unsigned char *pPage = AllocatePage(firstPage + i * m_PageSize);
+			if (!pPage)
+				break;
+			memcpy(pPage, &m_FillBuffer[i * m_PageSize], m_PageSize);
+			m_Statistics.Misses++;
+		}
+
+		return FindPage(firstPage);
+	}
+
+	template <class _Target> GDBStatus TargetMemoryCache::Read(_Target &target, ULONGLONG addr, void *pBuffer, size_t *pSizeInBytes)
+	{
+		size_t size = *pSizeInBytes;
+		bool cacheable = size && (m_bEnabled ? IsCacheable(addr, size) : IsPersistent(addr, size));
+		if (!cacheable)
+		{
+			m_Statistics.UncachedReads++;
+			return target.ReadTargetMemory(addr, pBuffer, pSizeInBytes);
+		}
+
+		unsigned char *pOut = (unsigned char *)pBuffer;
+		ULONGLONG lastPage = GetPageAddress(addr + size - 1);
+		size_t done = 0;
+
+		while (done < size)
+		{
+			ULONGLONG pageAddr = GetPageAddress(addr + done);
+			size_t offsetInPage = (size_t)(addr + done - pageAddr);
+			size_t todo = m_PageSize - offsetInPage;
+			if (todo > size - done)
+				todo = size - done;
+
+			const unsigned char *pPage = FindPage(pageAddr);
+			if (pPage)
+				m_Statistics.Hits++;
+			else
+				pPage = FillPages(target, pageAddr, lastPage);
+
+			if (!pPage)
+			{
+				//The page cannot be cached, so the rest of the request is passed to the target
+				m_Statistics.UncachedReads++;
+				size_t remaining = size - done;
+				GDBStatus status = target.ReadTargetMemory(addr + done, pOut + done, &remaining);
+				if (status != kGDBSuccess)
+				{
+					if (!done)
+						return status;
+					remaining = 0;	//Report the bytes copied from the cache as a partial read
+				}
+
+				*pSizeInBytes = done + remaining;
+				return kGDBSuccess;
+			}
+
+			memcpy(pOut + done, pPage + offsetInPage, todo);
+			done += todo;
+		}
+
+		return kGDBSuccess;
+	}
+
+	template <class _Target> size_t TargetMemoryCache::Prefetch(_Target &target, ULONGLONG addr, size_t size)
+	{
+		bool cacheable = size && (m_bEnabled ? IsCacheable(addr, size) : IsPersistent(addr, size));
+		if (!cacheable)
+			return 0;
+
+		//Each page stored by FillPages() is counted as a miss
+		unsigned long long missesBefore = m_Statistics.Misses;
+		ULONGLONG lastPage = GetPageAddress(addr + size - 1);
+		for (ULONGLONG pageAddr = GetPageAddress(addr); ; pageAddr += m_PageSize)
+		{
+			//FillPages() reads the whole run of missing pages starting at pageAddr, so the next iterations skip it
+			if (!FindPage(pageAddr) && !FillPages(target, pageAddr, lastPage))
+				break;
+			if (pageAddr == lastPage)
+				break;
+		}
+
+		return (size_t)(m_Statistics.Misses - missesBefore);
+	}
+}
@@ -27,31 +27,29 @@ namespace GDBServerFoundation
 			rgGS,
 		};
 
-		static RegisterEntry _RawRegisterList[] = {
+		static constexpr RegisterEntry _RawRegisterList[] = {
 			{rgEAX, "eax", 32},
 			{rgECX, "ecx", 32},
 			{rgEDX, "edx", 32},
 			{rgEBX, "ebx", 32},
-			{rgESP, "esp", 32},
-			{rgEBP, "ebp", 32},
+			{rgESP, "esp", 32, rfExpedited},
+			{rgEBP, "ebp", 32, rfExpedited},
 			{rgESI, "esi", 32},
 			{rgEDI, "edi", 32},
 
-			{rgEIP, "eip", 32},
+			{rgEIP, "eip", 32, rfExpedited},
 			{rgEFLAGS, "eflags", 32},
 			{rgCS, "cs", 32},
-			{rgCS, "ss", 32},
-			{rgCS, "ds", 32},
-			{rgCS, "es", 32},
-			{rgCS, "fs", 32},
-			{rgCS, "gs", 32},
+			{rgSS, "ss", 32},
+			{rgDS, "ds", 32},
+			{rgES, "es", 32},
+			{rgFS, "fs", 32},
+			{rgGS, "gs", 32},
 		};
 
-		static PlatformRegisterList RegisterList = 
-		{
-			sizeof(_RawRegisterList) / sizeof(_RawRegisterList[0]),
-			_RawRegisterList,
-		};
+		//The layout of the 'g' reply is computed at compile time
+		static constexpr StaticRegisterList<sizeof(_RawRegisterList) / sizeof(_RawRegisterList[0])> _RegisterLayout(_RawRegisterList);
+		static constexpr PlatformRegisterList RegisterList = _RegisterLayout.GetList();
 
 	}
 }
\ No newline at end of file
@@ -0,0 +1,583 @@
+/*
+	Compares the request handling throughput of GDBStub and GDBStubT.
+
+	The benchmark uses a trivial in-process target (a memory buffer and a set of i386 registers) and feeds packets directly
+	to the stub via PacketCodec::DispatchPacket(), so the results only include the protocol handling and the target calls,
+	but not the network overhead. It measures 3 scenarios:
+		* Single-stepping: 's' followed by reading the stop reply (as GDB does when executing 'stepi')
+		* Reading memory: 'm' packets of different sizes (as GDB does when displaying memory or walking the stack)
+		* Connection setup: creating a stub and handling the packets GDB sends before showing the first prompt. This is measured
+		  both for a target reporting its capabilities (see IStoppedGDBTarget::GetCapabilities()) and for a target that does not,
+		  and with the startup replies precomputed when the connection is accepted (see GDBStub::EnableStartupSnapshot()).
+		* Break-in latency (Linux only): the time between sending 0x03 while the target is running and the
+		  ISyncGDBTarget::SendBreakInRequestAsync() call. The session runs over a Unix socket pair via GDBServer::HandleConnection(),
+		  both with the poll()-based detector (PollBreakInDetector) and with the BreakInSocket worker thread.
+
+	Usage:
+		StubBenchmark [iterations]
+*/
+
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <new>
+#include "../../GDBStubT.h"
+#include "../../GDBPacketCodec.h"
+#include "../../GDBServer.h"
+#include "../SimpleWin32Server/registers-i386.h"
+
+using namespace GDBServerFoundation;
+
+//The heap allocations are counted by replacing the global operator new (and malloc() on glibc), so that the steady-state
+//request handling can be checked for any heap use, not only for the SessionArena chunks (see BasicGDBStub::GetSessionArenaStatistics())
+static bool s_bCountAllocations;
+static unsigned long long s_AllocationCount;
+
+static inline void CountAllocation()
+{
+	if (s_bCountAllocations)
+		s_AllocationCount++;
+}
+
+#ifdef __GLIBC__
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *p, size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+	CountAllocation();
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+	CountAllocation();
+	return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *p, size_t size)
+{
+	CountAllocation();
+	return __libc_realloc(p, size);
+}
+
+#define UncountedMalloc __libc_malloc
+#else
+#define UncountedMalloc malloc
+#endif
+
+void *operator new(size_t size)
+{
+	CountAllocation();
+	void *p = UncountedMalloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	free(p);
+}
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <unistd.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//! Makes ISyncGDBTarget::ResumeAndWait() block until a break-in request arrives and records when it has arrived
+class BreakInLatencyProbe
+{
+private:
+	std::mutex m_Lock;
+	std::condition_variable m_StateChanged;
+	bool m_bRunning, m_bBreakInRequested;
+	std::chrono::high_resolution_clock::time_point m_BreakInTime;
+
+public:
+	BreakInLatencyProbe()
+		: m_bRunning(false)
+		, m_bBreakInRequested(false)
+	{
+	}
+
+	//! Called by the target instead of running
+	void WaitForBreakIn()
+	{
+		std::unique_lock<std::mutex> lck(m_Lock);
+		m_bRunning = true;
+		m_StateChanged.notify_all();
+		while (!m_bBreakInRequested)
+			m_StateChanged.wait(lck);
+		m_bBreakInRequested = m_bRunning = false;
+	}
+
+	void OnBreakInRequest()
+	{
+		std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+		std::lock_guard<std::mutex> lck(m_Lock);
+		if (!m_bRunning || m_bBreakInRequested)
+			return;
+		m_BreakInTime = now;
+		m_bBreakInRequested = true;
+		m_StateChanged.notify_all();
+	}
+
+	//! Waits until the target is blocked in ResumeAndWait()
+	void WaitUntilRunning()
+	{
+		std::unique_lock<std::mutex> lck(m_Lock);
+		while (!m_bRunning)
+			m_StateChanged.wait(lck);
+	}
+
+	std::chrono::high_resolution_clock::time_point GetBreakInTime()
+	{
+		std::lock_guard<std::mutex> lck(m_Lock);
+		return m_BreakInTime;
+	}
+};
+#endif
+
+//! A simulator-like target that keeps the memory and registers in the process memory
+class SimulatorTarget final : public MinimalTargetBase
+{
+private:
+	enum
+	{
+		kMemorySize = 65536,
+		//Simulates a large process, where enumerating the libraries takes noticeable time
+		kLibraryCount = 256,
+	};
+
+	unsigned char m_Memory[kMemorySize];
+	unsigned m_Registers[16];
+	bool m_bReportCapabilities;
+#ifdef __linux__
+	BreakInLatencyProbe *m_pProbe;
+#endif
+
+public:
+	SimulatorTarget(bool reportCapabilities = true)
+		: m_bReportCapabilities(reportCapabilities)
+#ifdef __linux__
+		, m_pProbe(NULL)
+#endif
+	{
+		for (size_t i = 0; i < sizeof(m_Memory); i++)
+			m_Memory[i] = (unsigned char)i;
+		memset(m_Registers, 0, sizeof(m_Registers));
+	}
+
+	virtual unsigned GetCapabilities()
+	{
+		if (!m_bReportCapabilities)
+			return 0;
+		return tcCapabilitiesKnown | tcDynamicLibraryList | tcThreadList;
+	}
+
+	virtual GDBStatus GetDynamicLibraryList(std::vector<DynamicLibraryRecord> &libraries)
+	{
+		char szPath[64];
+		for (unsigned i = 0; i < kLibraryCount; i++)
+		{
+			DynamicLibraryRecord rec;
+			snprintf(szPath, sizeof(szPath), "/usr/lib/libsimulated%u.so", i);
+			rec.FullPath = szPath;
+			rec.LoadAddress = 0x10000000ULL + i * 0x100000ULL;
+			libraries.push_back(rec);
+		}
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus GetThreadList(std::vector<ThreadRecord> &threads)
+	{
+		ThreadRecord rec;
+		rec.ThreadID = 1;
+		rec.UserFriendlyName = "main";
+		threads.push_back(rec);
+		return kGDBSuccess;
+	}
+
+	virtual const PlatformRegisterList *GetRegisterList()
+	{
+		return &i386::RegisterList;
+	}
+
+	virtual GDBStatus ReadFrameRelatedRegisters(int threadID, RegisterSetContainer &registers)
+	{
+		registers[i386::rgEBP] = RegisterValue(m_Registers[i386::rgEBP], 4);
+		registers[i386::rgESP] = RegisterValue(m_Registers[i386::rgESP], 4);
+		registers[i386::rgEIP] = RegisterValue(m_Registers[i386::rgEIP], 4);
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus ReadTargetRegisters(int threadID, RegisterSetContainer &registers)
+	{
+		for (size_t i = 0; i < __countof(m_Registers); i++)
+			registers[i] = RegisterValue(m_Registers[i], 4);
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus WriteTargetRegisters(int threadID, const RegisterSetContainer &registers)
+	{
+		for (size_t i = 0; i < __countof(m_Registers); i++)
+			if (registers[i].Valid)
+				m_Registers[i] = registers[i].ToUInt32();
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus ReadTargetMemory(ULONGLONG Address, void *pBuffer, size_t *pSizeInBytes)
+	{
+		if (Address >= kMemorySize)
+			return kGDBUnknownError;
+		if (*pSizeInBytes > kMemorySize - Address)
+			*pSizeInBytes = (size_t)(kMemorySize - Address);
+		memcpy(pBuffer, m_Memory + Address, *pSizeInBytes);
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus WriteTargetMemory(ULONGLONG Address, const void *pBuffer, size_t sizeInBytes)
+	{
+		if (Address >= kMemorySize || sizeInBytes > kMemorySize - Address)
+			return kGDBUnknownError;
+		memcpy(m_Memory + Address, pBuffer, sizeInBytes);
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus GetLastStopRecord(TargetStopRecord *pRec)
+	{
+		pRec->Reason = kSignalReceived;
+		pRec->ThreadID = 1;
+		pRec->Extension.SignalNumber = SIGTRAP;
+		return kGDBSuccess;
+	}
+
+#ifdef __linux__
+	//! Makes ResumeAndWait() block until a break-in request is received
+	void SetBreakInProbe(BreakInLatencyProbe *pProbe)
+	{
+		m_pProbe = pProbe;
+	}
+#endif
+
+	virtual GDBStatus ResumeAndWait(int threadID)
+	{
+#ifdef __linux__
+		if (m_pProbe)
+			m_pProbe->WaitForBreakIn();
+#endif
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus Step(int threadID)
+	{
+		m_Registers[i386::rgEIP]++;
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus SendBreakInRequestAsync()
+	{
+#ifdef __linux__
+		if (m_pProbe)
+			m_pProbe->OnBreakInRequest();
+#endif
+		return kGDBSuccess;
+	}
+};
+
+//! Sends the same packet to the stub the specified amount of times and returns the amount of packets handled per second
+static double MeasurePacketRate(IGDBStub *pStub, const char *pPacket, unsigned iterations, size_t *pTotalReplySize)
+{
+	bool ackEnabled = false;
+	size_t packetLength = strlen(pPacket), totalReplySize = 0;
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (unsigned i = 0; i < iterations; i++)
+	{
+		StubResponse response = PacketCodec::DispatchPacket(pStub, pPacket, packetLength, &ackEnabled);
+		totalReplySize += response.GetSize();
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	*pTotalReplySize = totalReplySize;
+	return elapsed.count() ? iterations / elapsed.count() : 0;
+}
+
+static void CompareStubs(const char *pDescription, const char *pPacket, unsigned iterations)
+{
+	GDBStub virtualStub(new SimulatorTarget());
+	GDBStubT<SimulatorTarget> staticStub(new SimulatorTarget());
+	size_t virtualReplySize, staticReplySize;
+
+	//Let the session arenas reach their steady-state size before measuring
+	MeasurePacketRate(&virtualStub, pPacket, iterations / 10 + 1, &virtualReplySize);
+	MeasurePacketRate(&staticStub, pPacket, iterations / 10 + 1, &staticReplySize);
+
+	double virtualRate = MeasurePacketRate(&virtualStub, pPacket, iterations, &virtualReplySize);
+	double staticRate = MeasurePacketRate(&staticStub, pPacket, iterations, &staticReplySize);
+
+	if (virtualReplySize != staticReplySize)
+		printf("%-24s reply size mismatch!\n", pDescription);
+
+	printf("%-24s %12.0f %12.0f %8.2fx\n", pDescription, virtualRate, staticRate, virtualRate ? staticRate / virtualRate : 0);
+}
+
+//! Creates a stub and passes it the packets sent by GDB when it connects. Returns the amount of connections per second.
+template <class _Stub> static double MeasureConnectionRate(bool reportCapabilities, bool useSnapshot, unsigned iterations)
+{
+	static const char *handshakePackets[] = {
+		"qSupported:multiprocess+;swbreak+;hwbreak+;qRelocInsn+;fork-events+;vfork-events+;exec-events+;vContSupported+;QThreadEvents+;no-resumed+",
+		"vMustReplyEmpty",
+		"QStartNoAckMode",
+		"Hg0",
+		"qXfer:features:read:target.xml:0,ffb",
+		"qTStatus",
+		"?",
+		"qfThreadInfo",
+		"qsThreadInfo",
+		"qAttached",
+		"Hc-1",
+		"qC",
+		"qOffsets",
+		"g",
+		"qXfer:libraries:read::0,ffb",
+		"qSymbol::",
+	};
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (unsigned i = 0; i < iterations; i++)
+	{
+		_Stub stub(new SimulatorTarget(reportCapabilities));
+		bool ackEnabled = true;
+		if (useSnapshot)
+		{
+			stub.EnableStartupSnapshot();
+			stub.OnConnectionAccepted();
+		}
+		for (size_t j = 0; j < __countof(handshakePackets); j++)
+			PacketCodec::DispatchPacket(&stub, handshakePackets[j], strlen(handshakePackets[j]), &ackEnabled);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return elapsed.count() ? iterations / elapsed.count() : 0;
+}
+
+static void CompareConnectionSetup(const char *pDescription, bool reportCapabilities, bool useSnapshot, unsigned iterations)
+{
+	double virtualRate = MeasureConnectionRate<GDBStub>(reportCapabilities, useSnapshot, iterations);
+	double staticRate = MeasureConnectionRate<GDBStubT<SimulatorTarget> >(reportCapabilities, useSnapshot, iterations);
+
+	printf("%-24s %12.0f %12.0f %8.2fx\n", pDescription, virtualRate, staticRate, virtualRate ? staticRate / virtualRate : 0);
+}
+
+//! Handles the given packets repeatedly after a warm-up and returns the amount of heap allocations they caused
+template <class _Stub> static unsigned long long CountSteadyStateAllocations(const char **packets, size_t packetCount, bool useRegisterCache, bool useSnapshot, unsigned iterations)
+{
+	_Stub stub(new SimulatorTarget());
+	bool ackEnabled = false;
+	stub.EnableRegisterCache(useRegisterCache);
+	if (useSnapshot)
+	{
+		stub.EnableStartupSnapshot();
+		stub.OnConnectionAccepted();
+	}
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		//The first pass lets the session arena and the caches reach their steady-state size
+		s_AllocationCount = 0;
+		s_bCountAllocations = (pass == 1);
+
+		for (unsigned i = 0; i < (pass ? iterations : 16); i++)
+			for (size_t j = 0; j < packetCount; j++)
+				PacketCodec::DispatchPacket(&stub, packets[j], strlen(packets[j]), &ackEnabled);
+	}
+
+	s_bCountAllocations = false;
+	return s_AllocationCount;
+}
+
+//! Prints the amount of heap allocations caused by the given packets and returns false if there were any
+static bool CheckSteadyStateAllocations(const char *pDescription, const char **packets, size_t packetCount, bool useRegisterCache, bool useSnapshot, unsigned iterations)
+{
+	unsigned long long virtualAllocations = CountSteadyStateAllocations<GDBStub>(packets, packetCount, useRegisterCache, useSnapshot, iterations);
+	unsigned long long staticAllocations = CountSteadyStateAllocations<GDBStubT<SimulatorTarget> >(packets, packetCount, useRegisterCache, useSnapshot, iterations);
+	bool passed = !virtualAllocations && !staticAllocations;
+
+	printf("%-24s %12llu %12llu %9s\n", pDescription, virtualAllocations, staticAllocations, passed ? "" : "FAILED");
+	return passed;
+}
+
+#ifdef __linux__
+
+//! A stub that does not report its blocking calls, so the server detects the break-in requests with the BreakInSocket worker thread
+class UnmonitoredGDBStub : public GDBStub
+{
+public:
+	UnmonitoredGDBStub(ISyncGDBTarget *pTarget)
+		: GDBStub(pTarget)
+	{
+	}
+
+	virtual bool SetBreakInMonitor(IBreakInMonitor *pMonitor) override
+	{
+		return false;
+	}
+};
+
+class LatencyStubFactory : public IGDBStubFactory
+{
+private:
+	BreakInLatencyProbe *m_pProbe;
+	bool m_bReportBlocking;
+
+public:
+	LatencyStubFactory(BreakInLatencyProbe *pProbe, bool reportBlocking)
+		: m_pProbe(pProbe)
+		, m_bReportBlocking(reportBlocking)
+	{
+	}
+
+	virtual IGDBStub *CreateStub(GDBServer *pServer)
+	{
+		SimulatorTarget *pTarget = new SimulatorTarget();
+		pTarget->SetBreakInProbe(m_pProbe);
+		if (m_bReportBlocking)
+			return new GDBStub(pTarget);
+		return new UnmonitoredGDBStub(pTarget);
+	}
+
+	virtual void OnProtocolError(const TCHAR *errorDescription)
+	{
+	}
+};
+
+//! Reads the data sent by the stub until the end of the next packet. Returns false if the connection has been closed.
+static bool ReceiveReplyPacket(int fd)
+{
+	char ch;
+	int checksumBytes = -1;
+	while (checksumBytes)
+	{
+		if (read(fd, &ch, 1) != 1)
+			return false;
+		if (checksumBytes > 0)
+			checksumBytes--;
+		else if (ch == '#')
+			checksumBytes = 2;
+	}
+	return true;
+}
+
+//! Resumes the target with 'c' and sends 0x03 as soon as the target blocks. Prints the time until the target receives the break-in request.
+static void MeasureBreakInLatency(const char *pDescription, bool reportBlocking, unsigned iterations)
+{
+	int sockets[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets))
+		return;
+
+	BreakInLatencyProbe probe;
+	LatencyStubFactory factory(&probe, reportBlocking);
+	GDBServer server(&factory, false);
+	FDTransport transport(sockets[0], sockets[0], false);
+	std::thread sessionThread([&]() {server.HandleConnection(&transport);});
+
+	static const char continuePacket[] = "$c#63", breakInRequest[] = {PacketCodec::kBreakInByte}, ack[] = {PacketCodec::kACK};
+	double totalLatency = 0, maxLatency = 0, minLatency = 0;
+	unsigned measured = 0;
+
+	//GDB sends a '+' when it connects and acknowledges each reply afterwards
+	for (unsigned i = 0; i < iterations && write(sockets[1], ack, sizeof(ack)) == sizeof(ack); i++)
+	{
+		if (write(sockets[1], continuePacket, sizeof(continuePacket) - 1) != sizeof(continuePacket) - 1)
+			break;
+
+		probe.WaitUntilRunning();
+		std::chrono::high_resolution_clock::time_point sent = std::chrono::high_resolution_clock::now();
+		if (write(sockets[1], breakInRequest, sizeof(breakInRequest)) != sizeof(breakInRequest))
+			break;
+
+		if (!ReceiveReplyPacket(sockets[1]))
+			break;
+
+		std::chrono::duration<double, std::micro> latency = probe.GetBreakInTime() - sent;
+		totalLatency += latency.count();
+		if (!measured || latency.count() > maxLatency)
+			maxLatency = latency.count();
+		if (!measured || latency.count() < minLatency)
+			minLatency = latency.count();
+		measured++;
+	}
+
+	shutdown(sockets[1], SHUT_RDWR);
+	sessionThread.join();
+	close(sockets[0]);
+	close(sockets[1]);
+
+	printf("%-24s %12.1f %12.1f %12.1f\n", pDescription, minLatency, measured ? totalLatency / measured : 0, maxLatency);
+}
+
+#endif
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	unsigned iterations = 1000000;
+	if (argc >= 2)
+		iterations = _tcstoul(argv[1], NULL, 0);
+
+	printf("%-24s %12s %12s %9s\n", "Packets/second", "GDBStub", "GDBStubT", "Speedup");
+	CompareStubs("Single step (s)", "s", iterations);
+	CompareStubs("Stop reason (?)", "?", iterations);
+	CompareStubs("Registers (g)", "g", iterations);
+	CompareStubs("Memory read (m, 4)", "m1000,4", iterations);
+	CompareStubs("Memory read (m, 64)", "m1000,40", iterations);
+	CompareStubs("Memory read (m, 1024)", "m1000,400", iterations / 4);
+	CompareStubs("Memory write (M, 4)", "M1000,4:01020304", iterations);
+
+	//Handling the packets sent while single-stepping should not allocate heap memory once the caches reach their steady-state size
+	static const char *steppingPackets[] = {"s", "?", "g"};
+	static const char *attachPackets[] = {"?", "g"};
+	bool allocationsPassed = true;
+
+	printf("\n%-24s %12s %12s\n", "Heap allocations", "GDBStub", "GDBStubT");
+	allocationsPassed &= CheckSteadyStateAllocations("Single step (s?g)", steppingPackets, __countof(steppingPackets), false, false, iterations / 10 + 1);
+	allocationsPassed &= CheckSteadyStateAllocations("With register cache", steppingPackets, __countof(steppingPackets), true, false, iterations / 10 + 1);
+	allocationsPassed &= CheckSteadyStateAllocations("Startup snapshot (?g)", attachPackets, __countof(attachPackets), false, true, iterations / 10 + 1);
+
+	printf("\n%-24s %12s %12s %9s\n", "Connections/second", "GDBStub", "GDBStubT", "Speedup");
+	CompareConnectionSetup("Capabilities probed", false, false, iterations / 100 + 1);
+	CompareConnectionSetup("Capabilities reported", true, false, iterations / 100 + 1);
+	CompareConnectionSetup("Startup snapshot", true, true, iterations / 100 + 1);
+
+#ifdef __linux__
+	printf("\n%-24s %12s %12s %12s\n", "Break-in latency (us)", "Min", "Average", "Max");
+	MeasureBreakInLatency("poll() detector", true, iterations / 1000 + 1);
+	MeasureBreakInLatency("Worker thread", false, iterations / 1000 + 1);
+#endif
+	return allocationsPassed ? 0 : 1;
+}
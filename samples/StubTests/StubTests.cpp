@@ -0,0 +1,1099 @@
+/*
+	Regression tests for the protocol handling: the packet encoders and the sessions that cannot be covered by feeding packets
+	directly to the stub.
+
+	Each test prints its name and the result. The program returns the amount of failed tests, so it can be run from a build script.
+	The tests running a GDB session use GDBServer::HandleConnection() over a Unix socket pair (or the event-driven server listening on
+	a Unix socket) and are only built on Linux, as well as the tests of the Linux transports (FDTransport and SerialTransport).
+
+	Usage:
+		StubTests
+*/
+
+#include "stdafx.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include "../../GDBStub.h"
+#include "../../GDBServer.h"
+#include "../../GDBPacketCodec.h"
+
+using namespace GDBServerFoundation;
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+//! Shared between a TestTarget and the test, as the target is deleted together with the stub when the session ends
+class TestTargetState
+{
+private:
+	std::mutex m_Lock;
+	std::condition_variable m_StateChanged;
+	bool m_bBreakInRequested;
+	unsigned m_ResumeCount, m_InterruptedResumeCount;
+
+public:
+	enum {kResumeTimeoutMsec = 2000};
+
+	//! Makes each memory read take the given time, so that the packets sent by GDB meanwhile are queued
+	unsigned MemoryReadDelayInUsec;
+	//! If nonzero, the target has a FLASH region at kFLASHBase and erasing it takes the given time
+	unsigned FLASHEraseDelayInMsec;
+	unsigned FLASHEraseCount;
+
+	enum {kFLASHBase = 0x08000000, kFLASHSize = 0x10000};
+
+	TestTargetState()
+		: m_bBreakInRequested(false)
+		, m_ResumeCount(0)
+		, m_InterruptedResumeCount(0)
+		, MemoryReadDelayInUsec(0)
+		, FLASHEraseDelayInMsec(0)
+		, FLASHEraseCount(0)
+	{
+	}
+
+	//! Simulates a running target that only stops when a break-in request arrives. A request sent before the target resumes stops it immediately.
+	void RunUntilBreakIn()
+	{
+		std::unique_lock<std::mutex> lck(m_Lock);
+		m_ResumeCount++;
+		if (m_StateChanged.wait_for(lck, std::chrono::milliseconds(kResumeTimeoutMsec), [this]() {return m_bBreakInRequested;}))
+			m_InterruptedResumeCount++;
+		m_bBreakInRequested = false;
+	}
+
+	void OnBreakInRequest()
+	{
+		std::lock_guard<std::mutex> lck(m_Lock);
+		m_bBreakInRequested = true;
+		m_StateChanged.notify_all();
+	}
+
+	//! Returns the amount of times the target was resumed and the amount of times it was stopped by a break-in request
+	void GetResumeCounts(unsigned *pResumed, unsigned *pInterrupted)
+	{
+		std::lock_guard<std::mutex> lck(m_Lock);
+		*pResumed = m_ResumeCount;
+		*pInterrupted = m_InterruptedResumeCount;
+	}
+};
+
+//! A target with a few registers. Each byte of its memory contains the lower byte of its address.
+class TestTarget : public MinimalTargetBase, public IFLASHProgrammer
+{
+private:
+	TestTargetState *m_pState;
+
+public:
+	TestTarget(TestTargetState *pState)
+		: m_pState(pState)
+	{
+	}
+
+	virtual const PlatformRegisterList *GetRegisterList()
+	{
+		static const RegisterEntry registers[] = {
+			{0, "eax", 32},
+			{1, "esp", 32},
+			{2, "eip", 32},
+		};
+		static const PlatformRegisterList list = {__countof(registers), registers};
+		return &list;
+	}
+
+	virtual GDBStatus ReadTargetRegisters(int threadID, RegisterSetContainer &registers)
+	{
+		for (size_t i = 0; i < GetRegisterList()->RegisterCount; i++)
+			registers[i] = RegisterValue(0, 4);
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus WriteTargetRegisters(int threadID, const RegisterSetContainer &registers)
+	{
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus ReadTargetMemory(ULONGLONG Address, void *pBuffer, size_t *pSizeInBytes)
+	{
+		if (m_pState->MemoryReadDelayInUsec)
+			usleep(m_pState->MemoryReadDelayInUsec);
+		for (size_t i = 0; i < *pSizeInBytes; i++)
+			((unsigned char *)pBuffer)[i] = (unsigned char)(Address + i);
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus WriteTargetMemory(ULONGLONG Address, const void *pBuffer, size_t sizeInBytes)
+	{
+		return kGDBUnknownError;
+	}
+
+	virtual GDBStatus GetLastStopRecord(TargetStopRecord *pRec)
+	{
+		pRec->Reason = kSignalReceived;
+		pRec->ThreadID = 1;
+		pRec->Extension.SignalNumber = SIGINT;
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus ResumeAndWait(int threadID)
+	{
+		m_pState->RunUntilBreakIn();
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus Step(int threadID)
+	{
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus SendBreakInRequestAsync()
+	{
+		m_pState->OnBreakInRequest();
+		return kGDBSuccess;
+	}
+
+	virtual IFLASHProgrammer *GetFLASHProgrammer()
+	{
+		return m_pState->FLASHEraseDelayInMsec ? this : NULL;
+	}
+
+	virtual GDBStatus GetEmbeddedMemoryRegions(std::vector<EmbeddedMemoryRegion> &regions)
+	{
+		EmbeddedMemoryRegion region;
+		region.Type = mtFLASH;
+		region.Start = TestTargetState::kFLASHBase;
+		region.Length = TestTargetState::kFLASHSize;
+		region.ErasureBlockSize = 0x1000;
+		regions.push_back(region);
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus EraseFLASH(ULONGLONG Address, size_t length)
+	{
+		m_pState->FLASHEraseCount++;
+		usleep(m_pState->FLASHEraseDelayInMsec * 1000);
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus WriteFLASH(ULONGLONG Address, const void *pBuffer, size_t length)
+	{
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus CommitFLASHWrite()
+	{
+		return kGDBSuccess;
+	}
+};
+
+//! A stub that does not report its blocking calls, so the server detects the break-in requests with the BreakInSocket worker thread
+class UnmonitoredGDBStub : public GDBStub
+{
+public:
+	UnmonitoredGDBStub(ISyncGDBTarget *pTarget)
+		: GDBStub(pTarget)
+	{
+	}
+
+	virtual bool SetBreakInMonitor(IBreakInMonitor *pMonitor) override
+	{
+		return false;
+	}
+};
+
+class TestStubFactory : public IGDBStubFactory
+{
+private:
+	TestTargetState *m_pState;
+	bool m_bReportBlocking;
+
+public:
+	TestStubFactory(TestTargetState *pState, bool reportBlocking)
+		: m_pState(pState)
+		, m_bReportBlocking(reportBlocking)
+	{
+	}
+
+	virtual IGDBStub *CreateStub(GDBServer *pServer)
+	{
+		if (m_bReportBlocking)
+			return new GDBStub(new TestTarget(m_pState));
+		return new UnmonitoredGDBStub(new TestTarget(m_pState));
+	}
+
+	virtual void OnProtocolError(const TCHAR *errorDescription)
+	{
+	}
+};
+
+//! Runs GDBServer::HandleConnection() on one end of a Unix socket pair. The test plays GDB on the other end.
+class TestSession
+{
+private:
+	enum {kReplyTimeoutMsec = 5000};
+
+	int m_Sockets[2];
+	TestStubFactory m_Factory;
+	GDBServer m_Server;
+	FDTransport *m_pTransport;
+	std::thread m_SessionThread;
+
+public:
+	TestSession(TestTargetState *pState, bool reportBlocking, unsigned readAheadPacketCount = GDBServer::kDefaultReadAheadPacketCount)
+		: m_Factory(pState, reportBlocking)
+		, m_Server(&m_Factory, false)
+		, m_pTransport(NULL)
+	{
+		m_Sockets[0] = m_Sockets[1] = -1;
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, m_Sockets))
+			return;
+
+		m_Server.SetReadAheadPacketCount(readAheadPacketCount);
+		m_pTransport = new FDTransport(m_Sockets[0], m_Sockets[0], false);
+		m_SessionThread = std::thread([this]() {m_Server.HandleConnection(m_pTransport);});
+	}
+
+	~TestSession()
+	{
+		Disconnect();
+		delete m_pTransport;
+		for (int i = 0; i < 2; i++)
+			if (m_Sockets[i] != -1)
+				close(m_Sockets[i]);
+	}
+
+	//! Closes the GDB end of the connection and waits until the session ends
+	void Disconnect()
+	{
+		if (m_Sockets[1] != -1)
+			shutdown(m_Sockets[1], SHUT_RDWR);
+		if (m_SessionThread.joinable())
+			m_SessionThread.join();
+	}
+
+	BreakInStatistics GetBreakInStatistics()
+	{
+		return m_Server.GetBreakInStatistics();
+	}
+
+	//! Enables the no-ack mode. GDB acknowledges the reply to 'QStartNoAckMode' as well.
+	bool StartNoAckMode()
+	{
+		return Send("+$QStartNoAckMode#b0") && ReceiveReply() == "OK" && Send("+");
+	}
+
+	//! Sends a packet with the given body, appending its checksum
+	bool SendPacket(const char *pBody)
+	{
+		unsigned char checksum = 0;
+		for (const char *p = pBody; *p; p++)
+			checksum += *p;
+
+		char trailer[4];
+		snprintf(trailer, sizeof(trailer), "#%02x", checksum);
+		return Send((std::string("$") + pBody + trailer).c_str());
+	}
+
+	//! Returns true if the next byte sent by the stub is an ACK received within the given time
+	bool ReceiveACK(unsigned timeoutMsec)
+	{
+		pollfd fd = {m_Sockets[1], POLLIN, 0};
+		char ch;
+		return poll(&fd, 1, timeoutMsec) == 1 && read(m_Sockets[1], &ch, 1) == 1 && ch == '+';
+	}
+
+	//! Sends the raw data (e.g. several packets or a packet followed by 0x03) with a single call
+	bool Send(const char *pData, size_t size)
+	{
+		return m_pTransport && write(m_Sockets[1], pData, size) == (ssize_t)size;
+	}
+
+	bool Send(const char *pData)
+	{
+		return Send(pData, strlen(pData));
+	}
+
+	//! Receives the data sent by the stub until the end of the next packet. Returns the packet body or an empty string on timeout.
+	std::string ReceiveReply()
+	{
+		std::string reply;
+		int checksumBytes = -1;
+		while (checksumBytes)
+		{
+			pollfd fd = {m_Sockets[1], POLLIN, 0};
+			char ch;
+			if (poll(&fd, 1, kReplyTimeoutMsec) != 1 || read(m_Sockets[1], &ch, 1) != 1)
+				return std::string();
+			if (checksumBytes > 0)
+				checksumBytes--;
+			else if (ch == '#')
+				checksumBytes = 2;
+			else if (!reply.empty() || ch == '$')
+				reply += ch;
+		}
+		return reply.substr(1);
+	}
+};
+
+//! Sends "$c#63" and 0x03 with a single write and checks that the target is stopped by the break-in request rather than by the timeout
+static bool TestBreakInSentWithContinue(bool reportBlocking, bool noAckMode, unsigned readAheadPacketCount)
+{
+	static const char breakInAfterContinue[] = "$c#63\x03";
+	TestTargetState targetState;
+
+	{
+		TestSession session(&targetState, reportBlocking, readAheadPacketCount);
+		if (noAckMode)
+		{
+			if (!session.StartNoAckMode())
+				return false;
+		}
+		else if (!session.Send("+$?#3f") || session.ReceiveReply().empty() || !session.Send("+"))
+			return false;
+
+		if (!session.Send(breakInAfterContinue, sizeof(breakInAfterContinue) - 1) || session.ReceiveReply().empty())
+			return false;
+	}
+
+	unsigned resumed, interrupted;
+	targetState.GetResumeCounts(&resumed, &interrupted);
+	return resumed == 1 && interrupted == 1;
+}
+
+//! Erases FLASH for longer than GDB would wait for the ACK in the ack mode. The ACK should arrive before the erase completes.
+static bool TestSlowRequestACK()
+{
+	enum {kEraseDelayInMsec = 500, kACKTimeoutMsec = 200};
+	TestTargetState targetState;
+	targetState.FLASHEraseDelayInMsec = kEraseDelayInMsec;
+	TestSession session(&targetState, true);
+
+	if (!session.Send("+") || !session.SendPacket("vFlashErase:8000000,1000"))
+		return false;
+
+	if (!session.ReceiveACK(kACKTimeoutMsec))
+	{
+		printf("The ACK was not sent before handling the request\n");
+		return false;
+	}
+
+	//A fast request still gets its ACK together with the reply
+	if (session.ReceiveReply() != "OK" || !session.Send("+") || !session.SendPacket("m1000,2") || !session.ReceiveACK(kACKTimeoutMsec))
+		return false;
+	return session.ReceiveReply() == "0001" && targetState.FLASHEraseCount == 1;
+}
+
+//! Disconnects while the target is running and checks that the target is stopped without counting a break-in request
+static bool TestDisconnectWhileRunning()
+{
+	TestTargetState targetState;
+	TestSession session(&targetState, true, 0);
+	if (!session.Send("+$c#63"))
+		return false;
+
+	session.Disconnect();
+
+	unsigned resumed, interrupted;
+	targetState.GetResumeCounts(&resumed, &interrupted);
+	return resumed == 1 && interrupted == 1 && session.GetBreakInStatistics().BreakInCount == 0;
+}
+
+//! Checks the SigIgn mask of the process. <signal.h> is not included, as its macros would replace the UnixSignal values.
+static bool IsSIGPIPEIgnored()
+{
+	enum {kSIGPIPE = 13};
+	unsigned long long ignoredSignals = 0;
+	char line[256];
+
+	FILE *fp = fopen("/proc/self/status", "r");
+	if (!fp)
+		return false;
+	while (fgets(line, sizeof(line), fp))
+		if (sscanf(line, "SigIgn: %llx", &ignoredSignals) == 1)
+			break;
+	fclose(fp);
+
+	return (ignoredSignals & (1ULL << (kSIGPIPE - 1))) != 0;
+}
+
+//! Sends a burst of 'm' packets in the no-ack mode, split into writes of different sizes, so that the packets are received by the
+//! read-ahead thread in pieces while the previous ones are still queued. Checks that each reply matches its own request.
+static bool TestReadAheadBurst()
+{
+	enum {kPacketCount = 500};
+	TestTargetState targetState;
+	targetState.MemoryReadDelayInUsec = 100;
+	TestSession session(&targetState, true);
+	if (!session.StartNoAckMode())
+		return false;
+
+	std::string burst;
+	char packet[64], body[32];
+	for (unsigned i = 0; i < kPacketCount; i++)
+	{
+		snprintf(body, sizeof(body), "m%x,%x", 0x1000 + i * 7, 1 + i % 16);
+		unsigned char checksum = 0;
+		for (const char *p = body; *p; p++)
+			checksum += *p;
+		snprintf(packet, sizeof(packet), "$%s#%02x", body, checksum);
+		burst += packet;
+	}
+
+	std::thread sender([&]()
+	{
+		//The data arrives at about the same rate as the packets are handled, so the reader thread often has to receive more while the queue is not empty
+		for (size_t offset = 0, chunk = 1; offset < burst.size(); offset += chunk, chunk = chunk % 37 + 1)
+		{
+			if (!session.Send(burst.data() + offset, std::min(chunk, burst.size() - offset)))
+				break;
+			usleep(targetState.MemoryReadDelayInUsec);
+		}
+	});
+
+	bool passed = true;
+	for (unsigned i = 0; i < kPacketCount && passed; i++)
+	{
+		std::string expected;
+		for (unsigned j = 0; j < 1 + i % 16; j++)
+		{
+			snprintf(body, sizeof(body), "%02x", (0x1000 + i * 7 + j) & 0xFF);
+			expected += body;
+		}
+		passed = session.ReceiveReply() == expected;
+	}
+
+	sender.join();
+	return passed;
+}
+
+//! Checks that a registered packet with invalid arguments gets an error reply, while an unknown packet gets an empty one
+static bool TestMalformedPackets()
+{
+	static const struct
+	{
+		const char *pRequest, *pExpectedReply;
+	} requests[] = {
+		{"m1000,2", "0001"},
+		{"mxyz,2", "EINVALIDARG"},
+		{"m1000", "EINVALIDARG"},
+		{"Z1,1000", "EINVALIDARG"},
+		{"qNoSuchPacket", ""},
+		{"y1000", ""},
+	};
+
+	TestTargetState targetState;
+	GDBStub stub(new TestTarget(&targetState));
+	bool ackEnabled = true;
+
+	for (size_t i = 0; i < __countof(requests); i++)
+	{
+		StubResponse response = PacketCodec::DispatchPacket(&stub, requests[i].pRequest, strlen(requests[i].pRequest), &ackEnabled);
+		if (std::string(response.GetData(), response.GetSize()) != requests[i].pExpectedReply)
+		{
+			printf("Unexpected reply to '%s'\n", requests[i].pRequest);
+			return false;
+		}
+	}
+	return true;
+}
+
+//! A target that cannot write the registers of thread 2 until FailWrites is cleared
+class FailingRegisterWriteTarget : public TestTarget
+{
+public:
+	bool FailWrites;
+	unsigned WriteCounts[3];
+	ULONGLONG WrittenValues[3];
+
+	FailingRegisterWriteTarget(TestTargetState *pState)
+		: TestTarget(pState)
+		, FailWrites(true)
+	{
+		memset(WriteCounts, 0, sizeof(WriteCounts));
+		memset(WrittenValues, 0, sizeof(WrittenValues));
+	}
+
+	virtual GDBStatus GetThreadList(std::vector<ThreadRecord> &threads)
+	{
+		for (int i = 1; i <= 2; i++)
+		{
+			ThreadRecord thread;
+			thread.ThreadID = i;
+			threads.push_back(thread);
+		}
+		return kGDBSuccess;
+	}
+
+	virtual GDBStatus WriteTargetRegisters(int threadID, const RegisterSetContainer &registers)
+	{
+		if (threadID < 1 || threadID > 2 || !registers[0].Valid)
+			return kGDBUnknownError;
+
+		WriteCounts[threadID]++;
+		if (threadID == 2 && FailWrites)
+			return kGDBUnknownError;
+
+		WrittenValues[threadID] = registers[0].ToUInt64();
+		return kGDBSuccess;
+	}
+};
+
+//! Modifies the registers of two threads and checks that the set that could not be written is written before the next resume.
+//! Querying the vCont modes does not resume the target, so it should not write the registers.
+static bool TestFailedRegisterFlush()
+{
+	static const char *modifyingRequests[] = {"Hg1", "P0=11111111", "Hg2", "P0=22222222"};
+
+	TestTargetState targetState;
+	FailingRegisterWriteTarget *pTarget = new FailingRegisterWriteTarget(&targetState);
+	GDBStub stub(pTarget);
+	bool ackEnabled = true;
+	stub.EnableRegisterCache();
+
+	for (size_t i = 0; i < __countof(modifyingRequests); i++)
+		if (!PacketCodec::DispatchPacket(&stub, modifyingRequests[i], strlen(modifyingRequests[i]), &ackEnabled).Equals("OK"))
+			return false;
+
+	StubResponse response = PacketCodec::DispatchPacket(&stub, "s", 1, &ackEnabled);
+	if (!response.GetSize() || response.GetData()[0] != 'E' || pTarget->WriteCounts[1] != 1 || pTarget->WriteCounts[2] != 1)
+		return false;
+
+	response = PacketCodec::DispatchPacket(&stub, "vCont?", 6, &ackEnabled);
+	if ((response.GetSize() && response.GetData()[0] == 'E') || pTarget->WriteCounts[2] != 1)
+		return false;
+
+	//Only the failed set is written again
+	pTarget->FailWrites = false;
+	response = PacketCodec::DispatchPacket(&stub, "s", 1, &ackEnabled);
+	if (!response.GetSize() || response.GetData()[0] != 'T')
+		return false;
+
+	return pTarget->WriteCounts[1] == 1 && pTarget->WriteCounts[2] == 2 && pTarget->WrittenValues[1] == 0x11111111 && pTarget->WrittenValues[2] == 0x22222222;
+}
+
+//! A target stopped at a software breakpoint. Its program counter is expedited, but not provided by ReadFrameRelatedRegisters().
+class BreakpointStopTarget : public TestTarget
+{
+public:
+	unsigned RegisterReadCount;
+
+	BreakpointStopTarget(TestTargetState *pState)
+		: TestTarget(pState)
+		, RegisterReadCount(0)
+	{
+	}
+
+	virtual const PlatformRegisterList *GetRegisterList()
+	{
+		static const RegisterEntry registers[] = {
+			{0, "eax", 32},
+			{1, "esp", 32},
+			{2, "eip", 32, rfExpedited},
+		};
+		static const PlatformRegisterList list = {__countof(registers), registers};
+		return &list;
+	}
+
+	virtual unsigned GetCapabilities()
+	{
+		return tcCapabilitiesKnown | tcBreakpointStopReasons;
+	}
+
+	virtual GDBStatus ReadTargetRegisters(int threadID, RegisterSetContainer &registers)
+	{
+		RegisterReadCount++;
+		return TestTarget::ReadTargetRegisters(threadID, registers);
+	}
+
+	virtual GDBStatus GetLastStopRecord(TargetStopRecord *pRec)
+	{
+		memset(pRec, 0, sizeof(*pRec));
+		pRec->Reason = kSignalReceived;
+		pRec->ThreadID = 1;
+		pRec->Extension.SignalNumber = SIGTRAP;
+		pRec->StoppedByBreakpoint = true;
+		pRec->BreakpointKind = bptSoftwareBreakpoint;
+		return kGDBSuccess;
+	}
+};
+
+//! Checks that the stop reply from the startup snapshot reports 'swbreak' negotiated after the snapshot was built, and that
+//! the registers are only read to report the expedited program counter if the register cache is enabled
+static bool TestSnapshotStopReply(bool useRegisterCache)
+{
+	static const char qSupported[] = "qSupported:swbreak+;hwbreak+";
+
+	TestTargetState targetState;
+	BreakpointStopTarget *pTarget = new BreakpointStopTarget(&targetState);
+	GDBStub stub(pTarget);
+	bool ackEnabled = true;
+	stub.EnableRegisterCache(useRegisterCache);
+	stub.EnableStartupSnapshot();
+	stub.OnConnectionAccepted();
+
+	//The snapshot reads all registers for the 'g' reply
+	pTarget->RegisterReadCount = 0;
+	PacketCodec::DispatchPacket(&stub, qSupported, sizeof(qSupported) - 1, &ackEnabled);
+	StubResponse response = PacketCodec::DispatchPacket(&stub, "?", 1, &ackEnabled);
+	std::string reply(response.GetData(), response.GetSize());
+	if (reply.find("swbreak:;") == std::string::npos)
+	{
+		printf("Unexpected stop reply: %s\n", reply.c_str());
+		return false;
+	}
+
+	bool pcReported = (reply.find("2:") != std::string::npos);
+	if (useRegisterCache)
+		return pcReported && pTarget->RegisterReadCount > 0;
+	return !pcReported && !pTarget->RegisterReadCount;
+}
+
+//! Writes to a pipe whose reading end has been closed. The transport should neither be terminated by SIGPIPE, nor make the whole process ignore it.
+static bool TestWriteToClosedPipe()
+{
+	int pipeFDs[2];
+	if (pipe(pipeFDs))
+		return false;
+	close(pipeFDs[0]);
+
+	bool sent;
+	{
+		FDTransport transport(-1, pipeFDs[1], true);
+		sent = transport.Send("+", 1);
+	}
+
+	return !sent && !IsSIGPIPEIgnored();
+}
+
+//! Receives a packet from a blocking socket and expands the RLE sequences. Returns the packet body or an empty string if the connection was closed.
+static std::string ReceiveDecodedPacket(int sock)
+{
+	std::string body;
+	char ch;
+	do
+	{
+		if (read(sock, &ch, 1) != 1)
+			return std::string();
+	} while (ch != '$');
+
+	for (;;)
+	{
+		if (read(sock, &ch, 1) != 1)
+			return std::string();
+		if (ch == '#')
+			break;
+		if (ch == '*' && !body.empty())
+		{
+			char count;
+			if (read(sock, &count, 1) != 1)
+				return std::string();
+			body.append(count - 29, body[body.size() - 1]);
+		}
+		else
+			body += ch;
+	}
+
+	char checksum[2];
+	if (read(sock, checksum, 2) != 2)
+		return std::string();
+	return body;
+}
+
+//! Requests a long streamed 'm' reply from the event-driven server. Checks that the reply starts before the whole block is read from the
+//! target, that it is intact, and that a packet received while it was being sent is handled afterwards.
+static bool TestEventDrivenStreamedReply()
+{
+	enum {kChunkDelayInUsec = 30000, kReadSize = 32 * GDBStub::kMemoryReadChunkSize, kFirstPartTimeoutMsec = 300};
+	TestTargetState targetState;
+	targetState.MemoryReadDelayInUsec = kChunkDelayInUsec;
+	TestStubFactory factory(&targetState, true);
+
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/StubTests-%d.sock", (int)getpid());
+	unlink(path);
+
+	bool passed = false;
+	{
+		GDBServer server(&factory, false);
+		if (!server.StartUnixSocket(path, 1, 2).Successful())
+			return false;
+
+		sockaddr_un addr = {0, };
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+		int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (sock != -1 && !connect(sock, (sockaddr *)&addr, sizeof(addr)))
+		{
+			timeval timeout = {5, 0};
+			setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+			char request[64];
+			snprintf(request, sizeof(request), "m0,%x", kReadSize);
+			unsigned char checksum = 0;
+			for (const char *p = request; *p; p++)
+				checksum += *p;
+
+			std::string packet = std::string("+$") + request;
+			snprintf(request, sizeof(request), "#%02x", checksum);
+			packet += request;
+
+			pollfd fd = {sock, POLLIN, 0};
+			char ack[2];
+			bool started = write(sock, packet.data(), packet.size()) == (ssize_t)packet.size() && poll(&fd, 1, kFirstPartTimeoutMsec) == 1 &&
+				read(sock, ack, 1) == 1 && ack[0] == '+' && poll(&fd, 1, kFirstPartTimeoutMsec) == 1;
+			if (!started)
+				printf("The reply was not started before reading the entire block\n");
+
+			//Queued while the reply is being sent. The stub should only handle it once the reply is complete.
+			const char nextRequest[] = "+$m1000,2#8c";
+			bool queued = write(sock, nextRequest, sizeof(nextRequest) - 1) == sizeof(nextRequest) - 1;
+
+			std::string expected;
+			for (unsigned i = 0; i < kReadSize; i++)
+			{
+				snprintf(request, sizeof(request), "%02x", i & 0xFF);
+				expected += request;
+			}
+
+			passed = started && queued && ReceiveDecodedPacket(sock) == expected && read(sock, ack, 1) == 1 && ack[0] == '+' &&
+				ReceiveDecodedPacket(sock) == "0001";
+		}
+
+		if (sock != -1)
+			close(sock);
+	}
+
+	unlink(path);
+	return passed;
+}
+
+//! Sends a packet larger than the tty buffer over a pseudo-terminal with SerialTransport and receives a request from the other side
+static bool TestSerialTransportOverPTY()
+{
+	enum {kBaudRate = 115200, kReplySize = 5000};
+
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master == -1 || grantpt(master) || unlockpt(master))
+		return false;
+
+	BazisLib::ActionStatus status;
+	SerialTransport transport(ptsname(master), kBaudRate, &status);
+	if (!status.Successful() || transport.IsReliable())
+	{
+		close(master);
+		return false;
+	}
+
+	//115200 baud is ~11520 bytes per second, so 8KB is the largest power of 2 within SerialTransport::kMaxPacketTransferTimeInMs
+	bool passed = transport.GetPreferredMaxPacketSize() == 0x2000;
+
+	std::string reply(kReplySize, 0);
+	for (size_t i = 0; i < reply.size(); i++)
+		reply[i] = 'a' + i % 26;
+
+	DataSegment segments[] = {{"$", 1}, {reply.data(), reply.size()}, {"#00", 3}};
+	std::string expected = std::string("$") + reply + "#00", received;
+
+	//The tty buffer is smaller than the packet, so the sender blocks until the other side reads the data
+	std::thread sender([&]()
+	{
+		size_t first = 0;
+		while (first < __countof(segments))
+		{
+			size_t done = transport.SendSegments(segments + first, __countof(segments) - first);
+			if (!done)
+				break;
+			for (; first < __countof(segments) && done >= segments[first].Length; first++)
+				done -= segments[first].Length;
+			if (first < __countof(segments))
+			{
+				segments[first].pData += done;
+				segments[first].Length -= done;
+			}
+		}
+	});
+
+	char buffer[4096];
+	while (received.size() < expected.size())
+	{
+		pollfd fd = {master, POLLIN, 0};
+		ssize_t done = (poll(&fd, 1, 5000) == 1) ? read(master, buffer, sizeof(buffer)) : 0;
+		if (done <= 0)
+			break;
+		received.append(buffer, done);
+	}
+	sender.join();
+	passed = passed && received == expected;
+
+	static const char request[] = "$g#67";
+	if (write(master, request, sizeof(request) - 1) != sizeof(request) - 1)
+		passed = false;
+
+	std::string receivedRequest;
+	while (passed && receivedRequest.size() < sizeof(request) - 1)
+	{
+		size_t done = transport.Receive(buffer, sizeof(buffer));
+		if (!done)
+			break;
+		receivedRequest.append(buffer, done);
+	}
+
+	close(master);
+	return passed && receivedRequest == request;
+}
+
+#endif
+
+//! Encodes the reply with EncodePacket() and ScatterGatherEncoder and compares the results with EncodePacketReference()
+static bool CompareEncoders(PacketCodec::ScatterGatherEncoder &encoder, const char *pReply, size_t replySize)
+{
+	BazisLib::BasicBuffer reference, encoded;
+	PacketCodec::EncodePacketReference(pReply, replySize, reference);
+	PacketCodec::EncodePacket(pReply, replySize, encoded);
+
+	std::string gathered;
+	encoder.Encode(pReply, replySize, false);
+	for (size_t i = 0; i < encoder.GetPendingSegmentCount(); i++)
+		gathered.append(encoder.GetPendingSegments()[i].pData, encoder.GetPendingSegments()[i].Length);
+
+	std::string expected((const char *)reference.GetConstData(), reference.GetSize());
+	if (expected == std::string((const char *)encoded.GetConstData(), encoded.GetSize()) && expected == gathered)
+		return true;
+
+	printf("Encoder mismatch for a %u-byte reply\n", (unsigned)replySize);
+	return false;
+}
+
+//! Checks the runs of all lengths up to the longest one that can be encoded, the runs whose RLE count would be '#', '$' or '}'
+//! (lengths 7, 8 and 97) and the escaped characters around the 16- and 32-byte block boundaries of the vectorized encoder
+static bool TestEncoderEdgeCases()
+{
+	static const char filler[] = "0123456789abcdef";
+	static const char specialChars[] = {'#', '$', '}', '*', '\0', 'R'};
+	enum {kMaxPrefix = 40, kMaxRunLength = 130, kReplySize = 100};
+
+	PacketCodec::ScatterGatherEncoder encoder;
+	std::string reply;
+	if (!CompareEncoders(encoder, "", 0))
+		return false;
+
+	//Runs preceded by prefixes of different length, so that they start and end at every offset within a block
+	for (size_t prefix = 0; prefix <= kMaxPrefix; prefix++)
+		for (size_t runLength = 1; runLength <= kMaxRunLength; runLength++)
+			for (size_t i = 0; i < sizeof(specialChars); i++)
+			{
+				reply.clear();
+				for (size_t j = 0; j < prefix; j++)
+					reply += filler[j % (sizeof(filler) - 1)];
+				reply.append(runLength, specialChars[i]);
+				reply += '0';
+				if (!CompareEncoders(encoder, reply.data(), reply.size()))
+					return false;
+			}
+
+	//A single escaped character at every offset, and a pair of them straddling each offset
+	for (size_t offset = 0; offset < kReplySize; offset++)
+		for (size_t i = 0; i < sizeof(specialChars); i++)
+			for (size_t count = 1; count <= 2; count++)
+			{
+				reply.clear();
+				for (size_t j = 0; j < kReplySize; j++)
+					reply += filler[j % (sizeof(filler) - 1)];
+				for (size_t j = 0; j < count && offset + j < kReplySize; j++)
+					reply[offset + j] = specialChars[i];
+				if (!CompareEncoders(encoder, reply.data(), reply.size()))
+					return false;
+			}
+
+	return true;
+}
+
+//! Compares the encoders on random replies. Some of them only contain a few distinct characters, so that they have many runs and escaped characters.
+static bool TestEncoderRandomReplies(unsigned iterations)
+{
+	static const char alphabet[] = "0000000aaf#$}*x";
+	enum {kMaxReplySize = 3000};
+
+	PacketCodec::ScatterGatherEncoder encoder;
+	std::string reply;
+	unsigned seed = 1;
+
+	for (unsigned iteration = 0; iteration < iterations; iteration++)
+	{
+		//A simple LCG keeps the replies the same on every platform
+		seed = seed * 1103515245 + 12345;
+		size_t size = (seed >> 8) % kMaxReplySize;
+		unsigned alphabetSize = 2 + iteration % (sizeof(alphabet) - 2);
+
+		reply.resize(size);
+		for (size_t i = 0; i < size; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			reply[i] = (iteration % 4 == 3) ? (char)(seed >> 16) : alphabet[(seed >> 16) % alphabetSize];
+		}
+
+		if (!CompareEncoders(encoder, reply.data(), reply.size()))
+			return false;
+	}
+
+	return true;
+}
+
+//! Counts the memory reads that reach the target. Each byte of its memory contains the lower byte of its address.
+class CountingMemoryTarget
+{
+public:
+	unsigned ReadCount;
+
+	CountingMemoryTarget()
+		: ReadCount(0)
+	{
+	}
+
+	GDBStatus ReadTargetMemory(ULONGLONG Address, void *pBuffer, size_t *pSizeInBytes)
+	{
+		ReadCount++;
+		for (size_t i = 0; i < *pSizeInBytes; i++)
+			((unsigned char *)pBuffer)[i] = (unsigned char)(Address + i);
+		return kGDBSuccess;
+	}
+};
+
+//! Fills the whole cache with FLASH pages and checks that the stack pages read afterwards are still cached
+static bool TestPersistentPagesDoNotStarveCache()
+{
+	enum {kPageSize = 256, kMaxPages = 8, kFLASHBase = 0x08000000, kStackBase = 0x20000000};
+
+	TargetMemoryCache cache;
+	CountingMemoryTarget target;
+	unsigned char buffer[kPageSize * 2];
+	size_t size;
+
+	cache.Configure(kPageSize, kPageSize * kMaxPages);
+	cache.AddPersistentRegion(kFLASHBase, kPageSize * kMaxPages * 2);
+	cache.Enable();
+
+	for (unsigned i = 0; i < kMaxPages; i++)
+	{
+		size = kPageSize;
+		if (cache.Read(target, kFLASHBase + i * kPageSize, buffer, &size) != kGDBSuccess)
+			return false;
+	}
+
+	//The stack pages evict the FLASH ones, so the second read is served from the cache
+	for (int pass = 0; pass < 2; pass++)
+	{
+		target.ReadCount = 0;
+		size = sizeof(buffer);
+		if (cache.Read(target, kStackBase + 0x80, buffer, &size) != kGDBSuccess || size != sizeof(buffer) || buffer[0] != 0x80)
+			return false;
+		if (target.ReadCount != (pass ? 0U : 1U))
+		{
+			printf("Stack read pass %d reached the target %u times\n", pass, target.ReadCount);
+			return false;
+		}
+	}
+
+	//The remaining FLASH pages are still kept when the target is resumed
+	cache.Invalidate();
+	target.ReadCount = 0;
+	size = kPageSize;
+	if (cache.Read(target, kFLASHBase + (kMaxPages - 1) * kPageSize, buffer, &size) != kGDBSuccess || target.ReadCount)
+		return false;
+
+	return cache.GetStatistics().Evictions == 3;
+}
+
+//! Checks that TargetMemoryCache::Prefetch() reads every run of missing pages and that StackPrefetcher only counts the windows actually read
+static bool TestStackPrefetch()
+{
+	enum {kPageSize = 256, kStackPointer = 0x20001000};
+
+	TargetMemoryCache cache;
+	CountingMemoryTarget target;
+	StackPrefetcher prefetcher;
+	RegisterSetContainer registers(1);
+	unsigned char buffer[4];
+	size_t size = sizeof(buffer);
+
+	cache.Configure(kPageSize);
+	prefetcher.AddWindow(0, 0, kPageSize * 4);
+	registers[0] = RegisterValue(kStackPointer, 4);
+
+	//Nothing is read while the cache is disabled
+	prefetcher.Prefetch(target, cache, registers);
+	prefetcher.OnTargetResumed();
+	if (target.ReadCount || prefetcher.GetStatistics(0).Prefetches || prefetcher.GetStatistics(0).UnusedPrefetches)
+		return false;
+
+	//The second page of the window is cached, so the two missing runs around it are read separately
+	cache.Enable();
+	if (cache.Read(target, kStackPointer + kPageSize, buffer, &size) != kGDBSuccess)
+		return false;
+
+	target.ReadCount = 0;
+	prefetcher.Prefetch(target, cache, registers);
+	if (target.ReadCount != 2 || prefetcher.GetStatistics(0).Prefetches != 1)
+	{
+		printf("The window was read with %u target calls\n", target.ReadCount);
+		return false;
+	}
+
+	target.ReadCount = 0;
+	for (unsigned i = 0; i < 4; i++)
+	{
+		size = sizeof(buffer);
+		if (cache.Read(target, kStackPointer + i * kPageSize, buffer, &size) != kGDBSuccess || buffer[0] != 0)
+			return false;
+		prefetcher.OnMemoryRead(kStackPointer + i * kPageSize, size);
+	}
+
+	prefetcher.OnTargetResumed();
+	return !target.ReadCount && prefetcher.GetStatistics(0).Hits == 4 && !prefetcher.GetStatistics(0).UnusedPrefetches;
+}
+
+static unsigned s_FailedTests;
+
+static void ReportResult(const char *pTestName, bool passed)
+{
+	printf("%-56s %s\n", pTestName, passed ? "passed" : "FAILED");
+	if (!passed)
+		s_FailedTests++;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+#ifdef __linux__
+	ReportResult("Break-in sent with 'c' (poll() detector)", TestBreakInSentWithContinue(true, false, GDBServer::kDefaultReadAheadPacketCount));
+	ReportResult("Break-in sent with 'c' (worker thread)", TestBreakInSentWithContinue(false, false, GDBServer::kDefaultReadAheadPacketCount));
+	ReportResult("Break-in sent with 'c' (no-ack mode, no read-ahead)", TestBreakInSentWithContinue(true, true, 0));
+	ReportResult("Break-in sent with 'c' (no-ack mode, read-ahead)", TestBreakInSentWithContinue(true, true, GDBServer::kDefaultReadAheadPacketCount));
+	ReportResult("Disconnect while the target is running", TestDisconnectWhileRunning());
+	ReportResult("ACK for a slow request in the ack mode", TestSlowRequestACK());
+	ReportResult("Read-ahead of a fragmented burst of packets", TestReadAheadBurst());
+	ReportResult("Malformed and unknown packets", TestMalformedPackets());
+	ReportResult("Failed register writes are retried", TestFailedRegisterFlush());
+	ReportResult("Snapshot stop reply (no register cache)", TestSnapshotStopReply(false));
+	ReportResult("Snapshot stop reply (register cache)", TestSnapshotStopReply(true));
+	ReportResult("Event-driven server: streamed 'm' reply", TestEventDrivenStreamedReply());
+	ReportResult("Writing to a closed pipe", TestWriteToClosedPipe());
+	ReportResult("Serial transport over a pseudo-terminal", TestSerialTransportOverPTY());
+#endif
+	ReportResult("Encoder: runs and escapes at block boundaries", TestEncoderEdgeCases());
+	ReportResult("Encoder: random replies", TestEncoderRandomReplies(20000));
+	ReportResult("Memory cache: FLASH pages do not starve the stack", TestPersistentPagesDoNotStarveCache());
+	ReportResult("Stack prefetch: missing runs and statistics", TestStackPrefetch());
+	return (int)s_FailedTests;
+}